@@ -9,11 +9,26 @@
 #ifndef DYNOBJECT_HPP
 #define DYNOBJECT_HPP
 
+#include <algorithm>
 #include <any>
+#include <array>
+#include <charconv>
+#include <coroutine>
+#include <cstdio>
+#include <atomic>
+#include <bit>
+#include <climits>
+#include <cmath>
 #include <expected>
+#include <map>
 #include <variant>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -21,6 +36,25 @@
 #include <vector>
 #include <sstream>
 #include <iomanip>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DYNOBJECT_HAVE_MMAP 1
+#endif
+
+#ifdef DYNOBJECT_MULTITHREADED
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#endif
 
 namespace dog0752
 {
@@ -28,8 +62,6 @@ namespace dynobj
 {
 
 #ifdef DYNOBJECT_MULTITHREADED
-#include <mutex>
-#include <shared_mutex>
 /* use real mutexes and lock guards */
 using factory_mutex_t = std::mutex;
 using object_mutex_t = std::shared_mutex;
@@ -62,438 +94,9343 @@ template <typename T>
 using shared_lock_t = DummyLock<T>;
 #endif
 
-class ObjectFactory
+/**
+ * what a factory allocates, used to route each kind of allocation to its
+ * own memory resource
+ */
+enum class AllocKind
 {
-private:
-	class Shape : public std::enable_shared_from_this<Shape>
+	objects,  /* the DynObject itself */
+	shapes,	  /* shapes, their shared_ptr control blocks and transitions */
+	slots,	  /* the values_ storage of objects */
+	interner, /* interned strings and the lookup table */
+	count_	  /* number of kinds, keep last */
+};
+
+/**
+ * the memory resources an ObjectFactory allocates from, one per kind.
+ * all of them default to the global default resource.
+ *
+ * note that whatever a std::any or a std::function allocates for a stored
+ * value can't be redirected, those always use the global operator new
+ */
+struct FactoryResources
+{
+	std::pmr::memory_resource *objects = std::pmr::get_default_resource();
+	std::pmr::memory_resource *shapes = std::pmr::get_default_resource();
+	std::pmr::memory_resource *slots = std::pmr::get_default_resource();
+	std::pmr::memory_resource *interner = std::pmr::get_default_resource();
+
+	/* everything from a single resource */
+	static FactoryResources all(std::pmr::memory_resource *resource)
 	{
-	public:
-		/* constructor for the root shape */
-		Shape()
-			: parent_(nullptr), property_key_(0),
-			  offset_(static_cast<size_t>(-1))
+		return {resource, resource, resource, resource};
+	}
+};
+
+/**
+ * a memory resource that forwards to an upstream resource and counts
+ * what goes through it, per AllocKind. hand resources() to a factory:
+ *
+ *   CountingResource counter;
+ *   ObjectFactory factory(counter.resources());
+ *   ...
+ *   counter.stats(AllocKind::shapes).allocations
+ *
+ * allocations made directly through the counter itself (not through one
+ * of the per kind views) are not attributed to any kind but still show up
+ * in total()
+ */
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+	struct Stats
+	{
+		size_t allocations = 0;
+		size_t deallocations = 0;
+		size_t bytes_allocated = 0; /* total over the whole lifetime */
+		size_t bytes_in_use = 0;	/* allocated minus deallocated */
+	};
+
+	explicit CountingResource(
+		std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+		: upstream_(upstream)
+	{
+		for (size_t i = 0; i < views_.size(); ++i)
+			views_[i].init(this, i);
+	}
+
+	CountingResource(const CountingResource &) = delete;
+	CountingResource &operator=(const CountingResource &) = delete;
+
+	/* the counting view for one kind of allocation */
+	std::pmr::memory_resource *resource(AllocKind kind)
+	{
+		return &views_[static_cast<size_t>(kind)];
+	}
+
+	/* one counting view per kind, ready to pass to an ObjectFactory */
+	FactoryResources resources()
+	{
+		return {resource(AllocKind::objects), resource(AllocKind::shapes),
+				resource(AllocKind::slots), resource(AllocKind::interner)};
+	}
+
+	Stats stats(AllocKind kind) const
+	{
+		return counters_[static_cast<size_t>(kind)].load();
+	}
+
+	/* everything, including allocations not tagged with a kind */
+	Stats total() const
+	{
+		Stats sum;
+		for (const auto &c : counters_)
 		{
+			Stats s = c.load();
+			sum.allocations += s.allocations;
+			sum.deallocations += s.deallocations;
+			sum.bytes_allocated += s.bytes_allocated;
+			sum.bytes_in_use += s.bytes_in_use;
 		}
+		return sum;
+	}
 
-		/* constructor for a transition or a child shape */
-		Shape(std::shared_ptr<const Shape> parent, size_t key)
-			: parent_(std::move(parent)), property_key_(key),
-			  offset_(parent_->getPropertyCount())
+	/* zeroes the lifetime counters, bytes_in_use is kept */
+	void reset()
+	{
+		for (auto &c : counters_)
 		{
+			c.allocations.store(0, std::memory_order_relaxed);
+			c.deallocations.store(0, std::memory_order_relaxed);
+			c.bytes_allocated.store(0, std::memory_order_relaxed);
 		}
+	}
 
-		/* looks up the memory offset for a given property identifier */
-		std::expected<size_t, std::monostate> getOffset(size_t key) const
+private:
+	/* index AllocKind::count_ is for untagged allocations */
+	static constexpr size_t untagged = static_cast<size_t>(AllocKind::count_);
+
+	struct Counter
+	{
+		std::atomic<size_t> allocations{0};
+		std::atomic<size_t> deallocations{0};
+		std::atomic<size_t> bytes_allocated{0};
+		std::atomic<size_t> bytes_in_use{0};
+
+		Stats load() const
 		{
-			const Shape *current = this;
-			/* the root's parent is null, so this loop always terminates */
-			while (current->parent_)
-			{
-				if (current->property_key_ == key)
-				{
-					return current->offset_;
-				}
-				current = current->parent_.get();
-			}
-			return std::unexpected(std::monostate{}); /* signal "not found" */
+			return {allocations.load(std::memory_order_relaxed),
+					deallocations.load(std::memory_order_relaxed),
+					bytes_allocated.load(std::memory_order_relaxed),
+					bytes_in_use.load(std::memory_order_relaxed)};
 		}
+	};
 
-		inline size_t getNewOffset() const
+	class View : public std::pmr::memory_resource
+	{
+	public:
+		void init(CountingResource *owner, size_t index)
 		{
-			return offset_;
+			owner_ = owner;
+			index_ = index;
 		}
-		inline size_t getPropertyCount() const
+
+	private:
+		void *do_allocate(size_t bytes, size_t align) override
 		{
-			return offset_ == static_cast<size_t>(-1) ? 0 : offset_ + 1;
+			return owner_->allocateAs(index_, bytes, align);
+		}
+		void do_deallocate(void *p, size_t bytes, size_t align) override
+		{
+			owner_->deallocateAs(index_, p, bytes, align);
+		}
+		bool do_is_equal(const memory_resource &other) const noexcept override
+		{
+			return this == &other;
 		}
 
-	private:
-		friend class ObjectFactory;
+		CountingResource *owner_ = nullptr;
+		size_t index_ = 0;
+	};
 
-		/**
-		 * parent_ points to the previous shape in the chain.
-		 * A lookup walks up this chain until it finds the property or
-		 * hits the root.
-		 */
-		std::shared_ptr<const Shape> parent_;
+	void *allocateAs(size_t index, size_t bytes, size_t align)
+	{
+		void *p = upstream_->allocate(bytes, align);
+		Counter &c = counters_[index];
+		c.allocations.fetch_add(1, std::memory_order_relaxed);
+		c.bytes_allocated.fetch_add(bytes, std::memory_order_relaxed);
+		c.bytes_in_use.fetch_add(bytes, std::memory_order_relaxed);
+		return p;
+	}
 
-		/**
-		 * property_key_ is the identifier for the new property that
-		 * this shape
-		 * adds relative to its parent.
-		 */
-		size_t property_key_;
+	void deallocateAs(size_t index, void *p, size_t bytes, size_t align)
+	{
+		upstream_->deallocate(p, bytes, align);
+		Counter &c = counters_[index];
+		c.deallocations.fetch_add(1, std::memory_order_relaxed);
+		c.bytes_in_use.fetch_sub(bytes, std::memory_order_relaxed);
+	}
 
-		/**
-		 * offset_ is the index in the values_ vector where the new
-		 *property is stored.
-		 */
-		size_t offset_;
+	void *do_allocate(size_t bytes, size_t align) override
+	{
+		return allocateAs(untagged, bytes, align);
+	}
+	void do_deallocate(void *p, size_t bytes, size_t align) override
+	{
+		deallocateAs(untagged, p, bytes, align);
+	}
+	bool do_is_equal(const memory_resource &other) const noexcept override
+	{
+		return this == &other;
+	}
 
-		/**
-		 * caches the transition to a new shape when a property is added
-		 */
-		std::unordered_map<size_t, std::weak_ptr<Shape>> transitions_;
-	};
+	std::pmr::memory_resource *upstream_;
+	std::array<View, untagged> views_;
+	std::array<Counter, untagged + 1> counters_;
+};
 
-public:
-	/**
-	 * a unique identifier for a property name, created by interning a
-	 * string
-	 */
-	using Identifier = size_t;
+/**
+ * how the values of one property are stored across all objects of a shape
+ * (the field representation, same idea as v8's). every field starts out
+ * with the representation of the first value stored into it and is
+ * generalized to `any` the first time a value of a different kind shows up.
+ * generalization never goes back
+ */
+enum class Representation : uint8_t
+{
+	none,	  /* nothing stored yet */
+	integer,  /* an unboxed int */
+	floating, /* an unboxed double */
+	heap,	  /* anything else, boxed in a std::any */
+	any		  /* mixed, every slot says for itself what it holds */
+};
 
-	class DynObject
-	{
-	public:
-		using Args = std::vector<std::any>;
-		using Method = std::function<std::any(DynObject &, Args)>;
+/**
+ * how an object's integer indexed properties (its elements) are stored.
+ * an object starts with no elements, the first store picks a packed kind
+ * and storing anything else, leaving a hole or writing far past the end
+ * moves it to a more general kind. like field representations, this only
+ * goes one way
+ */
+enum class ElementsKind : uint8_t
+{
+	none,		   /* no elements yet */
+	packed_int,	   /* dense, unboxed ints */
+	packed_double, /* dense, unboxed doubles */
+	generic,	   /* dense (maybe with holes), any value */
+	sparse		   /* an ordered index -> value map */
+};
 
-		/**
-		 * the object's prototype for inheritance. properties not found
-		 * on this object will be looked up on its prototype
-		 */
-		std::shared_ptr<DynObject> prototype = nullptr;
+/**
+ * how much of an object can still change (JS's Object.seal/freeze). like
+ * the kinds above, an object only ever moves down this list
+ */
+enum class Integrity : uint8_t
+{
+	none,	/* anything goes */
+	sealed, /* no adding or removing properties, values can change */
+	frozen	/* nothing changes, reads don't lock */
+};
 
-		template <typename T>
-		void set(ObjectFactory &factory, Identifier key, T &&value)
+/**
+ * a lazily started coroutine producing a T (the result of
+ * DynObject::callAsync and of async methods). nothing runs until the task
+ * is co_awaited, and the awaiting coroutine resumes right where the task
+ * finishes, on whatever thread that is. give it to Executor::spawn to run
+ * it without awaiting it. there are no exceptions in here, errors travel
+ * in T like everywhere else
+ */
+template <typename T = void>
+class Task
+{
+	/* return_value or return_void, whichever T wants */
+	template <typename U>
+	struct Result
+	{
+		std::optional<U> value;
+
+		void return_value(U v)
 		{
-			unique_lock_t<object_mutex_t> lock(mutex_);
+			value.emplace(std::move(v));
+		}
+		U take()
+		{
+			return std::move(*value);
+		}
+	};
+	template <typename U>
+	requires std::is_void_v<U>
+	struct Result<U>
+	{
+		void return_void()
+		{
+		}
+		void take()
+		{
+		}
+	};
 
-			auto maybe_offset = shape_->getOffset(key);
+public:
+	struct promise_type : Result<T>
+	{
+		std::coroutine_handle<> continuation;
 
-			if (maybe_offset.has_value())
-			{
-				/**
-				 * property already exists. get the offset and update the value
-				 */
-				const size_t offset = *maybe_offset;
-				values_[offset] = std::forward<T>(value);
-			}
-			else
+		Task get_return_object()
+		{
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept
+		{
+			return {};
+		}
+		/* jump straight back into whoever awaited us, if anyone did */
+		auto final_suspend() noexcept
+		{
+			struct Final
 			{
-				/* property doesn't exist: this is a shape transition. */
-				unique_lock_t<factory_mutex_t> factory_lock(
-					factory.factory_mutex_);
-				auto new_shape = factory.transition(shape_, key);
-				shape_ = new_shape;
-
-				/**
-				 * pre allocate the vector to the new required
-				 * size. avoids multiple reallocations
-				 */
-				values_.resize(new_shape->getPropertyCount());
-				values_[new_shape->getNewOffset()] = std::forward<T>(value);
-			}
+				bool await_ready() noexcept
+				{
+					return false;
+				}
+				std::coroutine_handle<>
+				await_suspend(std::coroutine_handle<promise_type> self) noexcept
+				{
+					if (self.promise().continuation)
+						return self.promise().continuation;
+					return std::noop_coroutine();
+				}
+				void await_resume() noexcept
+				{
+				}
+			};
+			return Final{};
+		}
+		void unhandled_exception() noexcept
+		{
+			std::terminate();
 		}
+	};
 
-		template <typename T>
-		std::expected<T, std::string> get(Identifier key) const
+	Task(Task &&other) noexcept
+		: handle_(std::exchange(other.handle_, nullptr))
+	{
+	}
+	Task &operator=(Task &&other) noexcept
+	{
+		if (this != &other)
 		{
-			shared_lock_t<object_mutex_t> lock(mutex_);
+			if (handle_)
+				handle_.destroy();
+			handle_ = std::exchange(other.handle_, nullptr);
+		}
+		return *this;
+	}
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+	~Task()
+	{
+		if (handle_)
+			handle_.destroy();
+	}
 
-			auto maybe_offset = shape_->getOffset(key);
+	/* starts the task and suspends the caller until it's done */
+	auto operator co_await() &&
+	{
+		struct Awaiter
+		{
+			std::coroutine_handle<promise_type> handle;
 
-			if (maybe_offset.has_value())
+			bool await_ready() noexcept
 			{
-				const size_t offset = *maybe_offset;
-				if constexpr (std::is_same_v<T, std::any>)
-					return values_[offset];
-				if (const T *val = std::any_cast<T>(&(values_[offset])))
-					return *val;
-				return std::unexpected("type mismatch for property");
+				return false;
+			}
+			std::coroutine_handle<>
+			await_suspend(std::coroutine_handle<> caller) noexcept
+			{
+				handle.promise().continuation = caller;
+				return handle;
+			}
+			T await_resume()
+			{
+				return handle.promise().take();
 			}
+		};
+		return Awaiter{handle_};
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle)
+	{
+	}
+
+	std::coroutine_handle<promise_type> handle_;
+};
 
+/**
+ * runs coroutines: a queue of suspended ones plus the threads resuming
+ * them. a coroutine waiting on I/O (an AsyncEvent) isn't in the queue and
+ * costs no thread, so thousands of calls can be in flight on a couple of
+ * workers.
+ *
+ * with DYNOBJECT_MULTITHREADED the constructor starts `threads` workers;
+ * otherwise (or with 0 workers) nothing runs until someone calls run() or
+ * poll(), which resume coroutines on the calling thread. the executor must
+ * outlive everything spawned on it
+ */
+class Executor
+{
+public:
+	explicit Executor(unsigned threads = 0)
+	{
 #ifdef DYNOBJECT_MULTITHREADED
-			lock.unlock(); /* unlock before recursing to mitigate deadlocks */
+		workers_.reserve(threads);
+		for (unsigned i = 0; i < threads; ++i)
+			workers_.emplace_back([this] { work(); });
+#else
+		(void)threads;
 #endif
+	}
 
-			if (prototype)
-			{
-				return prototype->get<T>(key);
-			}
+	Executor(const Executor &) = delete;
+	Executor &operator=(const Executor &) = delete;
 
-			return std::unexpected("no such property");
+	~Executor()
+	{
+#ifdef DYNOBJECT_MULTITHREADED
+		{
+			unique_lock_t<factory_mutex_t> lock(mutex_);
+			stopping_ = true;
+		}
+		ready_.notify_all();
+		for (std::thread &worker : workers_)
+			worker.join();
+#endif
+	}
+
+	/* queues a suspended coroutine to be resumed */
+	void post(std::coroutine_handle<> coroutine)
+	{
+		{
+			unique_lock_t<factory_mutex_t> lock(mutex_);
+			queue_.push_back(coroutine);
 		}
+#ifdef DYNOBJECT_MULTITHREADED
+		ready_.notify_one();
+#endif
+	}
 
-		template <typename R = std::any>
-		std::expected<R, std::string> call(Identifier name, Args args = {})
+	/* `co_await executor.schedule()` continues on the executor */
+	auto schedule()
+	{
+		struct Awaiter
 		{
-			auto maybe_method = this->get<Method>(name);
+			Executor &executor;
 
-			if (!maybe_method.has_value())
+			bool await_ready() noexcept
 			{
-				return std::unexpected(maybe_method.error());
+				return false;
 			}
-
-			const Method &method_to_call = maybe_method.value();
-			std::any result = method_to_call(*this, std::move(args));
-
-			if constexpr (std::is_same_v<R, std::any>)
-			{
-				return result;
-			}
-			else
+			void await_suspend(std::coroutine_handle<> caller)
 			{
-				if (const R *val = std::any_cast<R>(&result))
-				{
-					return *val;
-				}
-				return std::unexpected("type mismatch for method return value");
+				executor.post(caller);
 			}
-		}
-		/* JSON serialization */
-		std::string toJSON(const ObjectFactory &factory)
-			const /* need factory because of interning */
-		{
-			std::ostringstream oss;
-			oss << "{";
-			bool first = true;
-
-			/* iterate through all interned identifiers */
-			for (size_t i = 0; i < factory.id_to_str_.size(); ++i)
+			void await_resume() noexcept
 			{
-				auto maybe_val = this->get<std::any>(i);
-				if (maybe_val.has_value())
-				{
-					if (!first)
-						oss << ",";
-					oss << escapeJSONString(std::string(factory.getString(i)))
-						<< ":" << valueToJSON(*maybe_val);
-					first = false;
-				}
 			}
+		};
+		return Awaiter{*this};
+	}
 
-			oss << "}";
-			return oss.str();
-		}
+	/* runs task on the executor without anyone awaiting it, the result is dropped */
+	template <typename T>
+	void spawn(Task<T> task)
+	{
+		pending_.fetch_add(1, std::memory_order_relaxed);
+		detach(std::move(task));
+	}
 
-	private:
-		friend class ObjectFactory;
+	/* spawned tasks that haven't finished yet */
+	size_t pending() const
+	{
+		return pending_.load(std::memory_order_acquire);
+	}
 
-		/**
-		 * constructor is private, only the factory can create an object
-		 */
-		explicit DynObject(std::shared_ptr<Shape> initial_shape)
-			: shape_(std::move(initial_shape))
+	/**
+	 * resumes queued coroutines on this thread until the queue is empty,
+	 * including whatever they queue meanwhile. returns how many ran
+	 */
+	size_t poll()
+	{
+		size_t count = 0;
+		while (std::coroutine_handle<> next = pop())
 		{
+			next.resume();
+			++count;
 		}
+		return count;
+	}
 
-		std::shared_ptr<Shape> shape_;
-		std::vector<std::any> values_;
-		mutable object_mutex_t mutex_;
-
-		/* --- JSON helpers --- */
-
-		static std::string escapeJSONString(const std::string &s)
+	/**
+	 * like poll, but until every spawned task finished. with
+	 * DYNOBJECT_MULTITHREADED it sleeps while the queue is empty and other
+	 * threads still have tasks to finish or events to set; single threaded
+	 * there's nobody else, so it returns once nothing is left to run
+	 */
+	void run()
+	{
+		for (;;)
 		{
-			std::ostringstream oss;
-			oss << "\"";
-			for (char c : s)
+			std::coroutine_handle<> next;
 			{
-				switch (c)
-				{
-				case '\"':
-					oss << "\\\"";
-					break;
-				case '\\':
-					oss << "\\\\";
-					break;
-				case '\b':
-					oss << "\\b";
-					break;
-				case '\f':
-					oss << "\\f";
-					break;
-				case '\n':
-					oss << "\\n";
-					break;
-				case '\r':
-					oss << "\\r";
-					break;
-				case '\t':
-					oss << "\\t";
-					break;
-				default:
-					if ((unsigned char)c < 0x20)
-					{
-						oss << "\\u" << std::hex << std::setw(4)
-							<< std::setfill('0') << (int)(unsigned char)c;
-					}
-					else
-					{
-						oss << c;
-					}
-				}
+				unique_lock_t<factory_mutex_t> lock(mutex_);
+#ifdef DYNOBJECT_MULTITHREADED
+				ready_.wait(lock, [this] { return !queue_.empty() || pending() == 0; });
+#endif
+				if (queue_.empty())
+					return;
+				next = queue_.front();
+				queue_.pop_front();
 			}
-			oss << "\"";
-			return oss.str();
+			next.resume();
 		}
+	}
 
-		static std::string valueToJSON(const std::any &val)
+private:
+	/* owns itself, destroyed when it runs off its end */
+	struct Detached
+	{
+		struct promise_type
 		{
-			if (!val.has_value())
-				return "null";
-
-			if (auto p = std::any_cast<int>(&val))
-				return std::to_string(*p);
-			if (auto p = std::any_cast<double>(&val))
-				return std::to_string(*p);
-			if (auto p = std::any_cast<float>(&val))
-				return std::to_string(*p);
-			if (auto p = std::any_cast<bool>(&val))
-				return *p ? "true" : "false";
-			if (auto p = std::any_cast<std::string>(&val))
-				return escapeJSONString(*p);
-			if (auto p = std::any_cast<const char *>(&val))
-				return escapeJSONString(*p);
-
-			if (auto p = std::any_cast<std::vector<std::any>>(&val))
+			Detached get_return_object()
 			{
-				std::ostringstream oss;
-				oss << "[";
-				bool first = true;
-				for (auto &elem : *p)
-				{
-					if (!first)
-						oss << ",";
-					oss << valueToJSON(elem);
-					first = false;
-				}
-				oss << "]";
-				return oss.str();
+				return {};
 			}
-
-			if (auto p =
-					std::any_cast<std::unordered_map<std::string, std::any>>(
-						&val))
+			std::suspend_never initial_suspend() noexcept
 			{
-				std::ostringstream oss;
-				oss << "{";
-				bool first = true;
-				for (auto &[k, v] : *p)
-				{
-					if (!first)
-						oss << ",";
-					oss << escapeJSONString(k) << ":" << valueToJSON(v);
-					first = false;
-				}
-				oss << "}";
-				return oss.str();
+				return {};
+			}
+			std::suspend_never final_suspend() noexcept
+			{
+				return {};
+			}
+			void return_void()
+			{
+			}
+			void unhandled_exception() noexcept
+			{
+				std::terminate();
 			}
+		};
+	};
 
-#ifdef __cpp_rtti
-			return std::string{"<"} + val.type().name() + ">";
-#else
-			return "\"<?>\"";
+	template <typename T>
+	Detached detach(Task<T> task)
+	{
+		co_await schedule();
+		co_await std::move(task);
+		if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+#ifdef DYNOBJECT_MULTITHREADED
+			/* under the lock, or run() could miss it between check and wait */
+			unique_lock_t<factory_mutex_t> lock(mutex_);
+			ready_.notify_all();
 #endif
 		}
-	};
+	}
 
-	/* FACTORY METHODS */
+	std::coroutine_handle<> pop()
+	{
+		unique_lock_t<factory_mutex_t> lock(mutex_);
+		if (queue_.empty())
+			return nullptr;
+		std::coroutine_handle<> next = queue_.front();
+		queue_.pop_front();
+		return next;
+	}
 
-	ObjectFactory() : root_shape_(std::make_shared<Shape>())
+#ifdef DYNOBJECT_MULTITHREADED
+	void work()
 	{
+		for (;;)
+		{
+			std::coroutine_handle<> next;
+			{
+				unique_lock_t<factory_mutex_t> lock(mutex_);
+				ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+				if (queue_.empty())
+					return;
+				next = queue_.front();
+				queue_.pop_front();
+			}
+			next.resume();
+		}
 	}
 
-	/* creates a new, empty dynamic object */
-	std::unique_ptr<DynObject> createObject()
+	std::condition_variable ready_;
+	std::vector<std::thread> workers_;
+	bool stopping_ = false;
+#endif
+	factory_mutex_t mutex_;
+	std::deque<std::coroutine_handle<>> queue_;
+	std::atomic<size_t> pending_{0};
+};
+
+/**
+ * a one shot event coroutines can wait for, standing in for the
+ * completion of some I/O. `co_await event` suspends until set(), which
+ * hands every waiter to the executor; once set, waiting doesn't suspend.
+ * in tests this is the fake I/O source: a "device" (a task, another
+ * thread, the test itself between polls) sets events as its requests
+ * complete
+ */
+class AsyncEvent
+{
+public:
+	explicit AsyncEvent(Executor &executor) : executor_(executor)
 	{
-		/**
-		 * use a private constructor via new. std::make_unique cannot
-		 * access it
-		 */
-		return std::unique_ptr<DynObject>(new DynObject(root_shape_));
 	}
 
-	Identifier intern(std::string_view str)
+	AsyncEvent(const AsyncEvent &) = delete;
+	AsyncEvent &operator=(const AsyncEvent &) = delete;
+
+	void set()
 	{
-		unique_lock_t<factory_mutex_t> lock(intern_mutex_);
-		/**
-		 * use transparent hashing to look up string_view without
-		 * creating a string
-		 */
-		if (auto it = str_to_id_.find(str); it != str_to_id_.end())
+		std::vector<std::coroutine_handle<>> waiters;
 		{
-			return it->second;
+			unique_lock_t<factory_mutex_t> lock(mutex_);
+			set_.store(true, std::memory_order_release);
+			waiters.swap(waiters_);
 		}
+		for (std::coroutine_handle<> waiter : waiters)
+			executor_.post(waiter);
+	}
 
-		Identifier id = id_to_str_.size();
-		id_to_str_.emplace_back(str);
-		/**
-		 * emplace the string_view from our stable storage (id_to_str_)
-		 * into the map
-		 */
-		str_to_id_.emplace(id_to_str_.back(), id);
-		return id;
+	bool isSet() const
+	{
+		return set_.load(std::memory_order_acquire);
+	}
+
+	auto operator co_await()
+	{
+		struct Awaiter
+		{
+			AsyncEvent &event;
+
+			bool await_ready() const noexcept
+			{
+				return event.isSet();
+			}
+			bool await_suspend(std::coroutine_handle<> caller)
+			{
+				unique_lock_t<factory_mutex_t> lock(event.mutex_);
+				if (event.isSet())
+					return false;
+				event.waiters_.push_back(caller);
+				return true;
+			}
+			void await_resume() noexcept
+			{
+			}
+		};
+		return Awaiter{*this};
 	}
 
+private:
+	Executor &executor_;
+	factory_mutex_t mutex_;
+	std::atomic<bool> set_{false};
+	std::vector<std::coroutine_handle<>> waiters_;
+};
+
+class Snapshot;
+class ArrowBatch;
+class Script;
+class Parallel;
+
+/* the binary encodings BinaryCodec speaks */
+enum class BinaryFormat
+{
+	msgpack,
+	cbor
+};
+template <BinaryFormat F>
+class BinaryCodec;
+
+class ObjectFactory
+{
+public:
+	class DynObject;
+
 	/**
-	 * retrieves the original string from an interned identifier (for debugging)
+	 * a method stored as a plain function pointer plus a context word
+	 * (whatever the function wants it to be, the factory never touches
+	 * it), see DynObject::defineMethod
 	 */
-	std::string_view getString(Identifier id) const
+	using NativeMethod = std::any (*)(DynObject &self, void *context,
+									  std::span<std::any> args);
+
+	/**
+	 * a 32 bit reference to an object owned by the factory's handle table
+	 * (see createHandle): 24 bits of table index and 8 of generation. a
+	 * table entry's generation moves on when its object is destroyed, so
+	 * a stale handle resolves to nullptr instead of to whatever took the
+	 * entry over. as a property value it fits in std::any's own buffer:
+	 * no allocation and no refcount, unlike a std::shared_ptr<DynObject>.
+	 * the zero handle is null and never resolves
+	 */
+	struct Handle
 	{
-		unique_lock_t<factory_mutex_t> lock(intern_mutex_);
-		if (id < id_to_str_.size())
+		static constexpr unsigned index_bits = 24;
+
+		uint32_t bits = 0;
+
+		uint32_t index() const
 		{
-			return id_to_str_[id];
+			return bits & ((uint32_t{1} << index_bits) - 1);
 		}
-		return "<?>";
-	}
+		uint8_t generation() const
+		{
+			return uint8_t(bits >> index_bits);
+		}
+		explicit operator bool() const
+		{
+			return bits != 0;
+		}
+		friend bool operator==(Handle, Handle) = default;
+	};
 
 private:
 	/**
-	 * calculates the new shape an object transitions to when a new property
-	 * is added
+	 * storage for one property value. ints and doubles are kept unboxed,
+	 * everything else goes into a std::any. kind() says which member is
+	 * alive
 	 */
-	std::shared_ptr<Shape> transition(std::shared_ptr<Shape> from,
-									  Identifier key)
+	class Slot
 	{
-		/* check cache first */
-		if (auto it = from->transitions_.find(key);
-			it != from->transitions_.end())
+	public:
+		Slot() noexcept : kind_(Representation::none)
 		{
-			if (auto next_shape = it->second.lock())
+		}
+
+		Slot(const Slot &other) : kind_(Representation::none)
+		{
+			copyFrom(other);
+		}
+
+		Slot(Slot &&other) noexcept : kind_(Representation::none)
+		{
+			moveFrom(std::move(other));
+		}
+
+		Slot &operator=(const Slot &other)
+		{
+			if (this != &other)
 			{
-				return next_shape;
+				reset();
+				copyFrom(other);
 			}
+			return *this;
 		}
 
-		auto new_shape = std::make_shared<Shape>(from, key);
-
-		/**
-		 * cache the new transition using a weak_ptr to prevent cycles
-		 */
-		from->transitions_[key] = new_shape;
-		return new_shape;
-	}
+		Slot &operator=(Slot &&other) noexcept
+		{
+			if (this != &other)
+			{
+				reset();
+				moveFrom(std::move(other));
+			}
+			return *this;
+		}
 
-	/* a transparent hasher for unordered_map lookups with string_view */
-	struct StringHash
-	{
-		using is_transparent = void;
-		size_t operator()(std::string_view sv) const
+		~Slot()
+		{
+			reset();
+		}
 
+		/* the representation a value of type U gets when stored */
+		template <typename U>
+		static constexpr Representation representationOf()
 		{
-			return std::hash<std::string_view>{}(sv);
+			if constexpr (std::is_same_v<U, int>)
+				return Representation::integer;
+			else if constexpr (std::is_same_v<U, double>)
+				return Representation::floating;
+			else
+				return Representation::heap;
 		}
-		size_t operator()(const std::string &s) const
 
+		/* same for a value that is already boxed */
+		static Representation representationOf(const std::any &value)
 		{
-			return std::hash<std::string>{}(s);
+			if (value.type() == typeid(int))
+				return Representation::integer;
+			if (value.type() == typeid(double))
+				return Representation::floating;
+			return Representation::heap;
 		}
-	};
 
-	/* factory State */
-	std::shared_ptr<Shape> root_shape_;
-	factory_mutex_t factory_mutex_; /* for thread safe shape transitions */
+		Representation kind() const
+		{
+			return kind_;
+		}
 
-	/* string interning state */
+		/**
+		 * raw access. only valid when the field representation (or
+		 * kind()) says that's what the slot holds
+		 */
+		int &rawInt()
+		{
+			return int_;
+		}
+		int rawInt() const
+		{
+			return int_;
+		}
+		double &rawDouble()
+		{
+			return double_;
+		}
+		double rawDouble() const
+		{
+			return double_;
+		}
+		std::any &rawBoxed()
+		{
+			return boxed_;
+		}
+		const std::any &rawBoxed() const
+		{
+			return boxed_;
+		}
+
+		/* stores any value, switching the kind if needed */
+		template <typename T>
+		void store(T &&value)
+		{
+			using U = std::decay_t<T>;
+			if constexpr (std::is_same_v<U, std::any>)
+			{
+				/* unbox so the slot ends up the same as a typed store */
+				if (auto p = std::any_cast<int>(&value))
+					store(int(*p));
+				else if (auto p = std::any_cast<double>(&value))
+					store(double(*p));
+				else
+					storeBoxed(std::forward<T>(value));
+			}
+			else if constexpr (std::is_same_v<U, int>)
+			{
+				reset();
+				int_ = value;
+				kind_ = Representation::integer;
+			}
+			else if constexpr (std::is_same_v<U, double>)
+			{
+				reset();
+				double_ = value;
+				kind_ = Representation::floating;
+			}
+			else
+			{
+				storeBoxed(std::forward<T>(value));
+			}
+		}
+
+		/* the value as T, nullptr if it holds something else */
+		template <typename T>
+		const T *ptr() const
+		{
+			if constexpr (std::is_same_v<T, int>)
+				return kind_ == Representation::integer ? &int_ : nullptr;
+			else if constexpr (std::is_same_v<T, double>)
+				return kind_ == Representation::floating ? &double_ : nullptr;
+			else
+				return kind_ == Representation::heap
+						   ? std::any_cast<T>(&boxed_)
+						   : nullptr;
+		}
+
+		/* the value boxed up, empty if nothing was ever stored */
+		std::any toAny() const
+		{
+			switch (kind_)
+			{
+			case Representation::integer:
+				return int_;
+			case Representation::floating:
+				return double_;
+			case Representation::heap:
+				return boxed_;
+			default:
+				return {};
+			}
+		}
+
+	private:
+		template <typename T>
+		void storeBoxed(T &&value)
+		{
+			if (kind_ == Representation::heap)
+			{
+				boxed_ = std::forward<T>(value);
+				return;
+			}
+			reset();
+			new (&boxed_) std::any(std::forward<T>(value));
+			kind_ = Representation::heap;
+		}
+
+		void reset() noexcept
+		{
+			if (kind_ == Representation::heap)
+				boxed_.~any();
+			kind_ = Representation::none;
+		}
+
+		void copyFrom(const Slot &other)
+		{
+			switch (other.kind_)
+			{
+			case Representation::integer:
+				int_ = other.int_;
+				break;
+			case Representation::floating:
+				double_ = other.double_;
+				break;
+			case Representation::heap:
+				new (&boxed_) std::any(other.boxed_);
+				break;
+			default:
+				break;
+			}
+			kind_ = other.kind_;
+		}
+
+		void moveFrom(Slot &&other) noexcept
+		{
+			switch (other.kind_)
+			{
+			case Representation::integer:
+				int_ = other.int_;
+				break;
+			case Representation::floating:
+				double_ = other.double_;
+				break;
+			case Representation::heap:
+				new (&boxed_) std::any(std::move(other.boxed_));
+				break;
+			default:
+				break;
+			}
+			kind_ = other.kind_;
+		}
+
+		union
+		{
+			int int_;
+			double double_;
+			std::any boxed_;
+		};
+		Representation kind_;
+	};
+
+	/**
+	 * the elements backing store of an object. elements never go through
+	 * the shape or the interner, an index is just a position
+	 */
+	class Elements
+	{
+	public:
+		/**
+		 * writing this far past the end of a dense store switches to
+		 * sparse instead of filling the gap with holes
+		 */
+		static constexpr size_t max_gap = 1024;
+
+		explicit Elements(std::pmr::memory_resource *resource)
+			: resource_(resource)
+		{
+		}
+
+		ElementsKind kind() const
+		{
+			return kind_;
+		}
+
+		/* one past the highest index that holds a value */
+		size_t length() const
+		{
+			switch (kind_)
+			{
+			case ElementsKind::packed_int:
+				return std::get<IntStore>(store_).size();
+			case ElementsKind::packed_double:
+				return std::get<DoubleStore>(store_).size();
+			case ElementsKind::generic:
+				return std::get<GenericStore>(store_).size();
+			case ElementsKind::sparse:
+			{
+				const auto &map = std::get<SparseStore>(store_);
+				return map.empty() ? 0 : map.rbegin()->first + 1;
+			}
+			default:
+				return 0;
+			}
+		}
+
+		template <typename T>
+		void set(size_t index, T &&value)
+		{
+			using U = std::decay_t<T>;
+			constexpr Representation rep = Slot::representationOf<U>();
+
+			if (kind_ == ElementsKind::none)
+			{
+				if (index >= max_gap)
+					toSparse();
+				else if (index == 0 && rep == Representation::integer)
+					toKind<IntStore>(ElementsKind::packed_int);
+				else if (index == 0 && rep == Representation::floating)
+					toKind<DoubleStore>(ElementsKind::packed_double);
+				else
+					toKind<GenericStore>(ElementsKind::generic);
+			}
+
+			/* the packed kinds, while the value fits and there's no gap */
+			if constexpr (rep == Representation::integer)
+			{
+				if (kind_ == ElementsKind::packed_int &&
+					storePacked(std::get<IntStore>(store_), index, value))
+					return;
+			}
+			else if constexpr (rep == Representation::floating)
+			{
+				if (kind_ == ElementsKind::packed_double &&
+					storePacked(std::get<DoubleStore>(store_), index, value))
+					return;
+			}
+
+			if (kind_ == ElementsKind::packed_int ||
+				kind_ == ElementsKind::packed_double)
+				toGeneric();
+
+			if (kind_ == ElementsKind::generic)
+			{
+				auto &vec = std::get<GenericStore>(store_);
+				if (index < vec.size() + max_gap)
+				{
+					if (index >= vec.size())
+						vec.resize(index + 1); /* the gap becomes holes */
+					vec[index].store(std::forward<T>(value));
+					return;
+				}
+				toSparse();
+			}
+
+			std::get<SparseStore>(store_)[index].store(std::forward<T>(value));
+		}
+
+		/* the element at index, nullptr for a hole or out of range */
+		template <typename T>
+		const T *ptr(size_t index) const
+		{
+			switch (kind_)
+			{
+			case ElementsKind::packed_int:
+				if constexpr (std::is_same_v<T, int>)
+				{
+					const auto &vec = std::get<IntStore>(store_);
+					return index < vec.size() ? &vec[index] : nullptr;
+				}
+				return nullptr;
+			case ElementsKind::packed_double:
+				if constexpr (std::is_same_v<T, double>)
+				{
+					const auto &vec = std::get<DoubleStore>(store_);
+					return index < vec.size() ? &vec[index] : nullptr;
+				}
+				return nullptr;
+			default:
+				if (const Slot *slot = find(index))
+					return slot->ptr<T>();
+				return nullptr;
+			}
+		}
+
+		/* true if something is stored at index */
+		bool has(size_t index) const
+		{
+			switch (kind_)
+			{
+			case ElementsKind::packed_int:
+				return index < std::get<IntStore>(store_).size();
+			case ElementsKind::packed_double:
+				return index < std::get<DoubleStore>(store_).size();
+			default:
+				return find(index) != nullptr;
+			}
+		}
+
+		/* the element boxed up, empty for a hole */
+		std::any toAny(size_t index) const
+		{
+			switch (kind_)
+			{
+			case ElementsKind::packed_int:
+				return std::get<IntStore>(store_)[index];
+			case ElementsKind::packed_double:
+				return std::get<DoubleStore>(store_)[index];
+			default:
+				if (const Slot *slot = find(index))
+					return slot->toAny();
+				return {};
+			}
+		}
+
+		/* calls fn(index, std::any) for every element, in index order */
+		template <typename F>
+		void forEach(F &&fn) const
+		{
+			switch (kind_)
+			{
+			case ElementsKind::packed_int:
+			case ElementsKind::packed_double:
+				for (size_t i = 0, n = length(); i < n; ++i)
+					fn(i, toAny(i));
+				break;
+			case ElementsKind::generic:
+			{
+				const auto &vec = std::get<GenericStore>(store_);
+				for (size_t i = 0; i < vec.size(); ++i)
+				{
+					if (vec[i].kind() != Representation::none)
+						fn(i, vec[i].toAny());
+				}
+				break;
+			}
+			case ElementsKind::sparse:
+				for (const auto &[i, slot] : std::get<SparseStore>(store_))
+					fn(i, slot.toAny());
+				break;
+			default:
+				break;
+			}
+		}
+
+		/**
+		 * forEach without boxing: fn(index, const Slot &) for every
+		 * element in index order, packed values in a temporary Slot.
+		 * stops at the first fn returning false, and returns false then
+		 */
+		template <typename F>
+		bool everySlot(F &&fn) const
+		{
+			Slot tmp;
+			switch (kind_)
+			{
+			case ElementsKind::packed_int:
+			{
+				const auto &vec = std::get<IntStore>(store_);
+				for (size_t i = 0; i < vec.size(); ++i)
+				{
+					tmp.store(vec[i]);
+					if (!fn(i, std::as_const(tmp)))
+						return false;
+				}
+				return true;
+			}
+			case ElementsKind::packed_double:
+			{
+				const auto &vec = std::get<DoubleStore>(store_);
+				for (size_t i = 0; i < vec.size(); ++i)
+				{
+					tmp.store(vec[i]);
+					if (!fn(i, std::as_const(tmp)))
+						return false;
+				}
+				return true;
+			}
+			case ElementsKind::generic:
+			{
+				const auto &vec = std::get<GenericStore>(store_);
+				for (size_t i = 0; i < vec.size(); ++i)
+				{
+					if (vec[i].kind() != Representation::none && !fn(i, vec[i]))
+						return false;
+				}
+				return true;
+			}
+			case ElementsKind::sparse:
+				for (const auto &[i, slot] : std::get<SparseStore>(store_))
+				{
+					if (!fn(i, slot))
+						return false;
+				}
+				return true;
+			default:
+				return true;
+			}
+		}
+
+		/* the element as a Slot, packed ones put in tmp. nullptr for a hole */
+		const Slot *slotAt(size_t index, Slot &tmp) const
+		{
+			switch (kind_)
+			{
+			case ElementsKind::packed_int:
+			{
+				const auto &vec = std::get<IntStore>(store_);
+				if (index >= vec.size())
+					return nullptr;
+				tmp.store(vec[index]);
+				return &tmp;
+			}
+			case ElementsKind::packed_double:
+			{
+				const auto &vec = std::get<DoubleStore>(store_);
+				if (index >= vec.size())
+					return nullptr;
+				tmp.store(vec[index]);
+				return &tmp;
+			}
+			default:
+				return find(index);
+			}
+		}
+
+		/* how many elements are stored, holes don't count */
+		size_t count() const
+		{
+			switch (kind_)
+			{
+			case ElementsKind::generic:
+			{
+				const auto &vec = std::get<GenericStore>(store_);
+				return std::count_if(
+					vec.begin(), vec.end(), [](const Slot &slot)
+					{ return slot.kind() != Representation::none; });
+			}
+			case ElementsKind::sparse:
+				return std::get<SparseStore>(store_).size();
+			default:
+				return length();
+			}
+		}
+
+	private:
+		using IntStore = std::pmr::vector<int>;
+		using DoubleStore = std::pmr::vector<double>;
+		using GenericStore = std::pmr::vector<Slot>;
+		using SparseStore = std::pmr::map<size_t, Slot>;
+
+		template <typename Vec, typename V>
+		static bool storePacked(Vec &vec, size_t index, V value)
+		{
+			if (index < vec.size())
+			{
+				vec[index] = value;
+				return true;
+			}
+			if (index == vec.size())
+			{
+				vec.push_back(value);
+				return true;
+			}
+			return false; /* would leave a hole */
+		}
+
+		template <typename Store>
+		void toKind(ElementsKind kind)
+		{
+			store_.template emplace<Store>(resource_);
+			kind_ = kind;
+		}
+
+		/* a hole is a slot that never had anything stored */
+		const Slot *find(size_t index) const
+		{
+			if (kind_ == ElementsKind::generic)
+			{
+				const auto &vec = std::get<GenericStore>(store_);
+				if (index < vec.size() &&
+					vec[index].kind() != Representation::none)
+					return &vec[index];
+				return nullptr;
+			}
+			if (kind_ == ElementsKind::sparse)
+			{
+				const auto &map = std::get<SparseStore>(store_);
+				auto it = map.find(index);
+				return it != map.end() ? &it->second : nullptr;
+			}
+			return nullptr;
+		}
+
+		void toGeneric()
+		{
+			GenericStore vec(resource_);
+			vec.resize(length());
+			for (size_t i = 0; i < vec.size(); ++i)
+			{
+				if (kind_ == ElementsKind::packed_int)
+					vec[i].store(std::get<IntStore>(store_)[i]);
+				else
+					vec[i].store(std::get<DoubleStore>(store_)[i]);
+			}
+			store_ = std::move(vec);
+			kind_ = ElementsKind::generic;
+		}
+
+		void toSparse()
+		{
+			if (kind_ == ElementsKind::packed_int ||
+				kind_ == ElementsKind::packed_double)
+				toGeneric();
+			SparseStore map(resource_);
+			if (kind_ == ElementsKind::generic)
+			{
+				auto &vec = std::get<GenericStore>(store_);
+				for (size_t i = 0; i < vec.size(); ++i)
+				{
+					if (vec[i].kind() != Representation::none)
+						map.emplace(i, std::move(vec[i]));
+				}
+			}
+			store_ = std::move(map);
+			kind_ = ElementsKind::sparse;
+		}
+
+		std::pmr::memory_resource *resource_;
+		ElementsKind kind_ = ElementsKind::none;
+		std::variant<std::monostate, IntStore, DoubleStore, GenericStore,
+					 SparseStore>
+			store_;
+	};
+
+	/**
+	 * what happened to an object's properties since its last checkpoint,
+	 * only kept while change tracking is on. stores set a bit per slot
+	 * offset, added and removed keys are listed by identifier
+	 */
+	class Changes
+	{
+	public:
+		explicit Changes(std::pmr::memory_resource *resource)
+			: dirty_(resource), added_(resource), removed_(resource)
+		{
+		}
+
+		void store(size_t offset)
+		{
+			if (offset / 64 >= dirty_.size())
+				dirty_.resize(offset / 64 + 1, 0);
+			dirty_[offset / 64] |= uint64_t{1} << (offset % 64);
+		}
+
+		bool stored(size_t offset) const
+		{
+			return offset / 64 < dirty_.size() &&
+				   (dirty_[offset / 64] >> (offset % 64) & 1);
+		}
+
+		void add(size_t key, size_t offset)
+		{
+			store(offset);
+			/* removed and added back is just an add for whoever replays it */
+			if (auto it = std::find(removed_.begin(), removed_.end(), key);
+				it != removed_.end())
+				removed_.erase(it);
+			added_.push_back(key);
+		}
+
+		/* offset is where the key was, the slots after it move down one */
+		void remove(size_t key, size_t offset)
+		{
+			const size_t bits = dirty_.size() * 64;
+			for (size_t i = offset; i + 1 < bits; ++i)
+			{
+				const uint64_t mask = uint64_t{1} << (i % 64);
+				if (stored(i + 1))
+					dirty_[i / 64] |= mask;
+				else
+					dirty_[i / 64] &= ~mask;
+			}
+			if (bits)
+				dirty_.back() &= ~(uint64_t{1} << 63);
+
+			/* added since the checkpoint, so there's nothing to remove */
+			if (auto it = std::find(added_.begin(), added_.end(), key);
+				it != added_.end())
+				added_.erase(it);
+			else
+				removed_.push_back(key);
+		}
+
+		bool empty() const
+		{
+			return added_.empty() && removed_.empty() &&
+				   std::all_of(dirty_.begin(), dirty_.end(),
+							   [](uint64_t w) { return w == 0; });
+		}
+
+		void clear()
+		{
+			dirty_.clear();
+			added_.clear();
+			removed_.clear();
+		}
+
+		const std::pmr::vector<size_t> &added() const
+		{
+			return added_;
+		}
+
+		const std::pmr::vector<size_t> &removed() const
+		{
+			return removed_;
+		}
+
+	private:
+		std::pmr::vector<uint64_t> dirty_;
+		std::pmr::vector<size_t> added_;
+		std::pmr::vector<size_t> removed_;
+	};
+
+	/**
+	 * the getter/setter pair of an accessor property, kept in the shape
+	 * that added the property. the functions are stored as void (*)() and
+	 * cast back when get/set ask for exactly the accessor's type, which is
+	 * a direct call; any other type goes through the std::any thunks.
+	 *
+	 * a native method is kept the same way, with the function in getter
+	 * and type set to methodTag()
+	 */
+	struct Accessor
+	{
+		const void *type = nullptr; /* typeTag<T>(), nullptr: not an accessor */
+		void (*getter)() = nullptr; /* T (*)(const DynObject &) */
+		void (*setter)() = nullptr; /* void (*)(DynObject &, T), or nullptr */
+		void *context = nullptr;	/* a native method's context word */
+		std::any (*get_any)(const Accessor &, const DynObject &) = nullptr;
+		bool (*set_any)(const Accessor &, DynObject &, std::any &&) = nullptr;
+
+		/* a unique address per type, without needing rtti */
+		template <typename T>
+		static const void *typeTag()
+		{
+			static constexpr char tag = 0;
+			return &tag;
+		}
+
+		template <typename T>
+		static Accessor make(T (*get)(const DynObject &),
+							 void (*set)(DynObject &, T))
+		{
+			Accessor a;
+			a.type = typeTag<T>();
+			a.getter = reinterpret_cast<void (*)()>(get);
+			a.setter = reinterpret_cast<void (*)()>(set);
+			a.get_any = [](const Accessor &self, const DynObject &obj)
+			{
+				return std::any(
+					reinterpret_cast<T (*)(const DynObject &)>(self.getter)(obj));
+			};
+			a.set_any = [](const Accessor &self, DynObject &obj, std::any &&v)
+			{
+				T *p = std::any_cast<T>(&v);
+				if (!p)
+					return false;
+				reinterpret_cast<void (*)(DynObject &, T)>(self.setter)(
+					obj, std::move(*p));
+				return true;
+			};
+			return a;
+		}
+
+		/* not a typeTag, so get<NativeMethod> can't mistake it for a getter */
+		static const void *methodTag()
+		{
+			static constexpr char tag = 0;
+			return &tag;
+		}
+
+		/* get<Method> on a native method gets it wrapped in a Method */
+		static Accessor makeMethod(NativeMethod fn, void *context)
+		{
+			Accessor a;
+			a.type = methodTag();
+			a.getter = reinterpret_cast<void (*)()>(fn);
+			a.context = context;
+			a.get_any = [](const Accessor &self, const DynObject &)
+			{
+				return std::any(DynObject::Method(
+					[fn = reinterpret_cast<NativeMethod>(self.getter),
+					 context = self.context](DynObject &obj,
+											 DynObject::Args args)
+					{ return fn(obj, context, args); }));
+			};
+			return a;
+		}
+
+		bool method() const
+		{
+			return type == methodTag();
+		}
+
+		bool same(const Accessor &other) const
+		{
+			return type == other.type && getter == other.getter &&
+				   setter == other.setter && context == other.context;
+		}
+	};
+
+	class Shape : public std::enable_shared_from_this<Shape>
+	{
+	public:
+		/* constructor for the root shape */
+		explicit Shape(std::pmr::memory_resource *resource)
+			: parent_(nullptr), property_key_(0),
+			  offset_(static_cast<size_t>(-1)), transitions_(resource)
+		{
+		}
+
+		/* constructor for a transition or a child shape */
+		Shape(std::shared_ptr<const Shape> parent, size_t key,
+			  std::pmr::memory_resource *resource)
+			: parent_(std::move(parent)), property_key_(key),
+			  offset_(parent_->getPropertyCount()), transitions_(resource)
+		{
+		}
+
+		/* a child shape that adds an accessor property */
+		Shape(std::shared_ptr<const Shape> parent, size_t key,
+			  const Accessor &accessor, std::pmr::memory_resource *resource)
+			: Shape(std::move(parent), key, resource)
+		{
+			accessor_ = accessor;
+		}
+
+		~Shape()
+		{
+			for (auto &t : templates_)
+			{
+				if (const KeyTemplate *p = t.load(std::memory_order_relaxed))
+				{
+					std::pmr::polymorphic_allocator<KeyTemplate> alloc(
+						transitions_.get_allocator().resource());
+					alloc.delete_object(const_cast<KeyTemplate *>(p));
+				}
+			}
+		}
+
+		/**
+		 * the property names of this shape, pre-encoded for one output
+		 * format. keys holds the encoded names back to back in offset
+		 * order, key i ending at ends[i]; head is whatever the format puts
+		 * in front of them (a map header, say)
+		 */
+		struct KeyTemplate
+		{
+			explicit KeyTemplate(std::pmr::memory_resource *resource)
+				: head(resource), keys(resource), ends(resource)
+			{
+			}
+
+			std::string_view key(size_t offset) const
+			{
+				const size_t begin = offset == 0 ? 0 : ends[offset - 1];
+				return std::string_view(keys).substr(begin,
+													 ends[offset] - begin);
+			}
+
+			std::pmr::string head;
+			std::pmr::string keys;
+			std::pmr::vector<uint32_t> ends;
+		};
+
+		/* template slots, one per format that caches key templates */
+		static constexpr size_t template_msgpack = 0;
+		static constexpr size_t template_cbor = 1;
+		static constexpr size_t template_json = 2;
+		static constexpr size_t template_count = 3;
+
+		/**
+		 * the key template of kind `which`, built on first use by
+		 * build(KeyTemplate &, keys in offset order). shapes never change
+		 * their keys, so a template is valid for the shape's lifetime.
+		 * two threads may race to build it, the loser's copy is dropped
+		 */
+		template <typename F>
+		const KeyTemplate &keyTemplate(size_t which, F &&build) const
+		{
+			auto &cached = templates_[which];
+			if (const KeyTemplate *t = cached.load(std::memory_order_acquire))
+				return *t;
+
+			std::vector<size_t> keys(getPropertyCount());
+			for (const Shape *s = this; s->parent_; s = s->parent_.get())
+				keys[s->offset_] = s->property_key_;
+
+			std::pmr::polymorphic_allocator<KeyTemplate> alloc(
+				transitions_.get_allocator().resource());
+			KeyTemplate *built = alloc.new_object<KeyTemplate>(alloc.resource());
+			build(*built, keys);
+
+			const KeyTemplate *expected = nullptr;
+			if (!cached.compare_exchange_strong(expected, built,
+												std::memory_order_acq_rel))
+			{
+				alloc.delete_object(built);
+				return *expected;
+			}
+			return *built;
+		}
+
+		/* looks up the memory offset for a given property identifier */
+		std::expected<size_t, std::monostate> getOffset(size_t key) const
+		{
+			const Shape *current = this;
+			/* the root's parent is null, so this loop always terminates */
+			while (current->parent_)
+			{
+				if (current->property_key_ == key)
+				{
+					return current->offset_;
+				}
+				current = current->parent_.get();
+			}
+			return std::unexpected(std::monostate{}); /* signal "not found" */
+		}
+
+		/**
+		 * like getOffset, but returns the shape that added the property,
+		 * which also knows its representation. nullptr if not found
+		 */
+		const Shape *lookup(size_t key) const
+		{
+			const Shape *current = this;
+			while (current->parent_)
+			{
+				if (current->property_key_ == key)
+				{
+					return current;
+				}
+				current = current->parent_.get();
+			}
+			return nullptr;
+		}
+
+		/**
+		 * the representation of the property this shape added. relaxed is
+		 * enough: a slot is only written after its field was generalized,
+		 * under the owning object's lock, and readers take that lock too
+		 */
+		Representation representation() const
+		{
+			return representation_.load(std::memory_order_relaxed);
+		}
+
+		/* widens the representation so it also covers `rep` */
+		void generalize(Representation rep) const
+		{
+			Representation current =
+				representation_.load(std::memory_order_relaxed);
+			while (current != rep && current != Representation::any)
+			{
+				const Representation next = current == Representation::none
+												? rep
+												: Representation::any;
+				if (representation_.compare_exchange_weak(
+						current, next, std::memory_order_relaxed))
+				{
+					return;
+				}
+			}
+		}
+
+		inline size_t getNewOffset() const
+		{
+			return offset_;
+		}
+		inline size_t getPropertyCount() const
+		{
+			return offset_ == static_cast<size_t>(-1) ? 0 : offset_ + 1;
+		}
+
+	private:
+		friend class ObjectFactory;
+		friend class Snapshot;
+		friend class ArrowBatch;
+		friend class Script;
+		friend class Parallel;
+		template <BinaryFormat>
+		friend class BinaryCodec;
+
+		/**
+		 * parent_ points to the previous shape in the chain.
+		 * A lookup walks up this chain until it finds the property or
+		 * hits the root.
+		 */
+		std::shared_ptr<const Shape> parent_;
+
+		/**
+		 * property_key_ is the identifier for the new property that
+		 * this shape
+		 * adds relative to its parent.
+		 */
+		size_t property_key_;
+
+		/**
+		 * offset_ is the index in the values_ vector where the new
+		 *property is stored.
+		 */
+		size_t offset_;
+
+		/**
+		 * representation_ is the field representation of that property,
+		 * shared by every object with this shape. mutable because shapes
+		 * are otherwise immutable and reached through pointers to const
+		 */
+		mutable std::atomic<Representation> representation_{
+			Representation::none};
+
+		/**
+		 * set if the property is an accessor or a native method. its slot
+		 * is never used, every object of the shape shares the functions
+		 */
+		Accessor accessor_;
+
+		/**
+		 * caches the transition to a new shape when a property is added.
+		 * accessor transitions are keyed by ~key
+		 */
+		std::pmr::unordered_map<size_t, std::weak_ptr<Shape>> transitions_;
+
+		/* lazily built serialization templates, see keyTemplate */
+		mutable std::array<std::atomic<const KeyTemplate *>, template_count>
+			templates_{};
+	};
+
+public:
+	/**
+	 * a unique identifier for a property name, created by interning a
+	 * string
+	 */
+	using Identifier = size_t;
+
+	class DynObject
+	{
+	public:
+		using Args = std::vector<std::any>;
+		using Method = std::function<std::any(DynObject &, Args)>;
+		using NativeMethod = ObjectFactory::NativeMethod; /* see defineMethod */
+		using AsyncMethod = std::function<Task<std::any>(DynObject &, Args)>; /* see callAsync */
+
+		/**
+		 * the object's prototype for inheritance. properties not found
+		 * on this object will be looked up on its prototype
+		 */
+		std::shared_ptr<DynObject> prototype = nullptr;
+
+		/* fails if the object is frozen, or sealed and key is not own */
+		template <typename T>
+		std::expected<void, std::string> set(ObjectFactory &factory,
+											 Identifier key, T &&value)
+		{
+			bool observed;
+			std::optional<Accessor> accessor;
+			{
+				unique_lock_t<object_mutex_t> lock(mutex_);
+				if (const char *error = writeError(key)) [[unlikely]]
+					return std::unexpected(error);
+				if (const Accessor *a =
+						setLocked(factory, key, std::forward<T>(value)))
+					[[unlikely]] accessor = *a;
+				observed = observers_ != nullptr;
+			}
+			if (accessor) [[unlikely]]
+			{
+				/* the setter's own sets notify observers, if it does any */
+				if (!callSetter(*accessor, std::forward<T>(value)))
+					return std::unexpected("type mismatch for accessor");
+				return {};
+			}
+			if (observed) [[unlikely]]
+				changed(key);
+			return {};
+		}
+
+		/**
+		 * makes key an accessor property: get<T>(key) calls getter and
+		 * set(factory, key, value) calls setter (a no-op without one).
+		 * the pair is stored in the shape, so objects that define the same
+		 * accessors in the same order share shapes, and reading one costs
+		 * a shape lookup plus a direct call when T is the accessor's type.
+		 *
+		 * accessors on a prototype are found by get (called with the
+		 * object get was called on), but set on a missing key always adds
+		 * an own data property. transactions refuse accessors, and
+		 * serializers see them as empty values. sealed and frozen objects
+		 * can't get new accessors, but the setters of existing ones still
+		 * run on them
+		 */
+		template <typename T>
+		std::expected<void, std::string>
+		defineAccessor(ObjectFactory &factory, Identifier key,
+					   T (*getter)(const DynObject &),
+					   void (*setter)(DynObject &, T) = nullptr)
+		{
+			return define(factory, key, Accessor::make<T>(getter, setter));
+		}
+
+		/**
+		 * makes key a native method: call(key, args) calls
+		 * fn(*this, context, args) directly, no std::function and no
+		 * std::any around the callable. like accessors it lives in the
+		 * shape, so a method on a prototype (or on every object of a
+		 * shape) is stored once and costs one indirect call.
+		 * get<Method>(key) still works and gives a Method calling fn;
+		 * set(factory, key, value) replaces the method with the value
+		 */
+		std::expected<void, std::string> defineMethod(ObjectFactory &factory,
+													  Identifier key,
+													  NativeMethod fn,
+													  void *context = nullptr)
+		{
+			return define(factory, key, Accessor::makeMethod(fn, context));
+		}
+
+		/**
+		 * removes an own property. the object moves to the shape it would
+		 * have had if the property had never been added, so it keeps
+		 * sharing shapes with objects built without it. fails if there
+		 * was no such own property or the object is sealed or frozen
+		 */
+		std::expected<void, std::string> remove(ObjectFactory &factory,
+												Identifier key)
+		{
+			bool observed;
+			{
+				unique_lock_t<object_mutex_t> lock(mutex_);
+				if (const char *error = shapeError()) [[unlikely]]
+					return std::unexpected(error);
+				if (!removeLocked(factory, key))
+					return std::unexpected("no such property");
+				observed = observers_ != nullptr;
+			}
+			if (observed) [[unlikely]]
+				changed(key);
+			return {};
+		}
+
+		/**
+		 * no more adding or removing properties (or elements) on this
+		 * object. values can still change
+		 */
+		void seal()
+		{
+			unique_lock_t<object_mutex_t> lock(mutex_);
+			if (integrity_.load(std::memory_order_relaxed) == Integrity::none)
+				integrity_.store(Integrity::sealed, std::memory_order_release);
+		}
+
+		/**
+		 * makes the object read only: every write fails from now on, and
+		 * get/getElement/call stop taking the object's lock. freezing
+		 * also pins the prototype, don't assign `prototype` afterwards.
+		 *
+		 * if the whole prototype chain is already frozen, its properties
+		 * are resolved once here into a table sorted by key, so inherited
+		 * lookups (and misses) are one binary search instead of a walk up
+		 * the chain. freeze prototypes before the objects that use them
+		 */
+		void freeze()
+		{
+			unique_lock_t<object_mutex_t> lock(mutex_);
+			if (integrity_.load(std::memory_order_relaxed) == Integrity::frozen)
+				return;
+
+			bool chain_frozen = true;
+			for (const DynObject *p = prototype.get(); p && chain_frozen;
+				 p = p->prototype.get())
+				chain_frozen = p->frozen();
+			if (prototype && chain_frozen)
+			{
+				std::pmr::polymorphic_allocator<> alloc(
+					values_.get_allocator().resource());
+				inherited_ = alloc.new_object<std::pmr::vector<Inherited>>();
+				for (const DynObject *p = prototype.get(); p;
+					 p = p->prototype.get())
+				{
+					for (const Shape *s = p->shape_.get(); s->parent_;
+						 s = s->parent_.get())
+					{
+						if (!shape_->lookup(s->property_key_))
+							inherited_->push_back({s->property_key_, p, s});
+					}
+				}
+				/* the nearest prototype defining a key wins */
+				std::stable_sort(inherited_->begin(), inherited_->end(),
+								 [](const Inherited &a, const Inherited &b)
+								 { return a.key < b.key; });
+				inherited_->erase(
+					std::unique(inherited_->begin(), inherited_->end(),
+								[](const Inherited &a, const Inherited &b)
+								{ return a.key == b.key; }),
+					inherited_->end());
+				inherited_->shrink_to_fit();
+			}
+			integrity_.store(Integrity::frozen, std::memory_order_release);
+		}
+
+		Integrity integrity() const
+		{
+			return integrity_.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * several sets and removes under one exclusive lock. other threads
+		 * see none of them until the transaction ends, and then all of them
+		 * (commit) or none (rollback, which is also what happens when it's
+		 * destroyed without a commit). the lock is held for the whole life
+		 * of the transaction, so keep it short and don't go through the
+		 * object itself while it's open
+		 *
+		 *   auto tx = obj->transaction(factory);
+		 *   tx.set(x, 1);
+		 *   tx.remove(y);
+		 *   tx.commit();
+		 */
+		class Transaction
+		{
+		public:
+			~Transaction()
+			{
+				rollback();
+			}
+
+			Transaction(const Transaction &) = delete;
+			Transaction &operator=(const Transaction &) = delete;
+
+			/**
+			 * fails like DynObject::set, without ending the transaction.
+			 * accessors fail too: their setters can't run under the
+			 * transaction's lock, and there'd be nothing to roll back
+			 */
+			template <typename T>
+			std::expected<void, std::string> set(Identifier key, T &&value)
+			{
+				if (const char *error = obj_.writeError(key)) [[unlikely]]
+					return std::unexpected(error);
+				const Shape *field = obj_.shape_->lookup(key);
+				if (field && field->accessor_.type && !field->accessor_.method())
+					[[unlikely]] return std::unexpected(
+						"accessor properties can't be set in a transaction");
+				if (!field || field->accessor_.method())
+					saveShape(); /* an add */
+				else if (!shape_)
+					undo_.emplace_back(field->offset_,
+									   obj_.values_[field->offset_]);
+				obj_.setLocked(factory_, key, std::forward<T>(value));
+				touched(key);
+				return {};
+			}
+
+			std::expected<void, std::string> remove(Identifier key)
+			{
+				if (const char *error = obj_.shapeError()) [[unlikely]]
+					return std::unexpected(error);
+				if (!obj_.shape_->lookup(key))
+					return std::unexpected("no such property");
+				saveShape();
+				obj_.removeLocked(factory_, key);
+				touched(key);
+				return {};
+			}
+
+			/* publishes the changes and lets other threads in */
+			void commit()
+			{
+				if (!open_)
+					return;
+				open_ = false;
+				const bool observed = obj_.observers_ != nullptr;
+				unlock();
+				if (observed)
+				{
+					Batch batch; /* one notification for the lot */
+					for (Identifier key : keys_)
+						obj_.changed(key);
+				}
+			}
+
+			/* puts everything back the way it was when the transaction began */
+			void rollback()
+			{
+				if (!open_)
+					return;
+				open_ = false;
+				if (shape_)
+				{
+					obj_.shape_ = std::move(shape_);
+					obj_.values_ = std::move(values_);
+				}
+				for (auto it = undo_.rbegin(); it != undo_.rend(); ++it)
+					obj_.values_[it->first] = std::move(it->second);
+				obj_.forgetHash();
+				if (changes_)
+					*obj_.changes_ = std::move(*changes_);
+				unlock();
+			}
+
+		private:
+			friend class DynObject;
+
+			Transaction(DynObject &obj, ObjectFactory &factory)
+				: obj_(obj), factory_(factory), lock_(obj.mutex_),
+				  arena_(buffer_, sizeof(buffer_)), undo_(&arena_),
+				  values_(obj.values_.get_allocator()), keys_(&arena_)
+			{
+				undo_.reserve(8);
+				if (obj.changes_)
+					changes_.emplace(*obj.changes_);
+			}
+
+			/**
+			 * adds and removes move slots around, so the first one saves
+			 * the whole shape and slots. value changes before that are
+			 * undone slot by slot, the ones after it don't need saving
+			 */
+			void saveShape()
+			{
+				if (shape_)
+					return;
+				shape_ = obj_.shape_;
+				values_ = obj_.values_;
+			}
+
+			/* only needed for the observers */
+			void touched(Identifier key)
+			{
+				if (obj_.observers_ &&
+					std::find(keys_.begin(), keys_.end(), key) == keys_.end())
+					keys_.push_back(key);
+			}
+
+			void unlock()
+			{
+#ifdef DYNOBJECT_MULTITHREADED
+				lock_.unlock();
+#endif
+			}
+
+			DynObject &obj_;
+			ObjectFactory &factory_;
+			unique_lock_t<object_mutex_t> lock_;
+			bool open_ = true;
+			/* the undo log of a small transaction doesn't hit the heap */
+			alignas(std::max_align_t) std::byte buffer_[256];
+			std::pmr::monotonic_buffer_resource arena_;
+			std::pmr::vector<std::pair<size_t, Slot>> undo_;
+			std::shared_ptr<Shape> shape_; /* set once saveShape ran */
+			std::pmr::vector<Slot> values_;
+			std::optional<Changes> changes_;
+			std::pmr::vector<Identifier> keys_;
+		};
+
+		/* opens a transaction, see Transaction. blocks other writers and readers */
+		Transaction transaction(ObjectFactory &factory)
+		{
+			return Transaction(*this, factory);
+		}
+
+		/**
+		 * called after properties of an object changed, with the keys that
+		 * did (each once, in the order they first changed). the object's
+		 * lock is not held, so observers can read and write it
+		 */
+		using Observer = std::function<void(DynObject &, std::span<const Identifier>)>;
+		using Subscription = uint64_t;
+
+		/**
+		 * changes made while a Batch is alive on this thread are coalesced
+		 * per object and delivered once, when the outermost Batch ends.
+		 * objects changed in a batch have to outlive it
+		 */
+		class Batch
+		{
+		public:
+			Batch()
+			{
+				batchState().depth++;
+			}
+
+			~Batch()
+			{
+				if (--batchState().depth == 0)
+					flush();
+			}
+
+			Batch(const Batch &) = delete;
+			Batch &operator=(const Batch &) = delete;
+		};
+
+		/* calls fn after any own property is set, added or removed */
+		Subscription observe(Observer fn)
+		{
+			return subscribe(any_key, std::move(fn));
+		}
+
+		/* calls fn with just key, after key is set, added or removed */
+		Subscription observe(Identifier key, Observer fn)
+		{
+			return subscribe(key, std::move(fn));
+		}
+
+		/* false if there was no such subscription */
+		bool unobserve(Subscription id)
+		{
+			unique_lock_t<object_mutex_t> lock(mutex_);
+			if (!observers_)
+				return false;
+			auto &entries = observers_->entries;
+			auto it = std::find_if(entries.begin(), entries.end(),
+								   [&](const auto &e) { return e.id == id; });
+			if (it == entries.end())
+				return false;
+			entries.erase(it);
+			if (entries.empty())
+			{
+				/* back to the single branch in set */
+				std::pmr::polymorphic_allocator<Observers> alloc(
+					values_.get_allocator().resource());
+				alloc.delete_object(observers_);
+				observers_ = nullptr;
+			}
+			return true;
+		}
+
+	private:
+		/**
+		 * what weak references point at. it outlives the object for as
+		 * long as a Weak refers to it, so it comes from plain new rather
+		 * than the object's resource, which may be gone by then. in
+		 * single threaded builds the pointer and count are plain fields
+		 */
+		struct Lifetime
+		{
+			using Finalizer = std::function<void(const DynObject &)>;
+
+			explicit Lifetime(DynObject *obj) : object(obj)
+			{
+			}
+
+			DynObject *get() const
+			{
+#ifdef DYNOBJECT_MULTITHREADED
+				return object.load(std::memory_order_acquire);
+#else
+				return object;
+#endif
+			}
+
+			void retain()
+			{
+#ifdef DYNOBJECT_MULTITHREADED
+				refs.fetch_add(1, std::memory_order_relaxed);
+#else
+				++refs;
+#endif
+			}
+
+			/* true when that was the last reference */
+			bool drop()
+			{
+#ifdef DYNOBJECT_MULTITHREADED
+				return refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+#else
+				return --refs == 0;
+#endif
+			}
+
+			/* the object died or moved (ObjectFactory::evacuate), under mutex */
+			void retarget(DynObject *obj)
+			{
+#ifdef DYNOBJECT_MULTITHREADED
+				object.store(obj, std::memory_order_release);
+#else
+				object = obj;
+#endif
+			}
+
+#ifdef DYNOBJECT_MULTITHREADED
+			std::atomic<DynObject *> object;
+			std::atomic<size_t> refs{1}; /* the object's own, plus one per Weak */
+#else
+			DynObject *object;
+			size_t refs = 1;
+#endif
+			factory_mutex_t mutex; /* for object changing and finalizers */
+			std::vector<std::pair<Subscription, Finalizer>> finalizers;
+			Subscription next_id = 1;
+		};
+
+	public:
+		/**
+		 * a weak reference: get() is the object, or nullptr once it was
+		 * destroyed, and it doesn't keep the object alive. get() is a
+		 * single load and copying one bumps a counter (atomic only in
+		 * multithreaded builds). like ObjectFactory::resolve, nothing
+		 * stops another thread destroying the object while the pointer
+		 * from get() is in use, whoever owns it has to see to that.
+		 * two Weaks compare equal when they refer to the same object
+		 */
+		class Weak
+		{
+		public:
+			using Finalizer = Lifetime::Finalizer;
+
+			Weak() = default;
+
+			Weak(const Weak &other) : lifetime_(other.lifetime_)
+			{
+				if (lifetime_)
+					lifetime_->retain();
+			}
+
+			Weak(Weak &&other) noexcept
+				: lifetime_(std::exchange(other.lifetime_, nullptr))
+			{
+			}
+
+			Weak &operator=(Weak other) noexcept
+			{
+				std::swap(lifetime_, other.lifetime_);
+				return *this;
+			}
+
+			~Weak()
+			{
+				if (lifetime_ && lifetime_->drop())
+					delete lifetime_;
+			}
+
+			DynObject *get() const
+			{
+				return lifetime_ ? lifetime_->get() : nullptr;
+			}
+
+			bool expired() const
+			{
+				return get() == nullptr;
+			}
+
+			/**
+			 * calls fn when the object is destroyed, from its destructor:
+			 * weak references already read nullptr, but fn still gets to
+			 * read the object's properties. finalizers run in the order
+			 * they were added, with no lock held. 0 if the object is
+			 * already gone
+			 */
+			Subscription finalize(Finalizer fn) const
+			{
+				if (!lifetime_)
+					return 0;
+				unique_lock_t<factory_mutex_t> lock(lifetime_->mutex);
+				if (!lifetime_->get())
+					return 0;
+				const Subscription id = lifetime_->next_id++;
+				lifetime_->finalizers.emplace_back(id, std::move(fn));
+				return id;
+			}
+
+			/* false if there's no such finalizer (any more) */
+			bool unfinalize(Subscription id) const
+			{
+				if (!lifetime_)
+					return false;
+				unique_lock_t<factory_mutex_t> lock(lifetime_->mutex);
+				auto &entries = lifetime_->finalizers;
+				auto it = std::find_if(entries.begin(), entries.end(),
+									   [&](const auto &e) { return e.first == id; });
+				if (it == entries.end())
+					return false;
+				entries.erase(it);
+				return true;
+			}
+
+			/* stays the same while the object lives, even if it moves */
+			const void *identity() const
+			{
+				return lifetime_;
+			}
+
+			friend bool operator==(const Weak &a, const Weak &b)
+			{
+				return a.lifetime_ == b.lifetime_;
+			}
+
+		private:
+			friend class DynObject;
+
+			explicit Weak(Lifetime *lifetime) : lifetime_(lifetime)
+			{
+				lifetime_->retain();
+			}
+
+			Lifetime *lifetime_ = nullptr;
+		};
+
+		/* a weak reference to this object */
+		Weak weak()
+		{
+			unique_lock_t<object_mutex_t> lock(mutex_);
+			if (!lifetime_)
+				lifetime_ = new Lifetime(this);
+			return Weak(lifetime_);
+		}
+
+		/* weak().identity() without making one, nullptr before weak() */
+		const void *identity() const
+		{
+			shared_lock_t<object_mutex_t> lock(mutex_);
+			return lifetime_;
+		}
+
+		/**
+		 * the keys of what changed between two checkpoints. added keys
+		 * are not in changed, even if they were set again after being added
+		 */
+		struct ChangeSet
+		{
+			std::vector<Identifier> added;
+			std::vector<Identifier> changed;
+			std::vector<Identifier> removed;
+
+			bool empty() const
+			{
+				return added.empty() && changed.empty() && removed.empty();
+			}
+		};
+
+		/**
+		 * turns change tracking on (starting from a clean checkpoint) or
+		 * off. untracked objects pay one branch per set for it
+		 */
+		void trackChanges(bool on = true)
+		{
+			unique_lock_t<object_mutex_t> lock(mutex_);
+			std::pmr::polymorphic_allocator<Changes> alloc(
+				values_.get_allocator().resource());
+			if (on && !changes_)
+				changes_ = alloc.new_object<Changes>(alloc.resource());
+			else if (!on && changes_)
+			{
+				alloc.delete_object(changes_);
+				changes_ = nullptr;
+			}
+		}
+
+		bool tracksChanges() const
+		{
+			shared_lock_t<object_mutex_t> lock(mutex_);
+			return changes_ != nullptr;
+		}
+
+		/* true if something was set, added or removed since the checkpoint */
+		bool hasChanges() const
+		{
+			shared_lock_t<object_mutex_t> lock(mutex_);
+			return changes_ && !changes_->empty();
+		}
+
+		/**
+		 * returns what changed since the last checkpoint and starts a new
+		 * one, atomically with respect to other writers. empty if tracking
+		 * is off
+		 */
+		ChangeSet checkpoint()
+		{
+			unique_lock_t<object_mutex_t> lock(mutex_);
+			ChangeSet set;
+			if (!changes_)
+				return set;
+
+			set.added.assign(changes_->added().begin(), changes_->added().end());
+			set.removed.assign(changes_->removed().begin(),
+							   changes_->removed().end());
+			for (const Shape *s = shape_.get(); s->parent_;
+				 s = s->parent_.get())
+			{
+				if (changes_->stored(s->offset_) &&
+					std::find(set.added.begin(), set.added.end(),
+							  s->property_key_) == set.added.end())
+					set.changed.push_back(s->property_key_);
+			}
+			std::reverse(set.changed.begin(), set.changed.end());
+			changes_->clear();
+			return set;
+		}
+
+		/**
+		 * the changes as a JSON Patch (RFC 6902) array: remove, add and
+		 * replace operations with the current values. keys removed again
+		 * after the checkpoint was taken are left out
+		 */
+		std::string deltaJSON(const ObjectFactory &factory,
+							  const ChangeSet &changes) const
+		{
+			std::string out = "[";
+			bool first = true;
+			auto op = [&](const char *name, Identifier key)
+			{
+				if (!first)
+					out += ',';
+				first = false;
+				out += "{\"op\":\"";
+				out += name;
+				out += "\",\"path\":";
+				/* a JSON pointer: ~ and / are escaped as ~0 and ~1 */
+				std::string path = "/";
+				for (char c : factory.getString(key))
+				{
+					if (c == '~')
+						path += "~0";
+					else if (c == '/')
+						path += "~1";
+					else
+						path += c;
+				}
+				appendEscaped(out, path);
+			};
+
+			shared_lock_t<object_mutex_t> lock(mutex_);
+			for (Identifier key : changes.removed)
+			{
+				op("remove", key);
+				out += '}';
+			}
+			for (const auto *list : {&changes.added, &changes.changed})
+			{
+				for (Identifier key : *list)
+				{
+					const Shape *field = shape_->lookup(key);
+					if (!field)
+						continue;
+					op(list == &changes.added ? "add" : "replace", key);
+					out += ",\"value\":";
+					appendSlotJSON(out, values_[field->offset_]);
+					out += '}';
+				}
+			}
+			out += ']';
+			return out;
+		}
+
+		template <typename T>
+		std::expected<T, std::string> get(Identifier key) const
+		{
+			return getFrom<T>(key, *this);
+		}
+
+		/**
+		 * stores an integer indexed property (an element). elements live
+		 * in their own backing store: no interning, no shape transition.
+		 * a sealed object only takes stores to elements it already has,
+		 * a frozen one none at all
+		 */
+		template <typename T>
+		std::expected<void, std::string> setElement(size_t index, T &&value)
+		{
+			unique_lock_t<object_mutex_t> lock(mutex_);
+
+			if (const Integrity level = integrity_.load(std::memory_order_relaxed);
+				level != Integrity::none) [[unlikely]]
+			{
+				if (level == Integrity::frozen)
+					return std::unexpected("object is frozen");
+				if (!elements_ || !elements_->has(index))
+					return std::unexpected("object is sealed");
+			}
+			if (!elements_)
+			{
+				std::pmr::polymorphic_allocator<Elements> alloc(
+					values_.get_allocator().resource());
+				elements_ = alloc.new_object<Elements>(alloc.resource());
+			}
+			writeBarrier(value);
+			forgetHash();
+			elements_->set(index, std::forward<T>(value));
+			return {};
+		}
+
+		/* reads an element, falling back to the prototype like get does */
+		template <typename T>
+		std::expected<T, std::string> getElement(size_t index) const
+		{
+			if (frozen())
+			{
+				if (elements_ && elements_->has(index))
+					return readElement<T>(index);
+			}
+			else
+			{
+				/* unlocked at the end of the scope, before recursing */
+				shared_lock_t<object_mutex_t> lock(mutex_);
+				if (elements_ && elements_->has(index))
+					return readElement<T>(index);
+			}
+
+			if (prototype)
+			{
+				return prototype->getElement<T>(index);
+			}
+
+			return std::unexpected("no such element");
+		}
+
+		/* one past the highest own element index, like a JS array length */
+		size_t elementsLength() const
+		{
+			if (frozen())
+				return elements_ ? elements_->length() : 0;
+			shared_lock_t<object_mutex_t> lock(mutex_);
+			return elements_ ? elements_->length() : 0;
+		}
+
+		ElementsKind elementsKind() const
+		{
+			if (frozen())
+				return elements_ ? elements_->kind() : ElementsKind::none;
+			shared_lock_t<object_mutex_t> lock(mutex_);
+			return elements_ ? elements_->kind() : ElementsKind::none;
+		}
+
+		template <typename R = std::any>
+		std::expected<R, std::string> call(Identifier name, Args args = {})
+		{
+			Accessor native;
+			auto maybe_method = getFrom<Method>(name, *this, &native);
+			if (native.type)
+			{
+				return resultAs<R>(reinterpret_cast<NativeMethod>(native.getter)(
+					*this, native.context, args));
+			}
+
+			if (!maybe_method.has_value())
+			{
+				return std::unexpected(maybe_method.error());
+			}
+
+			const Method &method_to_call = maybe_method.value();
+			return resultAs<R>(method_to_call(*this, std::move(args)));
+		}
+
+		/**
+		 * call for methods that wait on I/O. an AsyncMethod (a function
+		 * returning a Task, i.e. a coroutine) is awaited; a Method or
+		 * native method is just called, so callers don't care which one
+		 * they got. the task is lazy, the lookup happens when it's first
+		 * awaited, and the object has to live until it's done
+		 */
+		template <typename R = std::any>
+		Task<std::expected<R, std::string>> callAsync(Identifier name, Args args = {})
+		{
+			/* a native method is found as such, without wrapping it first */
+			Accessor native;
+			auto maybe_async = getFrom<AsyncMethod>(name, *this, &native);
+			if (native.type)
+				co_return resultAs<R>(reinterpret_cast<NativeMethod>(
+					native.getter)(*this, native.context, args));
+			if (!maybe_async.has_value())
+				co_return call<R>(name, std::move(args));
+
+			const AsyncMethod method = std::move(maybe_async.value());
+			co_return resultAs<R>(co_await method(*this, std::move(args)));
+		}
+		/* JSON serialization */
+		std::string toJSON(const ObjectFactory &factory)
+			const /* need factory because of interning */
+		{
+			std::string out;
+			appendJSON(factory, out);
+			return out;
+		}
+
+		/**
+		 * appends the JSON of this object to out. reuse one string across
+		 * calls to serialize many objects without reallocating.
+		 *
+		 * elements come first in index order, then own properties in the
+		 * order they were added, then each prototype's elements and
+		 * properties that aren't shadowed, the same ones getElement and
+		 * get find. the names and separators come from a template cached
+		 * on the shape, so only the values get formatted per object
+		 */
+		void appendJSON(const ObjectFactory &factory, std::string &out) const
+		{
+			out += '{';
+			bool first = true;
+			/* names and indices already written, so shadowed ones are skipped */
+			JsonSeen seen;
+			{
+				shared_lock_t<object_mutex_t> lock(mutex_);
+				appendOwnJSON(factory, out, first, nullptr);
+				if (prototype)
+					rememberJSON(seen);
+			}
+
+			if (prototype)
+			{
+				for (const DynObject *proto = prototype.get(); proto;
+					 proto = proto->prototype.get())
+				{
+					shared_lock_t<object_mutex_t> lock(proto->mutex_);
+					proto->appendOwnJSON(factory, out, first, &seen);
+					if (proto->prototype)
+						proto->rememberJSON(seen);
+				}
+			}
+			out += '}';
+		}
+
+		/**
+		 * a hash of the object's content: own properties (by key, so the
+		 * order they were added in doesn't matter) and elements. nested
+		 * objects held as std::shared_ptr<DynObject> count by content
+		 * too, Handles by identity. prototypes don't count.
+		 *
+		 * the hash is kept until the object is next written. it isn't
+		 * kept while it depends on nested objects that aren't frozen,
+		 * since those can change without this object knowing
+		 */
+		size_t hash() const
+		{
+			ContentPath path;
+			bool stable = true;
+			return hashOf(path, stable);
+		}
+
+		/**
+		 * same content as other, in the sense of hash (equal objects hash
+		 * the same). objects of one shape compare slot by slot, others
+		 * key by key. values are compared by type and value: an int
+		 * never equals a double, and values of types other than the
+		 * usual scalars, strings, byte and std::any vectors, string maps,
+		 * objects and Handles only equal themselves. keys are the
+		 * factory's, so both objects must come from the same factory
+		 */
+		bool equals(const DynObject &other) const
+		{
+			ContentPath path;
+			return equalTo(other, path);
+		}
+
+		/* hash and equals as functors over object pointers */
+		struct ContentHash
+		{
+			template <typename P>
+			size_t operator()(const P &obj) const
+			{
+				return obj->hash();
+			}
+		};
+		struct ContentEqual
+		{
+			template <typename P, typename Q>
+			bool operator()(const P &a, const Q &b) const
+			{
+				return a->equals(*b);
+			}
+		};
+
+	private:
+		friend class ObjectFactory;
+		friend class Snapshot;
+		friend class ArrowBatch;
+		friend class Script;
+		friend class Parallel;
+		template <BinaryFormat>
+		friend class BinaryCodec;
+
+		template <typename T>
+		static Representation representationOf(const T &value)
+		{
+			if constexpr (std::is_same_v<T, std::any>)
+				return Slot::representationOf(value);
+			else
+				return Slot::representationOf<T>();
+		}
+
+		/**
+		 * the collector's write barrier (see ObjectFactory::collectStep
+		 * and evacuate), for a value about to be stored. values that
+		 * can't be a Handle cost nothing, the rest a check of whether a
+		 * cycle is marking or an old object may get a young handle
+		 */
+		template <typename T>
+		void writeBarrier(const T &value) const
+		{
+			using U = std::decay_t<T>;
+			if constexpr (std::is_same_v<U, Handle> || std::is_same_v<U, std::any> ||
+						  std::is_same_v<U, Slot>)
+			{
+				if (!heap_)
+					return;
+				const bool old =
+					!young_ && heap_->has_young_.load(std::memory_order_relaxed);
+				if (!old && !heap_->marking_.load(std::memory_order_relaxed))
+					[[likely]] return;
+				const Handle *handle;
+				if constexpr (std::is_same_v<U, Handle>)
+					handle = &value;
+				else if constexpr (std::is_same_v<U, std::any>)
+					handle = std::any_cast<Handle>(&value);
+				else
+					handle = value.template ptr<Handle>();
+				if (handle)
+					heap_->barrier(*handle, old);
+			}
+		}
+
+		/* defineAccessor and defineMethod: key becomes an accessor */
+		std::expected<void, std::string>
+		define(ObjectFactory &factory, Identifier key, const Accessor &accessor)
+		{
+			unique_lock_t<object_mutex_t> lock(mutex_);
+			if (const char *error = shapeError()) [[unlikely]]
+				return std::unexpected(error);
+			if (shape_->lookup(key))
+				removeLocked(factory, key);
+
+			unique_lock_t<factory_mutex_t> factory_lock(factory.factory_mutex_);
+			shape_ = factory.transition(shape_, key, &accessor);
+			values_.resize(shape_->getPropertyCount());
+			forgetHash();
+			return {};
+		}
+
+		template <typename R>
+		static std::expected<R, std::string> resultAs(std::any &&result)
+		{
+			if constexpr (std::is_same_v<R, std::any>)
+			{
+				return std::move(result);
+			}
+			else
+			{
+				if (const R *val = std::any_cast<R>(&result))
+				{
+					return *val;
+				}
+				return std::unexpected("type mismatch for method return value");
+			}
+		}
+
+		/**
+		 * get, with receiver being the object get was called on. with
+		 * native set, a native method found for a Method is copied there
+		 * instead of being wrapped
+		 */
+		template <typename T>
+		std::expected<T, std::string> getFrom(Identifier key,
+											  const DynObject &receiver,
+											  Accessor *native = nullptr) const
+		{
+			if (frozen())
+				return getFrozen<T>(key, receiver, native);
+
+			shared_lock_t<object_mutex_t> lock(mutex_);
+
+			if (const Shape *field = shape_->lookup(key))
+			{
+				if (field->accessor_.type) [[unlikely]]
+				{
+					const Accessor accessor = field->accessor_;
+#ifdef DYNOBJECT_MULTITHREADED
+					lock.unlock(); /* the getter may read the object */
+#endif
+					return callGetter<T>(accessor, receiver, native);
+				}
+				return readSlot<T>(*field);
+			}
+
+#ifdef DYNOBJECT_MULTITHREADED
+			lock.unlock(); /* unlock before recursing to mitigate deadlocks */
+#endif
+
+			if (prototype)
+			{
+				return prototype->getFrom<T>(key, receiver, native);
+			}
+
+			return std::unexpected("no such property");
+		}
+
+		/**
+		 * getFrom on a frozen object: shape_ and values_ can't change any
+		 * more, so there is nothing to lock
+		 */
+		template <typename T>
+		std::expected<T, std::string> getFrozen(Identifier key,
+												const DynObject &receiver,
+												Accessor *native) const
+		{
+			const DynObject *holder = this;
+			const Shape *field = frozenLookup(key, holder);
+			if (!field)
+			{
+				if (prototype && !inherited_)
+					return prototype->getFrom<T>(key, receiver, native);
+				return std::unexpected("no such property");
+			}
+			if (field->accessor_.type) [[unlikely]]
+				return callGetter<T>(field->accessor_, receiver, native);
+			return holder->readSlot<T>(*field);
+		}
+
+		/**
+		 * key on a frozen object, own or from the inherited_ table (then
+		 * holder is the prototype that has it). nullptr if not found; the
+		 * prototype still needs a look when there is no inherited_ table
+		 */
+		const Shape *frozenLookup(Identifier key, const DynObject *&holder) const
+		{
+			if (const Shape *field = shape_->lookup(key))
+				return field;
+			if (!inherited_)
+				return nullptr;
+			auto it = std::lower_bound(
+				inherited_->begin(), inherited_->end(), key,
+				[](const Inherited &e, Identifier k) { return e.key < k; });
+			if (it == inherited_->end() || it->key != key)
+				return nullptr;
+			holder = it->holder;
+			return it->field;
+		}
+
+		/* reads a data property of this object, the caller holds the lock */
+		template <typename T>
+		std::expected<T, std::string> readSlot(const Shape &field) const
+		{
+			const Slot &slot = values_[field.offset_];
+			/**
+			 * a field known to hold T everywhere is read without
+			 * looking at the slot's own kind
+			 */
+			if constexpr (std::is_same_v<T, int>)
+			{
+				if (field.representation() == Representation::integer)
+					return slot.rawInt();
+			}
+			else if constexpr (std::is_same_v<T, double>)
+			{
+				if (field.representation() == Representation::floating)
+					return slot.rawDouble();
+			}
+			if constexpr (std::is_same_v<T, std::any>)
+				return slot.toAny();
+			else
+			{
+				if (const T *val = slot.ptr<T>())
+					return *val;
+				return std::unexpected("type mismatch for property");
+			}
+		}
+
+		/* reads an element that exists, the caller holds the lock */
+		template <typename T>
+		std::expected<T, std::string> readElement(size_t index) const
+		{
+			if constexpr (std::is_same_v<T, std::any>)
+				return elements_->toAny(index);
+			else
+			{
+				if (const T *val = elements_->ptr<T>(index))
+					return *val;
+				return std::unexpected("type mismatch for element");
+			}
+		}
+
+		/* frozen objects are read without locking, see freeze */
+		bool frozen() const
+		{
+			return integrity_.load(std::memory_order_acquire) ==
+				   Integrity::frozen;
+		}
+
+		/**
+		 * why a set of key is refused, or nullptr. the caller holds mutex_.
+		 * setters of accessors still run on sealed and frozen objects
+		 */
+		const char *writeError(Identifier key) const
+		{
+			const Integrity level = integrity_.load(std::memory_order_relaxed);
+			if (level == Integrity::none) [[likely]]
+				return nullptr;
+			const Shape *field = shape_->lookup(key);
+			const bool method = field && field->accessor_.method();
+			if (field && field->accessor_.type && !method)
+				return nullptr;
+			if (level == Integrity::frozen)
+				return "object is frozen";
+			/* replacing a native method is a remove and an add */
+			return field && !method ? nullptr : "object is sealed";
+		}
+
+		/* why adding/removing properties is refused, or nullptr */
+		const char *shapeError() const
+		{
+			switch (integrity_.load(std::memory_order_relaxed))
+			{
+			case Integrity::none:
+				return nullptr;
+			case Integrity::sealed:
+				return "object is sealed";
+			default:
+				return "object is frozen";
+			}
+		}
+
+		template <typename T>
+		static std::expected<T, std::string>
+		callGetter(const Accessor &accessor, const DynObject &receiver,
+				   Accessor *native = nullptr)
+		{
+			if constexpr (std::is_same_v<T, Method> ||
+						  std::is_same_v<T, AsyncMethod>)
+			{
+				if (native && accessor.method())
+				{
+					*native = accessor;
+					return T();
+				}
+			}
+			if constexpr (!std::is_same_v<T, std::any>)
+			{
+				if (accessor.type == Accessor::typeTag<T>())
+					return reinterpret_cast<T (*)(const DynObject &)>(
+						accessor.getter)(receiver);
+			}
+			std::any value = accessor.get_any(accessor, receiver);
+			if constexpr (std::is_same_v<T, std::any>)
+				return value;
+			else
+			{
+				if (T *val = std::any_cast<T>(&value))
+					return std::move(*val);
+				return std::unexpected("type mismatch for property");
+			}
+		}
+
+		/* false if value isn't of the accessor's type */
+		template <typename T>
+		bool callSetter(const Accessor &accessor, T &&value)
+		{
+			using U = std::decay_t<T>;
+			if (!accessor.setter)
+				return true;
+			if constexpr (!std::is_same_v<U, std::any>)
+			{
+				if (accessor.type == Accessor::typeTag<U>())
+				{
+					reinterpret_cast<void (*)(DynObject &, U)>(accessor.setter)(
+						*this, std::forward<T>(value));
+					return true;
+				}
+			}
+			return accessor.set_any(accessor, *this,
+									std::any(std::forward<T>(value)));
+		}
+
+		/**
+		 * set without locking, the caller holds mutex_ exclusively. if key
+		 * is an accessor nothing is stored and its Accessor is returned for
+		 * the caller to invoke once the lock is released
+		 */
+		template <typename T>
+		const Accessor *setLocked(ObjectFactory &factory, Identifier key,
+								  T &&value)
+		{
+			using U = std::decay_t<T>;
+			writeBarrier(value);
+			forgetHash();
+
+			const Shape *field = shape_->lookup(key);
+			if (field && field->accessor_.type) [[unlikely]]
+			{
+				if (!field->accessor_.method())
+					return &field->accessor_;
+				/* a value replaces a native method, it's added anew below */
+				removeLocked(factory, key);
+				field = nullptr;
+			}
+
+			if (field)
+			{
+				/**
+				 * property already exists. get the offset and update the value
+				 */
+				Slot &slot = values_[field->offset_];
+				if (changes_) [[unlikely]]
+					changes_->store(field->offset_);
+				if constexpr (!std::is_same_v<U, std::any>)
+				{
+					/**
+					 * same representation as the field: every slot at this
+					 * offset already holds that kind, so it's a raw store
+					 */
+					constexpr Representation rep = Slot::representationOf<U>();
+					if (field->representation() == rep)
+					{
+						if constexpr (rep == Representation::integer)
+							slot.rawInt() = value;
+						else if constexpr (rep == Representation::floating)
+							slot.rawDouble() = value;
+						else
+							slot.rawBoxed() = std::forward<T>(value);
+						return nullptr;
+					}
+				}
+				field->generalize(representationOf(value));
+				slot.store(std::forward<T>(value));
+			}
+			else
+			{
+				/* property doesn't exist: this is a shape transition. */
+				unique_lock_t<factory_mutex_t> factory_lock(
+					factory.factory_mutex_);
+				auto new_shape = factory.transition(shape_, key);
+				new_shape->generalize(representationOf(value));
+				shape_ = new_shape;
+
+				/**
+				 * pre allocate the vector to the new required
+				 * size. avoids multiple reallocations
+				 */
+				values_.resize(new_shape->getPropertyCount());
+				values_[new_shape->getNewOffset()].store(
+					std::forward<T>(value));
+				if (changes_) [[unlikely]]
+					changes_->add(key, new_shape->getNewOffset());
+			}
+			return nullptr;
+		}
+
+		/* remove without locking, the caller holds mutex_ exclusively */
+		bool removeLocked(ObjectFactory &factory, Identifier key)
+		{
+			const Shape *field = shape_->lookup(key);
+			if (!field)
+				return false;
+			const size_t removed = field->offset_;
+			forgetHash();
+
+			std::vector<const Shape *> fields(values_.size());
+			for (const Shape *s = shape_.get(); s->parent_;
+				 s = s->parent_.get())
+				fields[s->offset_] = s;
+
+			std::shared_ptr<Shape> shape = factory.root_shape_;
+			{
+				unique_lock_t<factory_mutex_t> factory_lock(
+					factory.factory_mutex_);
+				for (size_t offset = 0; offset < fields.size(); ++offset)
+				{
+					if (offset == removed)
+						continue;
+					const Shape *f = fields[offset];
+					shape = factory.transition(
+						shape, f->property_key_,
+						f->accessor_.type ? &f->accessor_ : nullptr);
+					if (values_[offset].kind() != Representation::none)
+						shape->generalize(values_[offset].kind());
+				}
+			}
+
+			shape_ = std::move(shape);
+			values_.erase(values_.begin() + static_cast<ptrdiff_t>(removed));
+			if (changes_) [[unlikely]]
+				changes_->remove(key, removed);
+			return true;
+		}
+
+		/* --- observers --- */
+
+		static constexpr Identifier any_key = static_cast<Identifier>(-1);
+
+		/* allocated on the first observe, freed with the last unobserve */
+		struct Observers
+		{
+			struct Entry
+			{
+				Subscription id;
+				Identifier key; /* any_key for whole object observers */
+				Observer fn;
+			};
+
+			explicit Observers(std::pmr::memory_resource *resource)
+				: entries(resource)
+			{
+			}
+
+			std::pmr::vector<Entry> entries;
+			Subscription next_id = 1;
+		};
+
+		/* an object and the keys that changed, each once */
+		using ChangeGroup = std::pair<DynObject *, std::vector<Identifier>>;
+
+		/* the changes waiting for the outermost Batch on this thread */
+		struct BatchState
+		{
+			size_t depth = 0;
+			std::vector<ChangeGroup> pending;
+			std::unordered_map<const DynObject *, size_t> index; /* pending */
+			std::vector<ChangeGroup> delivering;
+		};
+
+		static BatchState &batchState()
+		{
+			thread_local BatchState state;
+			return state;
+		}
+
+		Subscription subscribe(Identifier key, Observer fn)
+		{
+			unique_lock_t<object_mutex_t> lock(mutex_);
+			if (!observers_)
+			{
+				std::pmr::polymorphic_allocator<Observers> alloc(
+					values_.get_allocator().resource());
+				observers_ = alloc.new_object<Observers>(alloc.resource());
+			}
+			const Subscription id = observers_->next_id++;
+			observers_->entries.push_back({id, key, std::move(fn)});
+			return id;
+		}
+
+		/* a change to key happened, the object lock is not held */
+		void changed(Identifier key)
+		{
+			BatchState &state = batchState();
+			if (state.depth == 0)
+			{
+				notify(std::span<const Identifier>(&key, 1));
+				return;
+			}
+
+			/* coalesced right away, a batch holds each change once */
+			size_t at = state.pending.size();
+			if (at == 0 || state.pending.back().first != this)
+			{
+				auto [it, inserted] = state.index.try_emplace(this, at);
+				if (inserted)
+					state.pending.emplace_back(this, std::vector<Identifier>{});
+				at = it->second;
+			}
+			else
+				at--;
+			auto &keys = state.pending[at].second;
+			if (std::find(keys.begin(), keys.end(), key) == keys.end())
+				keys.push_back(key);
+		}
+
+		/* groups the pending changes per object and delivers them */
+		static void flush()
+		{
+			BatchState &state = batchState();
+			/* observers may batch again, so the pending list is emptied first */
+			auto &groups = state.delivering;
+			const size_t base = groups.size();
+			std::move(state.pending.begin(), state.pending.end(),
+					  std::back_inserter(groups));
+			state.pending.clear();
+			state.index.clear();
+
+			/* by index, an observer's notify can append groups (and resize) */
+			for (size_t i = base; i < groups.size(); ++i)
+			{
+				if (DynObject *obj = groups[i].first)
+				{
+					std::vector<Identifier> keys = std::move(groups[i].second);
+					obj->notify(keys);
+				}
+			}
+			groups.resize(base);
+		}
+
+		void notify(std::span<const Identifier> keys)
+		{
+			std::vector<typename Observers::Entry> entries;
+			{
+				shared_lock_t<object_mutex_t> lock(mutex_);
+				if (!observers_)
+					return;
+				/* copied so observers can (un)subscribe while being called */
+				entries.assign(observers_->entries.begin(),
+							   observers_->entries.end());
+			}
+			for (auto &e : entries)
+			{
+				if (e.key == any_key)
+					e.fn(*this, keys);
+				else if (std::find(keys.begin(), keys.end(), e.key) != keys.end())
+					e.fn(*this, std::span<const Identifier>(&e.key, 1));
+			}
+		}
+
+		/**
+		 * constructor is private, only the factory can create an object
+		 */
+		DynObject(std::shared_ptr<Shape> initial_shape,
+				  std::pmr::memory_resource *object_resource,
+				  std::pmr::memory_resource *slot_resource)
+			: shape_(std::move(initial_shape)), values_(slot_resource),
+			  resource_(object_resource)
+		{
+		}
+
+		~DynObject()
+		{
+			if (lifetime_)
+			{
+				std::vector<std::pair<Subscription, Lifetime::Finalizer>> finalizers;
+				{
+					unique_lock_t<factory_mutex_t> lock(lifetime_->mutex);
+					lifetime_->retarget(nullptr);
+					finalizers.swap(lifetime_->finalizers);
+				}
+				for (auto &[id, fn] : finalizers)
+					fn(*this);
+				if (lifetime_->drop())
+					delete lifetime_;
+			}
+
+			std::pmr::polymorphic_allocator<> alloc(
+				values_.get_allocator().resource());
+			if (elements_)
+				alloc.delete_object(elements_);
+			if (changes_)
+				alloc.delete_object(changes_);
+			if (observers_)
+				alloc.delete_object(observers_);
+			if (inherited_)
+				alloc.delete_object(inherited_);
+
+			/* don't deliver to a dead object, on this thread at least */
+			BatchState &state = batchState();
+			if (!state.pending.empty() || !state.delivering.empty())
+			{
+				if (auto it = state.index.find(this); it != state.index.end())
+				{
+					state.pending[it->second].first = nullptr;
+					state.index.erase(it);
+				}
+				for (auto &group : state.delivering)
+				{
+					if (group.first == this)
+						group.first = nullptr;
+				}
+			}
+		}
+
+	public:
+		/**
+		 * objects live in memory from the factory's objects resource. a
+		 * destroying delete gives the memory back to it, so a plain
+		 * std::unique_ptr / std::shared_ptr can still own a DynObject
+		 */
+		void operator delete(DynObject *obj, std::destroying_delete_t)
+		{
+			std::pmr::memory_resource *resource = obj->resource_;
+			obj->~DynObject();
+			resource->deallocate(obj, sizeof(DynObject), alignof(DynObject));
+		}
+
+	private:
+		std::shared_ptr<Shape> shape_;
+		std::pmr::vector<Slot> values_;
+		Elements *elements_ = nullptr; /* allocated on first setElement */
+		Changes *changes_ = nullptr;   /* only while tracking changes */
+		Observers *observers_ = nullptr; /* only while observed */
+		ObjectFactory *heap_ = nullptr;	 /* while in a handle table */
+		uint32_t heap_index_ = 0;		 /* its entry there */
+		Lifetime *lifetime_ = nullptr;	 /* once weak() was called */
+		/* a frozen object's properties inherited from a frozen chain */
+		struct Inherited
+		{
+			Identifier key;
+			const DynObject *holder;
+			const Shape *field;
+		};
+		std::pmr::vector<Inherited> *inherited_ = nullptr;
+		std::atomic<Integrity> integrity_ = Integrity::none;
+		bool young_ = false; /* lives in the factory's nursery */
+		mutable std::atomic<size_t> hash_{0}; /* see hash, 0 when unknown */
+		std::atomic<bool> canonical_{false}; /* see ObjectFactory::canonical */
+		mutable object_mutex_t mutex_;
+		std::pmr::memory_resource *resource_; /* where this object lives */
+
+		/* --- JSON helpers --- */
+
+		/* the pre-escaped `,"name":` fragments for objects of a shape */
+		static const Shape::KeyTemplate &jsonTemplate(const ObjectFactory &factory,
+													  const Shape &shape)
+		{
+			return shape.keyTemplate(
+				Shape::template_json,
+				[&](Shape::KeyTemplate &t, const std::vector<size_t> &keys)
+				{
+					std::string fragment;
+					for (size_t key : keys)
+					{
+						fragment = ",";
+						appendEscaped(fragment, factory.getString(key));
+						fragment += ':';
+						t.keys += fragment;
+						t.ends.push_back(static_cast<uint32_t>(t.keys.size()));
+					}
+				});
+		}
+
+		/* the keys and element indices appendJSON wrote, both sorted */
+		struct JsonSeen
+		{
+			std::vector<Identifier> keys;
+			std::vector<size_t> elements;
+		};
+
+		/* merges own keys and element indices into seen, caller holds the lock */
+		void rememberJSON(JsonSeen &seen) const
+		{
+			const size_t old_keys = seen.keys.size();
+			for (const Shape *s = shape_.get(); s->parent_;
+				 s = s->parent_.get())
+				seen.keys.push_back(s->property_key_);
+			std::sort(seen.keys.begin() + old_keys, seen.keys.end());
+			std::inplace_merge(seen.keys.begin(), seen.keys.begin() + old_keys,
+							   seen.keys.end());
+
+			if (!elements_)
+				return;
+			/* forEach goes in index order, no sort needed */
+			const size_t old_elements = seen.elements.size();
+			elements_->forEach([&](size_t index, const std::any &)
+							   { seen.elements.push_back(index); });
+			std::inplace_merge(seen.elements.begin(),
+							   seen.elements.begin() + old_elements,
+							   seen.elements.end());
+		}
+
+		/**
+		 * own elements and properties not in skip (nullptr for the object
+		 * itself, the rest are prototypes). caller holds the lock
+		 */
+		void appendOwnJSON(const ObjectFactory &factory, std::string &out,
+						   bool &first, const JsonSeen *skip) const
+		{
+			if (elements_)
+			{
+				elements_->forEach(
+					[&](size_t index, const std::any &val)
+					{
+						if (skip && std::binary_search(skip->elements.begin(),
+													   skip->elements.end(),
+													   index))
+							return;
+						if (!first)
+							out += ',';
+						out += '"';
+						out += std::to_string(index);
+						out += "\":";
+						appendValueJSON(out, val);
+						first = false;
+					});
+			}
+
+			const size_t props = values_.size();
+			if (props == 0)
+				return;
+			const Shape::KeyTemplate &keys = jsonTemplate(factory, *shape_);
+			std::vector<Identifier> ids; /* by offset, only for prototypes */
+			if (skip)
+			{
+				ids.resize(props);
+				for (const Shape *s = shape_.get(); s->parent_;
+					 s = s->parent_.get())
+					ids[s->offset_] = s->property_key_;
+			}
+			for (size_t offset = 0; offset < props; ++offset)
+			{
+				if (skip && std::binary_search(skip->keys.begin(),
+											   skip->keys.end(), ids[offset]))
+					continue;
+
+				std::string_view fragment = keys.key(offset);
+				if (first)
+					fragment.remove_prefix(1); /* no leading comma */
+				out += fragment;
+				first = false;
+
+				appendSlotJSON(out, values_[offset]);
+			}
+		}
+
+		/**
+		 * how deep hash and equals follow nested objects. path is the
+		 * objects they have locked so far, so a cycle is noticed before
+		 * an object gets locked twice
+		 */
+		static constexpr size_t max_content_depth = 64;
+
+		/* the map type valueHash and valueEqual look into */
+		using AnyMap = std::unordered_map<std::string, std::any>;
+
+		struct ContentPath
+		{
+			bool has(const DynObject *obj) const
+			{
+				const auto end = objects.begin() + size;
+				return std::find(objects.begin(), end, obj) != end;
+			}
+
+			std::array<const DynObject *, max_content_depth> objects;
+			size_t size = 0;
+		};
+
+		static size_t mixHash(size_t h)
+		{
+			/* splitmix64's finalizer */
+			uint64_t x = h + 0x9e3779b97f4a7c15ull;
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+			return size_t(x ^ (x >> 31));
+		}
+
+		static size_t doubleHash(double v)
+		{
+			if (v != v)
+				return 0x7ff8; /* every NaN the same */
+			return std::hash<double>{}(v == 0 ? 0.0 : v);
+		}
+
+		static bool doubleEqual(double a, double b)
+		{
+			return a == b || (a != a && b != b);
+		}
+
+		size_t hashOf(ContentPath &path, bool &stable) const
+		{
+			if (size_t cached = hash_.load(std::memory_order_relaxed))
+				return cached;
+			if (path.size == max_content_depth || path.has(this))
+			{
+				stable = false;
+				return 1; /* a cycle, or too deep */
+			}
+
+			shared_lock_t<object_mutex_t> lock(mutex_);
+			path.objects[path.size++] = this;
+			bool own_stable = true;
+			/* a sum, so properties added in any order hash the same */
+			size_t h = 0;
+			for (const Shape *s = shape_.get(); s->parent_;
+				 s = s->parent_.get())
+				h += mixHash(s->property_key_ ^
+							 slotHash(values_[s->offset_], path, own_stable) *
+								 0x100000001b3ull);
+			if (elements_)
+			{
+				/* slotHash agrees with valueHash, whatever kind stores them */
+				size_t e = elements_->length();
+				elements_->everySlot(
+					[&](size_t index, const Slot &value)
+					{
+						e = mixHash(e ^ index ^
+									slotHash(value, path, own_stable));
+						return true;
+					});
+				h ^= mixHash(e);
+			}
+			--path.size;
+
+			h = h ? h : 1; /* 0 is "not cached" */
+			if (own_stable)
+				hash_.store(h, std::memory_order_relaxed);
+			else
+				stable = false;
+			return h;
+		}
+
+		static size_t slotHash(const Slot &slot, ContentPath &path,
+							   bool &stable)
+		{
+			switch (slot.kind())
+			{
+			case Representation::integer:
+				return std::hash<int>{}(slot.rawInt());
+			case Representation::floating:
+				return doubleHash(slot.rawDouble());
+			case Representation::heap:
+				return valueHash(slot.rawBoxed(), path, stable);
+			default:
+				return 0;
+			}
+		}
+
+		static size_t valueHash(const std::any &v, ContentPath &path,
+								bool &stable)
+		{
+			/**
+			 * strings first: in slots ints and doubles are never boxed, and
+			 * each miss costs a type_info comparison
+			 */
+			if (auto p = std::any_cast<std::string>(&v))
+				return std::hash<std::string_view>{}(*p);
+			if (!v.has_value())
+				return 0;
+			if (auto p = std::any_cast<int>(&v))
+				return std::hash<int>{}(*p);
+			if (auto p = std::any_cast<double>(&v))
+				return doubleHash(*p);
+			if (auto p = std::any_cast<bool>(&v))
+				return *p ? 0x2545 : 0x2546;
+			if (auto p = std::any_cast<float>(&v))
+				return doubleHash(*p) ^ 0xf;
+			if (auto p = std::any_cast<int64_t>(&v))
+				return std::hash<int64_t>{}(*p) ^ 0x64;
+			if (auto p = std::any_cast<uint64_t>(&v))
+				return std::hash<uint64_t>{}(*p) ^ 0x65;
+			if (auto p = std::any_cast<const char *>(&v))
+				return std::hash<std::string_view>{}(*p);
+			if (auto p = std::any_cast<Handle>(&v))
+				return mixHash(p->bits);
+			if (auto p = std::any_cast<std::vector<uint8_t>>(&v))
+			{
+				const std::string_view bytes(
+					reinterpret_cast<const char *>(p->data()), p->size());
+				return std::hash<std::string_view>{}(bytes) ^ 0xb;
+			}
+			if (auto p = std::any_cast<std::vector<std::any>>(&v))
+			{
+				size_t h = p->size();
+				for (const std::any &elem : *p)
+					h = mixHash(h ^ valueHash(elem, path, stable));
+				return h;
+			}
+			if (auto p = std::any_cast<AnyMap>(&v))
+			{
+				size_t h = p->size();
+				for (const auto &[key, elem] : *p)
+					h += mixHash(std::hash<std::string_view>{}(key) ^
+								 valueHash(elem, path, stable));
+				return h;
+			}
+			if (auto p = std::any_cast<std::shared_ptr<DynObject>>(&v))
+			{
+				if (!*p)
+					return 0;
+				if (!(*p)->frozen())
+					stable = false;
+				return (*p)->hashOf(path, stable);
+			}
+			return v.type().hash_code();
+		}
+
+		bool equalTo(const DynObject &other, ContentPath &path) const
+		{
+			if (this == &other)
+				return true;
+			/* two canonical instances of one shape and prototype never match */
+			if (canonical_.load(std::memory_order_relaxed) &&
+				other.canonical_.load(std::memory_order_relaxed) &&
+				shape_ == other.shape_ && prototype == other.prototype)
+				return false;
+			const size_t a = hash_.load(std::memory_order_relaxed);
+			const size_t b = other.hash_.load(std::memory_order_relaxed);
+			if (a && b && a != b)
+				return false;
+			/* cycles and very deep nesting come down to identity */
+			if (path.size + 2 > max_content_depth || path.has(this) ||
+				path.has(&other))
+				return false;
+
+			/* both read locked, in address order */
+			const bool ordered = std::less<const DynObject *>{}(this, &other);
+			const DynObject &low = ordered ? *this : other;
+			const DynObject &high = ordered ? other : *this;
+			shared_lock_t<object_mutex_t> first(low.mutex_);
+			shared_lock_t<object_mutex_t> second(high.mutex_);
+			if (values_.size() != other.values_.size())
+				return false;
+			path.objects[path.size++] = this;
+			path.objects[path.size++] = &other;
+			bool equal = true;
+			if (shape_ == other.shape_)
+			{
+				for (size_t i = 0; equal && i < values_.size(); ++i)
+					equal = slotEqual(values_[i], other.values_[i], path);
+			}
+			else
+			{
+				for (const Shape *s = shape_.get(); equal && s->parent_;
+					 s = s->parent_.get())
+				{
+					const Shape *field = other.shape_->lookup(s->property_key_);
+					equal = field &&
+							field->accessor_.type == s->accessor_.type &&
+							slotEqual(values_[s->offset_],
+									  other.values_[field->offset_], path);
+				}
+			}
+			if (equal)
+				equal = elementsEqual(other, path);
+			path.size -= 2;
+			return equal;
+		}
+
+		bool elementsEqual(const DynObject &other,
+						   ContentPath &path) const
+		{
+			const size_t length = elements_ ? elements_->length() : 0;
+			if (length != (other.elements_ ? other.elements_->length() : 0))
+				return false;
+			if (length == 0)
+				return true;
+			/**
+			 * as many elements on both sides and each of ours matched at
+			 * its index in theirs. slots of any kind compare in place, a
+			 * packed element and a generic one holding the same int match
+			 */
+			if (elements_->count() != other.elements_->count())
+				return false;
+			Slot tmp;
+			return elements_->everySlot(
+				[&](size_t index, const Slot &mine)
+				{
+					const Slot *theirs = other.elements_->slotAt(index, tmp);
+					return theirs && slotEqual(mine, *theirs, path);
+				});
+		}
+
+		static bool slotEqual(const Slot &a, const Slot &b,
+							  ContentPath &path)
+		{
+			if (a.kind() != b.kind())
+				return false;
+			switch (a.kind())
+			{
+			case Representation::integer:
+				return a.rawInt() == b.rawInt();
+			case Representation::floating:
+				return doubleEqual(a.rawDouble(), b.rawDouble());
+			case Representation::heap:
+				return valueEqual(a.rawBoxed(), b.rawBoxed(), path);
+			default:
+				return true;
+			}
+		}
+
+		static bool valueEqual(const std::any &a, const std::any &b,
+							   ContentPath &path)
+		{
+			/* strings first, as in valueHash */
+			if (auto p = std::any_cast<std::string>(&a))
+			{
+				auto q = std::any_cast<std::string>(&b);
+				return q && *p == *q;
+			}
+			if (a.type() != b.type())
+				return false;
+			if (!a.has_value())
+				return true;
+			if (auto p = std::any_cast<int>(&a))
+				return *p == std::any_cast<int>(b);
+			if (auto p = std::any_cast<double>(&a))
+				return doubleEqual(*p, std::any_cast<double>(b));
+			if (auto p = std::any_cast<bool>(&a))
+				return *p == std::any_cast<bool>(b);
+			if (auto p = std::any_cast<float>(&a))
+				return doubleEqual(*p, std::any_cast<float>(b));
+			if (auto p = std::any_cast<int64_t>(&a))
+				return *p == std::any_cast<int64_t>(b);
+			if (auto p = std::any_cast<uint64_t>(&a))
+				return *p == std::any_cast<uint64_t>(b);
+			if (auto p = std::any_cast<const char *>(&a))
+				return std::string_view(*p) == std::any_cast<const char *>(b);
+			if (auto p = std::any_cast<Handle>(&a))
+				return *p == std::any_cast<Handle>(b);
+			if (auto p = std::any_cast<std::vector<uint8_t>>(&a))
+				return *p == *std::any_cast<std::vector<uint8_t>>(&b);
+			if (auto p = std::any_cast<std::vector<std::any>>(&a))
+			{
+				const auto &q = *std::any_cast<std::vector<std::any>>(&b);
+				if (p->size() != q.size())
+					return false;
+				for (size_t i = 0; i < p->size(); ++i)
+				{
+					if (!valueEqual((*p)[i], q[i], path))
+						return false;
+				}
+				return true;
+			}
+			if (auto p = std::any_cast<AnyMap>(&a))
+			{
+				const auto &q = *std::any_cast<AnyMap>(&b);
+				if (p->size() != q.size())
+					return false;
+				for (const auto &[key, elem] : *p)
+				{
+					auto it = q.find(key);
+					if (it == q.end() || !valueEqual(elem, it->second, path))
+						return false;
+				}
+				return true;
+			}
+			if (auto p = std::any_cast<std::shared_ptr<DynObject>>(&a))
+			{
+				const auto &q = *std::any_cast<std::shared_ptr<DynObject>>(&b);
+				if (!*p || !q)
+					return *p == q;
+				return (*p)->equalTo(*q, path);
+			}
+			return &a == &b;
+		}
+
+		/* the cached hash is stale, the caller holds mutex_ exclusively */
+		void forgetHash()
+		{
+			hash_.store(0, std::memory_order_relaxed);
+		}
+
+		static void appendSlotJSON(std::string &out, const Slot &slot)
+		{
+			switch (slot.kind())
+			{
+			case Representation::integer:
+				appendInt(out, slot.rawInt());
+				break;
+			case Representation::floating:
+				appendDouble(out, slot.rawDouble());
+				break;
+			case Representation::heap:
+				appendValueJSON(out, slot.rawBoxed());
+				break;
+			default:
+				out += "null";
+			}
+		}
+
+		static void appendInt(std::string &out, long long v)
+		{
+			char buf[24];
+			auto res = std::to_chars(buf, buf + sizeof(buf), v);
+			out.append(buf, res.ptr);
+		}
+
+		/* same text as std::to_string(double), which is printf's %f */
+		static void appendDouble(std::string &out, double v)
+		{
+			char buf[512];
+			const int n = std::snprintf(buf, sizeof(buf), "%f", v);
+			if (n > 0 && static_cast<size_t>(n) < sizeof(buf))
+				out.append(buf, static_cast<size_t>(n));
+			else
+				out += std::to_string(v); /* only for enormous values */
+		}
+
+		static void appendEscaped(std::string &out, std::string_view s)
+		{
+			static constexpr char hex[] = "0123456789abcdef";
+			out += '"';
+			for (char c : s)
+			{
+				switch (c)
+				{
+				case '\"':
+					out += "\\\"";
+					break;
+				case '\\':
+					out += "\\\\";
+					break;
+				case '\b':
+					out += "\\b";
+					break;
+				case '\f':
+					out += "\\f";
+					break;
+				case '\n':
+					out += "\\n";
+					break;
+				case '\r':
+					out += "\\r";
+					break;
+				case '\t':
+					out += "\\t";
+					break;
+				default:
+					if ((unsigned char)c < 0x20)
+					{
+						out += "\\u00";
+						out += hex[(unsigned char)c >> 4];
+						out += hex[(unsigned char)c & 0xf];
+					}
+					else
+					{
+						out += c;
+					}
+				}
+			}
+			out += '"';
+		}
+
+		static void appendValueJSON(std::string &out, const std::any &val)
+		{
+			if (!val.has_value())
+				out += "null";
+			else if (auto p = std::any_cast<int>(&val))
+				appendInt(out, *p);
+			else if (auto p = std::any_cast<double>(&val))
+				appendDouble(out, *p);
+			else if (auto p = std::any_cast<std::string>(&val))
+				appendEscaped(out, *p);
+			else if (auto p = std::any_cast<bool>(&val))
+				out += *p ? "true" : "false";
+			else
+				out += valueToJSON(val);
+		}
+
+		static std::string escapeJSONString(const std::string &s)
+		{
+			std::string out;
+			appendEscaped(out, s);
+			return out;
+		}
+
+		static std::string valueToJSON(const std::any &val)
+		{
+			if (!val.has_value())
+				return "null";
+
+			if (auto p = std::any_cast<int>(&val))
+				return std::to_string(*p);
+			if (auto p = std::any_cast<double>(&val))
+				return std::to_string(*p);
+			if (auto p = std::any_cast<float>(&val))
+				return std::to_string(*p);
+			if (auto p = std::any_cast<bool>(&val))
+				return *p ? "true" : "false";
+			if (auto p = std::any_cast<std::string>(&val))
+				return escapeJSONString(*p);
+			if (auto p = std::any_cast<const char *>(&val))
+				return escapeJSONString(*p);
+
+			if (auto p = std::any_cast<std::vector<std::any>>(&val))
+			{
+				std::ostringstream oss;
+				oss << "[";
+				bool first = true;
+				for (auto &elem : *p)
+				{
+					if (!first)
+						oss << ",";
+					oss << valueToJSON(elem);
+					first = false;
+				}
+				oss << "]";
+				return oss.str();
+			}
+
+			if (auto p =
+					std::any_cast<std::unordered_map<std::string, std::any>>(
+						&val))
+			{
+				std::ostringstream oss;
+				oss << "{";
+				bool first = true;
+				for (auto &[k, v] : *p)
+				{
+					if (!first)
+						oss << ",";
+					oss << escapeJSONString(k) << ":" << valueToJSON(v);
+					first = false;
+				}
+				oss << "}";
+				return oss.str();
+			}
+
+#ifdef __cpp_rtti
+			return std::string{"<"} + val.type().name() + ">";
+#else
+			return "\"<?>\"";
+#endif
+		}
+	};
+
+	/* FACTORY METHODS */
+
+	ObjectFactory() : ObjectFactory(FactoryResources{})
+	{
+	}
+
+	/* allocates everything from one memory resource */
+	explicit ObjectFactory(std::pmr::memory_resource *resource)
+		: ObjectFactory(FactoryResources::all(resource))
+	{
+	}
+
+	/**
+	 * allocates each kind of memory from its own resource. the resources
+	 * must outlive the factory and every object created by it
+	 */
+	explicit ObjectFactory(const FactoryResources &resources)
+		: resources_(resources),
+		  root_shape_(newShape(resources.shapes)),
+		  id_to_str_(resources.interner), str_to_id_(resources.interner)
+	{
+	}
+
+	/* objects still in the handle table die with the factory */
+	~ObjectFactory()
+	{
+		if (!handle_chunks_)
+			return;
+		const uint32_t count = handle_count_.load(std::memory_order_relaxed);
+		for (uint32_t index = 1; index < count; ++index)
+		{
+			if (handleEntry(index).live.load(std::memory_order_relaxed))
+				delete handleEntry(index).object.load(std::memory_order_relaxed);
+		}
+		std::pmr::polymorphic_allocator<HandleEntry> alloc(resources_.objects);
+		for (size_t c = 0; c <= (count - 1) >> handle_chunk_bits; ++c)
+		{
+			HandleEntry *entries = handle_chunks_[c].load(std::memory_order_relaxed);
+			std::destroy_n(entries, handle_chunk);
+			alloc.deallocate(entries, handle_chunk);
+		}
+	}
+
+	const FactoryResources &resources() const
+	{
+		return resources_;
+	}
+
+	/* creates a new, empty dynamic object */
+	std::unique_ptr<DynObject> createObject()
+	{
+		/**
+		 * use the private constructor via placement new on memory from
+		 * the objects resource. std::make_unique cannot access it
+		 */
+		void *mem = resources_.objects->allocate(sizeof(DynObject),
+												 alignof(DynObject));
+		try
+		{
+			return std::unique_ptr<DynObject>(new (mem) DynObject(
+				root_shape_, resources_.objects, resources_.slots));
+		}
+		catch (...)
+		{
+			resources_.objects->deallocate(mem, sizeof(DynObject),
+										   alignof(DynObject));
+			throw;
+		}
+	}
+
+	/**
+	 * creates an object owned by the handle table rather than by a
+	 * pointer. it lives until destroy(handle) or the factory's end, or
+	 * until the collector finds it unreachable: it starts out rooted once
+	 * (see root), unroot it once something else refers to it. the null
+	 * handle means the table is full (2^24 entries, minus those retired
+	 * after 256 uses)
+	 */
+	Handle createHandle()
+	{
+		return adopt(createObject());
+	}
+
+	/**
+	 * createHandle for objects that likely die young: the object and its
+	 * slots are bump allocated in the nursery, and freeing them is left
+	 * to evacuate, which moves the ones still in use out of it
+	 */
+	Handle createYoung()
+	{
+		/* the nursery is about to be released, see evacuate */
+		if (evacuating_.load(std::memory_order_relaxed))
+			return createHandle();
+		void *mem = nursery_.allocate(sizeof(DynObject), alignof(DynObject));
+		std::unique_ptr<DynObject> obj(
+			new (mem) DynObject(root_shape_, &nursery_, &nursery_));
+		obj->young_ = true;
+		return adopt(std::move(obj));
+	}
+
+	/* hands obj over to the handle table, see createHandle */
+	Handle adopt(std::unique_ptr<DynObject> obj)
+	{
+		unique_lock_t<factory_mutex_t> lock(handle_mutex_);
+		uint32_t index;
+		if (free_handle_ != no_handle)
+		{
+			index = free_handle_;
+			free_handle_ = handleEntry(index).next_free;
+		}
+		else
+		{
+			/* index 0 stays unused, so the zero handle is never valid */
+			index = std::max<uint32_t>(
+				handle_count_.load(std::memory_order_relaxed), 1);
+			if (index >> Handle::index_bits)
+				return {};
+			if (!handle_chunks_)
+				handle_chunks_ = std::make_unique<std::atomic<HandleEntry *>[]>(
+					size_t{1} << (Handle::index_bits - handle_chunk_bits));
+			auto &chunk = handle_chunks_[index >> handle_chunk_bits];
+			if (!chunk.load(std::memory_order_relaxed))
+			{
+				std::pmr::polymorphic_allocator<HandleEntry> alloc(
+					resources_.objects);
+				HandleEntry *entries = alloc.allocate(handle_chunk);
+				std::uninitialized_default_construct_n(entries, handle_chunk);
+				chunk.store(entries, std::memory_order_relaxed);
+			}
+			/* resolve checks this first, which makes the chunk visible */
+			handle_count_.store(index + 1, std::memory_order_release);
+		}
+
+		HandleEntry &entry = handleEntry(index);
+		DynObject *object = obj.release();
+		object->heap_ = this;
+		object->heap_index_ = index;
+		/**
+		 * a resolve that reads this pointer must then see the generation
+		 * bump of the release before it, see resolve
+		 */
+		std::atomic_thread_fence(std::memory_order_release);
+		entry.object.store(object, std::memory_order_relaxed);
+		const uint8_t generation =
+			entry.generation.load(std::memory_order_relaxed);
+		/**
+		 * allocated black: a cycle in progress keeps it. it may already
+		 * hold handles though, so while marking it gets scanned too
+		 */
+		entry.mark = gc_epoch_;
+		if (gc_phase_ == GcPhase::mark)
+			gray_.push_back(index);
+		roots_[index] = 1;
+		entry.young.store(object->young_, std::memory_order_relaxed);
+		if (object->young_)
+		{
+			young_.push_back(index);
+			has_young_.store(true, std::memory_order_relaxed);
+		}
+		/* publishes the object along with the generation */
+		entry.live.store(true, std::memory_order_release);
+		return Handle{uint32_t(generation) << Handle::index_bits | index};
+	}
+
+	/**
+	 * the object behind handle, nullptr if it was destroyed (or the
+	 * handle is null or from another factory). lock free: it reads the
+	 * entry like a seqlock, checking liveness and generation again after
+	 * the pointer, so a destroy and reuse of the entry meanwhile can't
+	 * hand an old handle the new object
+	 */
+	DynObject *resolve(Handle handle) const
+	{
+		const uint32_t index = handle.index();
+		if (!handle || index >= handle_count_.load(std::memory_order_acquire))
+			return nullptr;
+		const HandleEntry &entry = handleEntry(index);
+		if (!entry.live.load(std::memory_order_acquire) ||
+			entry.generation.load(std::memory_order_relaxed) !=
+				handle.generation())
+			return nullptr;
+		DynObject *object = entry.object.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (!entry.live.load(std::memory_order_relaxed) ||
+			entry.generation.load(std::memory_order_relaxed) !=
+				handle.generation())
+			return nullptr;
+		return object;
+	}
+
+	/**
+	 * destroys the object behind handle. false if it's already gone.
+	 * like deleting through a pointer, nobody may be using the object
+	 */
+	bool destroy(Handle handle)
+	{
+		DynObject *obj;
+		{
+			unique_lock_t<factory_mutex_t> lock(handle_mutex_);
+			if (!resolve(handle))
+				return false;
+			roots_.erase(handle.index());
+			obj = release(handle.index());
+		}
+		delete obj;
+		return true;
+	}
+
+	/**
+	 * makes handle a root of the collector: it and everything reachable
+	 * from it through handles stored in properties or elements stays
+	 * alive. roots count, every root needs its unroot. false for a dead
+	 * handle
+	 */
+	bool root(Handle handle)
+	{
+		unique_lock_t<factory_mutex_t> lock(handle_mutex_);
+		if (!resolve(handle))
+			return false;
+		++roots_[handle.index()];
+		if (gc_phase_ == GcPhase::mark)
+			shade(handle.index());
+		return true;
+	}
+
+	bool unroot(Handle handle)
+	{
+		unique_lock_t<factory_mutex_t> lock(handle_mutex_);
+		auto it = roots_.find(handle.index());
+		if (it == roots_.end() || !resolve(handle))
+			return false;
+		if (--it->second == 0)
+			roots_.erase(it);
+		return true;
+	}
+
+	/**
+	 * makes proto (or nothing, for a null handle) obj's prototype. the
+	 * table keeps owning proto, obj's prototype just points at it, and
+	 * the collector follows that edge: a prototype reachable only from
+	 * the objects using it stays alive. assigning such a pointer to
+	 * `prototype` by hand works too, but misses the write barrier a
+	 * running cycle needs. young prototypes are refused since evacuate
+	 * moves them, and so are prototype cycles
+	 */
+	std::expected<void, std::string> setPrototype(Handle obj, Handle proto)
+	{
+		DynObject *object = resolve(obj);
+		if (!object)
+			return std::unexpected("dead handle");
+		DynObject *target = nullptr;
+		if (proto)
+		{
+			target = resolve(proto);
+			if (!target)
+				return std::unexpected("dead prototype handle");
+			if (target->young_)
+				return std::unexpected("young objects can't be prototypes");
+			for (const DynObject *p = target; p; p = p->prototype.get())
+				if (p == object)
+					return std::unexpected("prototype cycle");
+			barrier(proto, false);
+		}
+		/* aliasing an empty owner: a pointer that owns nothing */
+		object->prototype = std::shared_ptr<DynObject>(std::shared_ptr<void>(), target);
+		return {};
+	}
+
+	/**
+	 * one slice of an incremental mark & sweep over the handle table:
+	 * starts a cycle if none is running, then does at most budget units
+	 * of work (an object scanned, an entry swept), so the pause stays
+	 * bounded. true if that finished the cycle.
+	 *
+	 * what survives is the roots and what they reach through Handle
+	 * values, or as prototypes set by setPrototype; the rest of the
+	 * table is destroyed. std::shared_ptr values aren't followed, and
+	 * neither are handles held anywhere but in table objects (locals,
+	 * objects made with createObject): root those. between steps
+	 * objects are used as usual, a write barrier in the set paths keeps
+	 * a running cycle from losing anything stored meanwhile. it never
+	 * moves objects
+	 */
+	bool collectStep(size_t budget = 1024)
+	{
+		std::vector<DynObject *> dead;
+		bool finished = false;
+		{
+			unique_lock_t<factory_mutex_t> lock(handle_mutex_);
+			if (gc_phase_ == GcPhase::idle)
+			{
+				/* last cycle's marks are this one's white */
+				++gc_epoch_;
+				gc_phase_ = GcPhase::mark;
+				marking_.store(true, std::memory_order_relaxed);
+				for (const auto &[index, count] : roots_)
+					shade(index);
+			}
+			while (budget && gc_phase_ == GcPhase::mark)
+			{
+				if (gray_.empty())
+				{
+					unique_lock_t<factory_mutex_t> barrier_lock(barrier_mutex_);
+					for (Handle handle : shaded_)
+						if (resolve(handle))
+							shade(handle.index());
+					shaded_.clear();
+					if (gray_.empty())
+					{
+						/* no barrier stores pending, none can come */
+						marking_.store(false, std::memory_order_relaxed);
+						gc_phase_ = GcPhase::sweep;
+						sweep_at_ = 1;
+					}
+					continue;
+				}
+				const uint32_t index = gray_.back();
+				gray_.pop_back();
+				HandleEntry &entry = handleEntry(index);
+				if (entry.live.load(std::memory_order_relaxed))
+					trace(*entry.object.load(std::memory_order_relaxed));
+				--budget;
+			}
+			const uint32_t count = handle_count_.load(std::memory_order_relaxed);
+			while (budget && gc_phase_ == GcPhase::sweep)
+			{
+				if (sweep_at_ >= count)
+				{
+					gc_phase_ = GcPhase::idle;
+					finished = true;
+					break;
+				}
+				HandleEntry &entry = handleEntry(sweep_at_);
+				if (entry.live.load(std::memory_order_relaxed) &&
+					entry.mark != gc_epoch_)
+					dead.push_back(release(sweep_at_));
+				++sweep_at_;
+				--budget;
+			}
+			collected_ += dead.size();
+		}
+		/* outside the lock, so the pause doesn't include destructors */
+		for (DynObject *obj : dead)
+			delete obj;
+		return finished;
+	}
+
+	/* finishes a running cycle, then does a whole new one */
+	void collect()
+	{
+		if (gcRunning())
+			while (!collectStep(SIZE_MAX))
+				;
+		while (!collectStep(SIZE_MAX))
+			;
+	}
+
+	/* objects the collector destroyed so far */
+	size_t collected() const
+	{
+		unique_lock_t<factory_mutex_t> lock(handle_mutex_);
+		return collected_;
+	}
+
+	/**
+	 * a minor collection: young objects (createYoung) still reachable
+	 * from roots, or stored into an older object since the last evacuate,
+	 * are copied out of the nursery into long lived memory, the rest are
+	 * destroyed and the nursery starts over empty. handles stay valid, a
+	 * moved object just has a new address, so pointers from resolve (and
+	 * Index entries) to young objects don't survive this. it stops the
+	 * world: no other thread may use young objects meanwhile, and it
+	 * can't run inside a DynObject::Batch. the dead are destroyed with
+	 * no lock held, so finalizers may use the factory; what they make
+	 * with createYoung is allocated old. returns how many moved
+	 */
+	size_t evacuate()
+	{
+		if (evacuating_.exchange(true, std::memory_order_relaxed))
+			return 0; /* called from a finalizer of a dead young object */
+		std::vector<DynObject *> dead;
+		size_t moved = 0;
+		{
+			unique_lock_t<factory_mutex_t> lock(handle_mutex_);
+			moved = evacuateLocked(dead);
+			collected_ += dead.size();
+		}
+		/**
+		 * destructors run finalizers, which may call back in here, so
+		 * they run unlocked. only once they're done is the nursery
+		 * empty; until then createYoung hands out old objects
+		 */
+		for (DynObject *obj : dead)
+			delete obj;
+		nursery_.release();
+		evacuating_.store(false, std::memory_order_relaxed);
+		return moved;
+	}
+
+	Identifier intern(std::string_view str)
+	{
+		unique_lock_t<factory_mutex_t> lock(intern_mutex_);
+		/**
+		 * use transparent hashing to look up string_view without
+		 * creating a string
+		 */
+		if (auto it = str_to_id_.find(str); it != str_to_id_.end())
+		{
+			return it->second;
+		}
+
+		Identifier id = id_to_str_.size();
+		id_to_str_.emplace_back(str);
+		/**
+		 * emplace the string_view from our stable storage (id_to_str_)
+		 * into the map
+		 */
+		str_to_id_.emplace(id_to_str_.back(), id);
+		return id;
+	}
+
+	/**
+	 * hash consing for frozen objects: the canonical instance of obj's
+	 * content, which is obj itself the first time that content is seen.
+	 * later objects equal to it (same shape, prototype and equals) get
+	 * the first one back, so duplicates can be dropped and canonical
+	 * objects compare equal only if they're the same object. canonicalize
+	 * nested objects before freezing what holds them, so those get
+	 * shared too.
+	 *
+	 * the set is sharded by hash, one lock per shard, and doesn't keep
+	 * objects alive: entries of dead ones are purged as the set grows.
+	 * fails if obj isn't frozen, or holds nested objects that aren't
+	 */
+	std::expected<std::shared_ptr<DynObject>, std::string>
+	canonical(const std::shared_ptr<DynObject> &obj)
+	{
+		if (!obj)
+			return std::unexpected("null object");
+		if (!obj->frozen())
+			return std::unexpected("object is not frozen");
+		const size_t hash = obj->hash();
+		/* only a stable hash is kept, see DynObject::hash */
+		if (obj->hash_.load(std::memory_order_relaxed) != hash)
+			return std::unexpected("object holds objects that are not frozen");
+		if (obj->canonical_.load(std::memory_order_relaxed))
+			return obj;
+
+		CanonicalShard &shard = canonical_[hash % canonical_shards];
+		unique_lock_t<factory_mutex_t> lock(shard.mutex);
+		auto [it, end] = shard.objects.equal_range(hash);
+		while (it != end)
+		{
+			std::shared_ptr<DynObject> found = it->second.lock();
+			if (!found)
+			{
+				it = shard.objects.erase(it);
+				continue;
+			}
+			if (found->shape_ == obj->shape_ && found->prototype == obj->prototype &&
+				found->equals(*obj))
+				return found;
+			++it;
+		}
+		shard.objects.emplace(hash, obj);
+		obj->canonical_.store(true, std::memory_order_relaxed);
+		if (shard.objects.size() >= shard.purge_at)
+		{
+			std::erase_if(shard.objects,
+						  [](const auto &entry) { return entry.second.expired(); });
+			shard.purge_at = std::max<size_t>(64, shard.objects.size() * 2);
+		}
+		return obj;
+	}
+
+	/* canonical objects known, counting dead ones not purged yet */
+	size_t canonicalCount() const
+	{
+		size_t count = 0;
+		for (const CanonicalShard &shard : canonical_)
+		{
+			unique_lock_t<factory_mutex_t> lock(shard.mutex);
+			count += shard.objects.size();
+		}
+		return count;
+	}
+
+	/**
+	 * retrieves the original string from an interned identifier (for debugging)
+	 */
+	std::string_view getString(Identifier id) const
+	{
+		unique_lock_t<factory_mutex_t> lock(intern_mutex_);
+		if (id < id_to_str_.size())
+		{
+			return id_to_str_[id];
+		}
+		return "<?>";
+	}
+
+private:
+	/**
+	 * calculates the new shape an object transitions to when a new property
+	 * is added
+	 */
+	std::shared_ptr<Shape> transition(std::shared_ptr<Shape> from,
+									  Identifier key,
+									  const Accessor *accessor = nullptr)
+	{
+		const size_t cache_key = accessor ? ~key : key;
+		/* check cache first */
+		if (auto it = from->transitions_.find(cache_key);
+			it != from->transitions_.end())
+		{
+			if (auto next_shape = it->second.lock())
+			{
+				if (!accessor || next_shape->accessor_.same(*accessor))
+					return next_shape;
+			}
+		}
+
+		auto new_shape =
+			accessor ? newShape(resources_.shapes, from, key, *accessor)
+					 : newShape(resources_.shapes, from, key);
+
+		/**
+		 * cache the new transition using a weak_ptr to prevent cycles
+		 */
+		from->transitions_[cache_key] = new_shape;
+		return new_shape;
+	}
+
+	/**
+	 * shapes and their control block come from the shapes resource in
+	 * one allocation
+	 */
+	template <typename... Args>
+	static std::shared_ptr<Shape> newShape(std::pmr::memory_resource *resource,
+										   Args &&...args)
+	{
+		return std::allocate_shared<Shape>(
+			std::pmr::polymorphic_allocator<Shape>(resource),
+			std::forward<Args>(args)..., resource);
+	}
+
+	/* a transparent hasher for unordered_map lookups with string_view */
+	struct StringHash
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view sv) const
+
+		{
+			return std::hash<std::string_view>{}(sv);
+		}
+		size_t operator()(const std::pmr::string &s) const
+
+		{
+			return std::hash<std::string_view>{}(s);
+		}
+	};
+
+	friend class Snapshot;
+	friend class ArrowBatch;
+	friend class Script;
+	friend class Parallel;
+	template <BinaryFormat>
+	friend class BinaryCodec;
+
+	/* one handle table entry, see Handle */
+	struct HandleEntry
+	{
+		std::atomic<DynObject *> object{nullptr};
+		std::atomic<uint8_t> generation{0}; /* of the current or next object */
+		std::atomic<bool> live{false};
+		std::atomic<bool> young{false}; /* in the nursery */
+		uint8_t mark = 0;		/* == gc_epoch_: reached this cycle */
+		uint32_t next_free = 0; /* free list link while not live */
+	};
+
+	/* the table grows by chunks that never move, so resolve needs no lock */
+	static constexpr unsigned handle_chunk_bits = 12;
+	static constexpr uint32_t handle_chunk = uint32_t{1} << handle_chunk_bits;
+	static constexpr uint32_t no_handle = 0;
+
+	HandleEntry &handleEntry(uint32_t index) const
+	{
+		return handle_chunks_[index >> handle_chunk_bits].load(
+			std::memory_order_relaxed)[index & (handle_chunk - 1)];
+	}
+
+	/**
+	 * takes the object out of entry index and frees the entry, the
+	 * caller deletes it. under handle_mutex_
+	 */
+	DynObject *release(uint32_t index)
+	{
+		HandleEntry &entry = handleEntry(index);
+		DynObject *obj = entry.object.load(std::memory_order_relaxed);
+		/**
+		 * the generation moves first: a resolve that still reads obj
+		 * here, or the next object adopt puts in, sees it on its second
+		 * look. after 256 objects the entry would hand out old handles
+		 * again, so it retires instead
+		 */
+		const uint8_t next =
+			uint8_t(entry.generation.load(std::memory_order_relaxed) + 1);
+		entry.generation.store(next, std::memory_order_relaxed);
+		entry.live.store(false, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		entry.object.store(nullptr, std::memory_order_relaxed);
+		entry.young.store(false, std::memory_order_relaxed);
+		if (next != 0)
+		{
+			entry.next_free = free_handle_;
+			free_handle_ = index;
+		}
+		return obj;
+	}
+
+	/* collector states, see collectStep */
+	enum class GcPhase : uint8_t
+	{
+		idle,
+		mark,
+		sweep
+	};
+
+	bool gcRunning() const
+	{
+		unique_lock_t<factory_mutex_t> lock(handle_mutex_);
+		return gc_phase_ != GcPhase::idle;
+	}
+
+	/* white to gray: marks a live entry and queues it to be traced */
+	void shade(uint32_t index)
+	{
+		HandleEntry &entry = handleEntry(index);
+		if (entry.mark == gc_epoch_)
+			return;
+		entry.mark = gc_epoch_;
+		gray_.push_back(index);
+	}
+
+	/**
+	 * gray to black: shades whatever obj's values and elements refer to,
+	 * and its prototype if that's one of ours (see setPrototype)
+	 */
+	void trace(const DynObject &obj)
+	{
+		shared_lock_t<object_mutex_t> lock(obj.mutex_);
+		forEachHandle(obj,
+					  [this](Handle handle)
+					  {
+						  if (resolve(handle))
+							  shade(handle.index());
+					  });
+		const DynObject *proto = obj.prototype.get();
+		if (proto && proto->heap_ == this)
+			shade(proto->heap_index_);
+	}
+
+	/* fn(handle) for every Handle in obj's values and elements */
+	template <typename F>
+	static void forEachHandle(const DynObject &obj, F &&fn)
+	{
+		for (const Slot &slot : obj.values_)
+		{
+			if (const Handle *handle = slot.ptr<Handle>())
+				fn(*handle);
+		}
+		if (obj.elements_ && obj.elements_->kind() >= ElementsKind::generic)
+		{
+			obj.elements_->forEach(
+				[&](size_t, const std::any &value)
+				{
+					if (const Handle *handle = std::any_cast<Handle>(&value))
+						fn(*handle);
+				});
+		}
+	}
+
+	/**
+	 * evacuate's part under handle_mutex_: promotes the survivors and
+	 * releases the dead young entries into dead, for the caller to
+	 * delete once the lock is gone. returns how many moved
+	 */
+	size_t evacuateLocked(std::vector<DynObject *> &dead)
+	{
+		std::vector<uint32_t> work;
+		const auto follow = [&](Handle handle)
+		{
+			if (resolve(handle) &&
+				handleEntry(handle.index()).young.load(std::memory_order_relaxed))
+				work.push_back(handle.index());
+		};
+		{
+			unique_lock_t<factory_mutex_t> barrier_lock(barrier_mutex_);
+			for (Handle handle : remembered_)
+				follow(handle);
+			remembered_.clear();
+		}
+		for (const auto &[index, count] : roots_)
+			if (handleEntry(index).young.load(std::memory_order_relaxed))
+				work.push_back(index);
+
+		size_t moved = 0;
+		while (!work.empty())
+		{
+			HandleEntry &entry = handleEntry(work.back());
+			work.pop_back();
+			if (!entry.young.load(std::memory_order_relaxed))
+				continue; /* moved already */
+			DynObject *old = promote(*entry.object.load(std::memory_order_relaxed));
+			entry.object.store(old, std::memory_order_release);
+			entry.young.store(false, std::memory_order_relaxed);
+			forEachHandle(*old, follow);
+			++moved;
+		}
+
+		std::vector<uint32_t> young;
+		young.swap(young_);
+		has_young_.store(false, std::memory_order_relaxed);
+		for (uint32_t index : young)
+		{
+			HandleEntry &entry = handleEntry(index);
+			if (entry.live.load(std::memory_order_relaxed) &&
+				entry.young.load(std::memory_order_relaxed))
+				dead.push_back(release(index));
+		}
+		return moved;
+	}
+
+	/**
+	 * a copy of young in long lived memory, taking over everything it
+	 * has; young itself is destroyed
+	 */
+	DynObject *promote(DynObject &young)
+	{
+		std::pmr::memory_resource *slots = resources_.slots;
+		void *mem = resources_.objects->allocate(sizeof(DynObject),
+												 alignof(DynObject));
+		DynObject *old = new (mem)
+			DynObject(std::move(young.shape_), resources_.objects, slots);
+		old->heap_ = this;
+		old->heap_index_ = young.heap_index_;
+		old->prototype = std::move(young.prototype);
+		old->integrity_.store(young.integrity_.load(std::memory_order_relaxed),
+							  std::memory_order_relaxed);
+		old->hash_.store(young.hash_.load(std::memory_order_relaxed),
+						 std::memory_order_relaxed);
+		if ((old->lifetime_ = std::exchange(young.lifetime_, nullptr)))
+		{
+			unique_lock_t<factory_mutex_t> lock(old->lifetime_->mutex);
+			old->lifetime_->retarget(old);
+		}
+		old->values_.reserve(young.values_.size());
+		for (Slot &slot : young.values_)
+			old->values_.push_back(std::move(slot));
+
+		/**
+		 * what hangs off the object was allocated in the nursery too. a
+		 * pmr move assignment between resources moves element by element
+		 * into the new one; elements get rebuilt by value
+		 */
+		std::pmr::polymorphic_allocator<> alloc(slots);
+		if (young.elements_)
+		{
+			old->elements_ = alloc.new_object<Elements>(slots);
+			young.elements_->forEach([&](size_t index, std::any value)
+									 { old->elements_->set(index, std::move(value)); });
+		}
+		if (young.changes_)
+		{
+			old->changes_ = alloc.new_object<Changes>(slots);
+			*old->changes_ = std::move(*young.changes_);
+		}
+		if (young.observers_)
+		{
+			old->observers_ = alloc.new_object<DynObject::Observers>(slots);
+			*old->observers_ = std::move(*young.observers_);
+		}
+		if (young.inherited_)
+		{
+			old->inherited_ = alloc.new_object<std::pmr::vector<DynObject::Inherited>>();
+			*old->inherited_ = std::move(*young.inherited_);
+		}
+		delete &young;
+		return old;
+	}
+
+	/**
+	 * the write barrier, for stores into table objects while marking:
+	 * a handle stored into an already traced object gets marked, or the
+	 * object it names could be swept while still referenced. it only
+	 * queues the handle, the lock order is object -> barrier_mutex_
+	 */
+	void barrier(Handle handle, bool old)
+	{
+		unique_lock_t<factory_mutex_t> lock(barrier_mutex_);
+		if (marking_.load(std::memory_order_relaxed))
+			shaded_.push_back(handle);
+		/* an old object pointing into the nursery: that's a root for evacuate */
+		if (old && resolve(handle) &&
+			handleEntry(handle.index()).young.load(std::memory_order_relaxed))
+			remembered_.push_back(handle);
+	}
+
+	/**
+	 * where young objects live: a bump allocator handing out memory until
+	 * evacuate releases all of it at once. freeing single blocks does
+	 * nothing. locked in multithreaded builds, since young objects'
+	 * slots grow from any thread
+	 */
+	class Nursery : public std::pmr::memory_resource
+	{
+	public:
+		explicit Nursery(std::pmr::memory_resource *upstream)
+			: bump_(size_t{1} << 16, upstream)
+		{
+		}
+
+		void release()
+		{
+			unique_lock_t<factory_mutex_t> lock(mutex_);
+			bump_.release();
+		}
+
+	private:
+		void *do_allocate(size_t bytes, size_t alignment) override
+		{
+			unique_lock_t<factory_mutex_t> lock(mutex_);
+			return bump_.allocate(bytes, alignment);
+		}
+		void do_deallocate(void *, size_t, size_t) override
+		{
+		}
+		bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+		{
+			return this == &other;
+		}
+
+		factory_mutex_t mutex_;
+		std::pmr::monotonic_buffer_resource bump_;
+	};
+
+	/* factory State */
+	FactoryResources resources_;
+	std::shared_ptr<Shape> root_shape_;
+	factory_mutex_t factory_mutex_; /* for thread safe shape transitions */
+
+	/* handle table state */
+	mutable factory_mutex_t handle_mutex_;
+	std::unique_ptr<std::atomic<HandleEntry *>[]> handle_chunks_;
+	std::atomic<uint32_t> handle_count_{0}; /* entries ever used, plus 0 */
+	uint32_t free_handle_ = no_handle;		/* the destroyed, reusable ones */
+
+	/* collector state, under handle_mutex_ except for the barrier's */
+	std::unordered_map<uint32_t, uint32_t> roots_; /* index -> root count */
+	GcPhase gc_phase_ = GcPhase::idle;
+	uint8_t gc_epoch_ = 0;
+	std::vector<uint32_t> gray_; /* marked, not traced yet */
+	uint32_t sweep_at_ = 0;
+	size_t collected_ = 0;
+	std::atomic<bool> marking_{false};
+	factory_mutex_t barrier_mutex_;
+	std::vector<Handle> shaded_; /* stored by the barrier while marking */
+
+	/* nursery state, see createYoung and evacuate */
+	Nursery nursery_{resources_.objects};
+	std::vector<uint32_t> young_; /* entries handed out young */
+	std::atomic<bool> has_young_{false};
+	std::atomic<bool> evacuating_{false};
+	std::vector<Handle> remembered_; /* young, stored into old objects */
+
+	/* canonical objects by content hash, see canonical */
+	static constexpr size_t canonical_shards = 64;
+	struct alignas(64) CanonicalShard
+	{
+		mutable factory_mutex_t mutex;
+		std::unordered_multimap<size_t, std::weak_ptr<DynObject>> objects;
+		size_t purge_at = 64; /* size that triggers dropping dead entries */
+	};
+	std::array<CanonicalShard, canonical_shards> canonical_;
+
+	/* string interning state */
 	mutable factory_mutex_t intern_mutex_;
-	std::vector<std::string> id_to_str_;
-	std::unordered_map<std::string, Identifier, StringHash, std::equal_to<>>
+	std::pmr::vector<std::pmr::string> id_to_str_;
+	std::pmr::unordered_map<std::pmr::string, Identifier, StringHash,
+							std::equal_to<>>
 		str_to_id_;
 };
+
+/**
+ * a binary snapshot of a set of objects: the property names they use,
+ * their shapes and their values, in a flat file that is read through mmap.
+ *
+ * nothing is parsed on open. objects can be read in place through views,
+ * or turned back into real DynObjects one at a time with load(), which is
+ * when their values get deserialized. the file is mapped read only, so
+ * several processes opening the same snapshot share its pages.
+ *
+ * layout (native byte order, checked on open):
+ *
+ *   header       80 bytes, see the h_* offsets below
+ *   strings      {u64 offset, u64 length} per property name
+ *   shapes       {u32 parent, u32 key, u32 offset, u32 unused} per shape,
+ *                parents always come before their children, 0 is the root
+ *   objects      {u32 shape, u32 prototype, u64 slots, u32 slot count,
+ *                 u32 element count, u64 elements} per object
+ *   data         string bytes, slot records (16 bytes each) and element
+ *                records (u64 index + slot record), sorted by index
+ *
+ * values that can be stored: int, double, float, bool, std::string,
+ * const char * (comes back as std::string), int64_t, uint64_t and
+ * std::shared_ptr<DynObject> pointing at another object of the same
+ * snapshot. prototypes are kept when the prototype is in the snapshot too
+ */
+class Snapshot
+{
+public:
+	using DynObject = ObjectFactory::DynObject;
+
+	/* a property name of this snapshot, see key() */
+	using Key = uint32_t;
+	static constexpr uint32_t no_index = 0xffffffffu;
+
+	/**
+	 * writes `objects` to a snapshot file. with skip_unsupported, values of
+	 * types the format can't hold (methods, say) come back empty instead of
+	 * failing the write
+	 */
+	static std::expected<void, std::string>
+	write(const ObjectFactory &factory,
+		  const std::vector<const DynObject *> &objects,
+		  const std::string &path, bool skip_unsupported = false)
+	{
+		auto bytes = serialize(factory, objects, skip_unsupported);
+		if (!bytes.has_value())
+			return std::unexpected(bytes.error());
+
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return std::unexpected("cannot open " + path + " for writing");
+		out.write(bytes->data(), static_cast<std::streamsize>(bytes->size()));
+		if (!out)
+			return std::unexpected("write to " + path + " failed");
+		return {};
+	}
+
+	/* same, into memory */
+	static std::expected<std::string, std::string>
+	serialize(const ObjectFactory &factory,
+			  const std::vector<const DynObject *> &objects,
+			  bool skip_unsupported = false)
+	{
+		Writer writer(factory, objects, skip_unsupported);
+		return writer.run();
+	}
+
+	/* maps a snapshot file. the mapping lives as long as the Snapshot */
+	static std::expected<Snapshot, std::string> open(const std::string &path)
+	{
+		Snapshot snap;
+#ifdef DYNOBJECT_HAVE_MMAP
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return std::unexpected("cannot open " + path);
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(h_size))
+		{
+			::close(fd);
+			return std::unexpected(path + " is not a snapshot");
+		}
+		void *map = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+						   MAP_SHARED, fd, 0);
+		::close(fd);
+		if (map == MAP_FAILED)
+			return std::unexpected("mmap of " + path + " failed");
+		snap.base_ = static_cast<const char *>(map);
+		snap.size_ = static_cast<size_t>(st.st_size);
+		snap.mapped_ = true;
+#else
+		/* no mmap here, fall back to reading the whole file */
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+			return std::unexpected("cannot open " + path);
+		snap.owned_.assign(std::istreambuf_iterator<char>(in),
+						   std::istreambuf_iterator<char>());
+		snap.base_ = snap.owned_.data();
+		snap.size_ = snap.owned_.size();
+#endif
+		if (auto ok = snap.validate(); !ok.has_value())
+			return std::unexpected(ok.error());
+		return snap;
+	}
+
+	/* wraps snapshot bytes that are already in memory (copied) */
+	static std::expected<Snapshot, std::string> fromBytes(std::string bytes)
+	{
+		Snapshot snap;
+		snap.owned_ = std::move(bytes);
+		snap.base_ = snap.owned_.data();
+		snap.size_ = snap.owned_.size();
+		if (auto ok = snap.validate(); !ok.has_value())
+			return std::unexpected(ok.error());
+		return snap;
+	}
+
+	Snapshot(Snapshot &&other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	Snapshot &operator=(Snapshot &&other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			owned_ = std::move(other.owned_);
+			base_ = other.mapped_ ? other.base_ : owned_.data();
+			size_ = other.size_;
+			mapped_ = other.mapped_;
+			keys_ = std::move(other.keys_);
+			keys_built_ = other.keys_built_;
+			bound_factory_ = other.bound_factory_;
+			shape_map_ = std::move(other.shape_map_);
+			loaded_ = std::move(other.loaded_);
+			visit_ = std::move(other.visit_);
+			visit_epoch_ = other.visit_epoch_;
+			other.base_ = nullptr;
+			other.size_ = 0;
+			other.mapped_ = false;
+		}
+		return *this;
+	}
+
+	Snapshot(const Snapshot &) = delete;
+	Snapshot &operator=(const Snapshot &) = delete;
+
+	~Snapshot()
+	{
+		release();
+	}
+
+	size_t objectCount() const
+	{
+		return u64(h_object_count);
+	}
+
+	size_t keyCount() const
+	{
+		return u64(h_string_count);
+	}
+
+	std::string_view keyName(Key key) const
+	{
+		const size_t rec = u64(h_strings) + size_t{key} * 16;
+		return {base_ + u64(rec), u64(rec + 8)};
+	}
+
+	/**
+	 * the snapshot's id for a property name, no_index if no object in the
+	 * snapshot has it. the name table is indexed on first use
+	 */
+	Key key(std::string_view name)
+	{
+		if (!keys_built_)
+		{
+			for (Key k = 0; k < keyCount(); ++k)
+				keys_.emplace(keyName(k), k);
+			keys_built_ = true;
+		}
+		auto it = keys_.find(name);
+		return it != keys_.end() ? it->second : no_index;
+	}
+
+	/**
+	 * read only access to one object, straight from the mapping. strings
+	 * can be read as std::string_view pointing into it
+	 */
+	class ObjectView
+	{
+	public:
+		template <typename T>
+		std::expected<T, std::string> get(Key key) const
+		{
+			for (ObjectView v = *this; v.valid(); v = v.prototype())
+			{
+				const uint32_t offset = v.offsetOf(key);
+				if (offset != no_index)
+					return snap_->decode<T>(v.slotRecord(offset));
+			}
+			return std::unexpected("no such property");
+		}
+
+		template <typename T>
+		std::expected<T, std::string> getElement(size_t index) const
+		{
+			for (ObjectView v = *this; v.valid(); v = v.prototype())
+			{
+				/* element records are sorted by index */
+				size_t lo = 0, hi = v.elementCount();
+				while (lo < hi)
+				{
+					const size_t mid = (lo + hi) / 2;
+					const size_t rec = v.elementRecord(mid);
+					const uint64_t at = snap_->u64(rec);
+					if (at == index)
+						return snap_->decode<T>(rec + 8);
+					if (at < index)
+						lo = mid + 1;
+					else
+						hi = mid;
+				}
+			}
+			return std::unexpected("no such element");
+		}
+
+		/* a view of the prototype, invalid if there is none */
+		ObjectView prototype() const
+		{
+			const uint32_t proto = snap_->u32(record_ + 4);
+			return proto == no_index ? ObjectView{} : snap_->object(proto);
+		}
+
+		bool valid() const
+		{
+			return snap_ != nullptr;
+		}
+
+		size_t index() const
+		{
+			return index_;
+		}
+
+	private:
+		friend class Snapshot;
+
+		ObjectView() = default;
+		ObjectView(const Snapshot *snap, size_t index)
+			: snap_(snap), index_(index),
+			  record_(snap->u64(h_objects) + index * 32)
+		{
+		}
+
+		/* walks the snapshot's shape chain, same as Shape::getOffset */
+		uint32_t offsetOf(Key key) const
+		{
+			uint32_t shape = snap_->u32(record_);
+			while (shape != 0)
+			{
+				const size_t rec = snap_->shapeRecord(shape);
+				if (snap_->u32(rec + 4) == key)
+					return snap_->u32(rec + 8);
+				shape = snap_->u32(rec);
+			}
+			return no_index;
+		}
+
+		size_t slotRecord(uint32_t offset) const
+		{
+			return snap_->u64(record_ + 8) + size_t{offset} * 16;
+		}
+
+		size_t elementCount() const
+		{
+			return snap_->u32(record_ + 20);
+		}
+
+		size_t elementRecord(size_t i) const
+		{
+			return snap_->u64(record_ + 24) + i * 24;
+		}
+
+		const Snapshot *snap_ = nullptr;
+		size_t index_ = 0;
+		size_t record_ = 0;
+	};
+
+	ObjectView object(size_t index) const
+	{
+		return ObjectView(this, index);
+	}
+
+	/**
+	 * deserializes one object into `factory`. property names are interned
+	 * and shapes rebuilt through the normal transitions, both only once
+	 * per snapshot. prototypes and object valued properties are loaded
+	 * (once) through loadShared, so shared objects stay shared, cycles
+	 * among them included.
+	 *
+	 * a snapshot binds to the first factory it loads into and must not
+	 * outlive it
+	 */
+	std::expected<std::unique_ptr<DynObject>, std::string>
+	load(ObjectFactory &factory, size_t index)
+	{
+		if (auto ok = bind(factory, index); !ok.has_value())
+			return std::unexpected(ok.error());
+		auto obj = factory.createObject();
+		if (auto ok = loadGraph(factory, index, obj.get()); !ok.has_value())
+			return std::unexpected(ok.error());
+		return obj;
+	}
+
+	/**
+	 * like load, but the object is loaded at most once and shared by
+	 * everyone asking for it
+	 */
+	std::expected<std::shared_ptr<DynObject>, std::string>
+	loadShared(ObjectFactory &factory, size_t index)
+	{
+		if (auto ok = bind(factory, index); !ok.has_value())
+			return std::unexpected(ok.error());
+		if (auto existing = loaded_[index].lock())
+			return existing;
+		return loadGraph(factory, index, nullptr);
+	}
+
+private:
+	enum Tag : uint8_t
+	{
+		tag_none,
+		tag_int,
+		tag_double,
+		tag_bool,
+		tag_string,
+		tag_int64,
+		tag_float,
+		tag_object,
+		tag_uint64
+	};
+
+	static constexpr char magic[8] = {'D', 'Y', 'N', 'S', 'N', 'A', 'P', 0};
+	static constexpr uint32_t version = 1;
+	static constexpr uint32_t byte_order = 0x01020304u;
+
+	/* header field offsets */
+	static constexpr size_t h_magic = 0;
+	static constexpr size_t h_version = 8;
+	static constexpr size_t h_byte_order = 12;
+	static constexpr size_t h_string_count = 16;
+	static constexpr size_t h_strings = 24;
+	static constexpr size_t h_shape_count = 32;
+	static constexpr size_t h_shapes = 40;
+	static constexpr size_t h_object_count = 48;
+	static constexpr size_t h_objects = 56;
+	static constexpr size_t h_file_size = 64;
+	static constexpr size_t h_size = 80;
+
+	Snapshot() = default;
+
+	void release()
+	{
+#ifdef DYNOBJECT_HAVE_MMAP
+		if (mapped_ && base_)
+			::munmap(const_cast<char *>(base_), size_);
+#endif
+		base_ = nullptr;
+		mapped_ = false;
+	}
+
+	/* unaligned reads, the compiler turns them into plain loads */
+	uint32_t u32(size_t at) const
+	{
+		uint32_t v;
+		std::memcpy(&v, base_ + at, sizeof(v));
+		return v;
+	}
+	uint64_t u64(size_t at) const
+	{
+		uint64_t v;
+		std::memcpy(&v, base_ + at, sizeof(v));
+		return v;
+	}
+
+	size_t shapeRecord(uint32_t shape) const
+	{
+		return u64(h_shapes) + size_t{shape} * 16;
+	}
+
+	/**
+	 * checks the header and that every table and record stays inside the
+	 * file, so views never read out of bounds. this touches the tables
+	 * but not the values
+	 */
+	std::expected<void, std::string> validate() const
+	{
+		auto fits = [&](uint64_t offset, uint64_t count, uint64_t width)
+		{
+			return offset <= size_ && count <= (size_ - offset) / width;
+		};
+		if (size_ < h_size || std::memcmp(base_, magic, sizeof(magic)) != 0)
+			return std::unexpected("not a snapshot");
+		if (u32(h_version) != version)
+			return std::unexpected("unsupported snapshot version");
+		if (u32(h_byte_order) != byte_order)
+			return std::unexpected("snapshot was written with another byte "
+								   "order");
+		if (u64(h_file_size) != size_)
+			return std::unexpected("snapshot is truncated");
+		if (!fits(u64(h_strings), u64(h_string_count), 16) ||
+			!fits(u64(h_shapes), u64(h_shape_count), 16) ||
+			!fits(u64(h_objects), u64(h_object_count), 32) ||
+			u64(h_shape_count) == 0 || u64(h_string_count) >= no_index ||
+			u64(h_shape_count) >= no_index || u64(h_object_count) >= no_index)
+			return std::unexpected("corrupt snapshot tables");
+
+		for (size_t k = 0; k < u64(h_string_count); ++k)
+		{
+			const size_t rec = u64(h_strings) + k * 16;
+			if (!fits(u64(rec), u64(rec + 8), 1))
+				return std::unexpected("corrupt snapshot string");
+		}
+		for (uint32_t sh = 1; sh < u64(h_shape_count); ++sh)
+		{
+			const size_t rec = shapeRecord(sh);
+			if (u32(rec) >= sh || u32(rec + 4) >= u64(h_string_count))
+				return std::unexpected("corrupt snapshot shape");
+			/**
+			 * each shape adds the next offset to its parent's (the root
+			 * has none), so every offset up the chain is below the
+			 * leaf's, which the objects check against their slot count
+			 */
+			const uint32_t parent = u32(rec);
+			const uint64_t expected =
+				parent == 0 ? 0 : uint64_t{u32(shapeRecord(parent) + 8)} + 1;
+			if (u32(rec + 8) != expected)
+				return std::unexpected("corrupt snapshot shape");
+		}
+		for (size_t i = 0; i < u64(h_object_count); ++i)
+		{
+			const size_t rec = u64(h_objects) + i * 32;
+			const uint32_t shape = u32(rec);
+			const uint32_t proto = u32(rec + 4);
+			if (shape >= u64(h_shape_count) ||
+				(proto != no_index && proto >= u64(h_object_count)) ||
+				!fits(u64(rec + 8), u32(rec + 16), 16) ||
+				!fits(u64(rec + 24), u32(rec + 20), 24))
+				return std::unexpected("corrupt snapshot object");
+			const uint32_t props =
+				shape == 0 ? 0 : u32(shapeRecord(shape) + 8) + 1;
+			if (props != u32(rec + 16))
+				return std::unexpected("corrupt snapshot object");
+		}
+
+		/**
+		 * a prototype cycle would make lookups loop forever. every proto
+		 * is in range by now; a walk stops at the first object known to
+		 * reach the end, so each object is walked once
+		 */
+		auto proto_of = [&](uint32_t i)
+		{ return u32(u64(h_objects) + size_t{i} * 32 + 4); };
+		std::vector<uint8_t> state(u64(h_object_count)); /* 1 walking, 2 ends */
+		for (uint32_t i = 0; i < state.size(); ++i)
+		{
+			uint32_t p = i;
+			for (; p != no_index && state[p] == 0; p = proto_of(p))
+				state[p] = 1;
+			if (p != no_index && state[p] == 1)
+				return std::unexpected("snapshot prototype cycle");
+			for (uint32_t q = i; q != p; q = proto_of(q))
+				state[q] = 2;
+		}
+		return {};
+	}
+
+	/**
+	 * decodes one slot record. for T = std::any an object reference comes
+	 * back as an error, load() resolves those itself
+	 */
+	template <typename T>
+	std::expected<T, std::string> decode(size_t rec) const
+	{
+		const uint8_t tag = static_cast<uint8_t>(base_[rec]);
+		const uint32_t aux = u32(rec + 4);
+		const uint64_t payload = u64(rec + 8);
+
+		if constexpr (std::is_same_v<T, std::any>)
+		{
+			switch (tag)
+			{
+			case tag_none:
+				return std::any{};
+			case tag_int:
+				return std::any(static_cast<int>(static_cast<uint32_t>(payload)));
+			case tag_double:
+				return std::any(std::bit_cast<double>(payload));
+			case tag_float:
+				return std::any(
+					std::bit_cast<float>(static_cast<uint32_t>(payload)));
+			case tag_bool:
+				return std::any(payload != 0);
+			case tag_int64:
+				return std::any(static_cast<int64_t>(payload));
+			case tag_uint64:
+				return std::any(payload);
+			case tag_string:
+				if (payload > size_ || aux > size_ - payload)
+					return std::unexpected("corrupt snapshot string");
+				return std::any(std::string(base_ + payload, aux));
+			default:
+				return std::unexpected("object reference");
+			}
+		}
+		else
+		{
+			if constexpr (std::is_same_v<T, int>)
+			{
+				if (tag == tag_int)
+					return static_cast<int>(static_cast<uint32_t>(payload));
+			}
+			else if constexpr (std::is_same_v<T, double>)
+			{
+				if (tag == tag_double)
+					return std::bit_cast<double>(payload);
+			}
+			else if constexpr (std::is_same_v<T, float>)
+			{
+				if (tag == tag_float)
+					return std::bit_cast<float>(static_cast<uint32_t>(payload));
+			}
+			else if constexpr (std::is_same_v<T, bool>)
+			{
+				if (tag == tag_bool)
+					return payload != 0;
+			}
+			else if constexpr (std::is_same_v<T, int64_t>)
+			{
+				if (tag == tag_int64)
+					return static_cast<int64_t>(payload);
+			}
+			else if constexpr (std::is_same_v<T, uint64_t>)
+			{
+				if (tag == tag_uint64)
+					return payload;
+			}
+			else if constexpr (std::is_same_v<T, std::string_view> ||
+							   std::is_same_v<T, std::string>)
+			{
+				if (tag == tag_string)
+				{
+					if (payload > size_ || aux > size_ - payload)
+						return std::unexpected("corrupt snapshot string");
+					return T(base_ + payload, aux);
+				}
+			}
+			else if constexpr (std::is_same_v<T, ObjectView>)
+			{
+				if (tag == tag_object && payload < objectCount())
+					return object(static_cast<size_t>(payload));
+			}
+			if (tag == tag_none)
+				return std::unexpected("no such property");
+			return std::unexpected("type mismatch for property");
+		}
+	}
+
+	/* what load and loadShared check first, binds the snapshot to factory */
+	std::expected<void, std::string> bind(ObjectFactory &factory, size_t index)
+	{
+		if (index >= objectCount())
+			return std::unexpected("no such object in snapshot");
+		if (bound_factory_ && bound_factory_ != &factory)
+			return std::unexpected("snapshot is bound to another factory");
+		bound_factory_ = &factory;
+		if (shape_map_.empty())
+			shape_map_.resize(u64(h_shape_count));
+		if (loaded_.empty())
+		{
+			loaded_.resize(objectCount());
+			visit_.resize(objectCount());
+		}
+		return {};
+	}
+
+	/**
+	 * loads index and every object it reaches that isn't loaded yet, in
+	 * loops rather than recursion, so long chains can't run out of stack.
+	 * the records are checked first, then the missing objects created and
+	 * put in loaded_, and only then filled: a reference, a cycle's too,
+	 * finds its target already there, and corrupt input fails before
+	 * anything is made. with into, index itself goes into that object
+	 * (and the result is null) instead of a shared one
+	 */
+	std::expected<std::shared_ptr<DynObject>, std::string>
+	loadGraph(ObjectFactory &factory, size_t index, DynObject *into)
+	{
+		if (++visit_epoch_ == 0)
+		{
+			std::fill(visit_.begin(), visit_.end(), 0);
+			visit_epoch_ = 1;
+		}
+		std::vector<size_t> order; /* the shared objects to make */
+		auto reach = [&](size_t target)
+		{
+			if (visit_[target] == visit_epoch_ || !loaded_[target].expired())
+				return;
+			visit_[target] = visit_epoch_;
+			order.push_back(target);
+		};
+		if (into)
+		{
+			if (auto ok = checkObject(index, reach); !ok.has_value())
+				return std::unexpected(ok.error());
+		}
+		else
+			reach(index);
+		for (size_t next = 0; next < order.size(); ++next)
+		{
+			if (auto ok = checkObject(order[next], reach); !ok.has_value())
+				return std::unexpected(ok.error());
+		}
+
+		std::vector<std::shared_ptr<DynObject>> made;
+		made.reserve(order.size());
+		for (size_t target : order)
+		{
+			made.push_back(factory.createObject());
+			loaded_[target] = made.back();
+		}
+		if (into)
+			fill(factory, index, *into);
+		for (size_t i = 0; i < order.size(); ++i)
+			fill(factory, order[i], *made[i]);
+		if (into)
+			return nullptr;
+		return made.front();
+	}
+
+	/**
+	 * checks that an object record's values decode, calling reach(target)
+	 * for every object it refers to, its prototype included
+	 */
+	template <typename F>
+	std::expected<void, std::string> checkObject(size_t index,
+												 F &&reach) const
+	{
+		auto check = [&](size_t rec)
+		{
+			const uint64_t payload = u64(rec + 8);
+			switch (static_cast<uint8_t>(base_[rec]))
+			{
+			case tag_none:
+			case tag_int:
+			case tag_double:
+			case tag_bool:
+			case tag_int64:
+			case tag_float:
+			case tag_uint64:
+				return true;
+			case tag_string:
+				return payload <= size_ && u32(rec + 4) <= size_ - payload;
+			case tag_object:
+				if (payload >= objectCount())
+					return false;
+				reach(static_cast<size_t>(payload));
+				return true;
+			default:
+				return false;
+			}
+		};
+		const ObjectView view = object(index);
+		for (uint32_t offset = 0; offset < u32(view.record_ + 16); ++offset)
+		{
+			if (!check(view.slotRecord(offset)))
+				return std::unexpected("corrupt snapshot value");
+		}
+		for (size_t i = 0; i < view.elementCount(); ++i)
+		{
+			if (!check(view.elementRecord(i) + 8))
+				return std::unexpected("corrupt snapshot value");
+		}
+		if (const uint32_t proto = u32(view.record_ + 4); proto != no_index)
+			reach(proto);
+		return {};
+	}
+
+	/**
+	 * decodes a record checked by checkObject into obj. the objects it
+	 * refers to are in loaded_ by now, see loadGraph
+	 */
+	void fill(ObjectFactory &factory, size_t index, DynObject &obj)
+	{
+		const ObjectView view = object(index);
+		auto shape = liveShape(factory, u32(view.record_));
+		const size_t count = u32(view.record_ + 16);
+		obj.values_.resize(count);
+		for (uint32_t offset = 0; offset < count; ++offset)
+			obj.values_[offset].store(value(view.slotRecord(offset)));
+		/* generalize the fields for the kinds that were actually stored */
+		for (const ObjectFactory::Shape *s = shape.get(); s->parent_;
+			 s = s->parent_.get())
+			s->generalize(obj.values_[s->offset_].kind());
+		obj.shape_ = std::move(shape);
+
+		for (size_t i = 0; i < view.elementCount(); ++i)
+		{
+			const size_t rec = view.elementRecord(i);
+			obj.setElement(u64(rec), value(rec + 8));
+		}
+
+		if (const uint32_t proto = u32(view.record_ + 4); proto != no_index)
+			obj.prototype = loaded_[proto].lock();
+	}
+
+	/* a checked slot record's value, references come from loaded_ */
+	std::any value(size_t rec) const
+	{
+		if (static_cast<uint8_t>(base_[rec]) == tag_object)
+			return std::any(loaded_[static_cast<size_t>(u64(rec + 8))].lock());
+		return decode<std::any>(rec).value_or(std::any{});
+	}
+
+	/* the factory's shape for a snapshot shape, built once */
+	std::shared_ptr<ObjectFactory::Shape> liveShape(ObjectFactory &factory,
+													uint32_t shape)
+	{
+		if (shape == 0)
+			return factory.root_shape_;
+		/* the missing ancestors, nearest first; a loop, chains can be long */
+		std::vector<uint32_t> missing;
+		for (uint32_t s = shape; s != 0 && !shape_map_[s];
+			 s = u32(shapeRecord(s)))
+			missing.push_back(s);
+		for (auto it = missing.rbegin(); it != missing.rend(); ++it)
+		{
+			const size_t rec = shapeRecord(*it);
+			const uint32_t parent = u32(rec);
+			const auto key = factory.intern(keyName(u32(rec + 4)));
+			unique_lock_t<factory_mutex_t> lock(factory.factory_mutex_);
+			shape_map_[*it] = factory.transition(
+				parent == 0 ? factory.root_shape_ : shape_map_[parent], key);
+		}
+		return shape_map_[shape];
+	}
+
+	/* builds the file image, see the layout at the top of the class */
+	class Writer
+	{
+	public:
+		Writer(const ObjectFactory &factory,
+			   const std::vector<const DynObject *> &objects,
+			   bool skip_unsupported)
+			: factory_(factory), objects_(objects),
+			  skip_unsupported_(skip_unsupported)
+		{
+		}
+
+		std::expected<std::string, std::string> run()
+		{
+			for (size_t i = 0; i < objects_.size(); ++i)
+				index_.emplace(objects_[i], static_cast<uint32_t>(i));
+			shape_ids_.emplace(factory_.root_shape_.get(), 0);
+			shapes_.push_back({no_index, 0, 0});
+
+			/* shapes and names first, values go into the data blob */
+			struct ObjectRecord
+			{
+				uint32_t shape, prototype, slot_count, element_count;
+				uint64_t slots, elements;
+			};
+			std::vector<ObjectRecord> records;
+			for (const DynObject *obj : objects_)
+			{
+				shared_lock_t<object_mutex_t> lock(obj->mutex_);
+				ObjectRecord r{};
+				r.shape = shapeId(obj->shape_.get());
+				r.prototype = no_index;
+				if (obj->prototype)
+				{
+					if (auto it = index_.find(obj->prototype.get());
+						it != index_.end())
+						r.prototype = it->second;
+				}
+
+				r.slot_count = static_cast<uint32_t>(obj->values_.size());
+				std::vector<std::any> values;
+				for (const auto &slot : obj->values_)
+					values.push_back(slot.toAny());
+				std::vector<std::pair<size_t, std::any>> elements;
+				if (obj->elements_)
+				{
+					obj->elements_->forEach(
+						[&](size_t i, std::any v)
+						{ elements.emplace_back(i, std::move(v)); });
+				}
+
+				align8();
+				r.slots = data_.size();
+				for (const auto &v : values)
+				{
+					auto ok = slotRecord(v);
+					if (!ok.has_value())
+						return std::unexpected(ok.error());
+					if (!*ok)
+						emptyRecord(); /* skipped, keep the offsets */
+				}
+				flushStrings();
+
+				align8();
+				r.elements = data_.size();
+				r.element_count = 0;
+				for (const auto &[i, v] : elements)
+				{
+					const size_t at = data_.size();
+					put64(data_, i);
+					auto ok = slotRecord(v);
+					if (!ok.has_value())
+						return std::unexpected(ok.error());
+					if (!*ok)
+						data_.resize(at); /* skipped, drop the index too */
+					else
+						r.element_count++;
+				}
+				flushStrings();
+				records.push_back(r);
+			}
+
+			/* tables go first, then the data blob */
+			const size_t strings_at = h_size;
+			const size_t shapes_at = strings_at + names_.size() * 16;
+			const size_t objects_at = shapes_at + shapes_.size() * 16;
+			const size_t data_at = objects_at + records.size() * 32;
+
+			std::string out;
+			out.append(magic, sizeof(magic));
+			put32(out, version);
+			put32(out, byte_order);
+			put64(out, names_.size());
+			put64(out, strings_at);
+			put64(out, shapes_.size());
+			put64(out, shapes_at);
+			put64(out, records.size());
+			put64(out, objects_at);
+			put64(out, 0); /* file size, patched below */
+			put64(out, 0);
+
+			for (const auto &[offset, length] : names_)
+			{
+				put64(out, data_at + offset);
+				put64(out, length);
+			}
+			for (const auto &sh : shapes_)
+			{
+				put32(out, sh.parent);
+				put32(out, sh.key);
+				put32(out, sh.offset);
+				put32(out, 0);
+			}
+			for (const auto &r : records)
+			{
+				put32(out, r.shape);
+				put32(out, r.prototype);
+				put64(out, data_at + r.slots);
+				put32(out, r.slot_count);
+				put32(out, r.element_count);
+				put64(out, data_at + r.elements);
+			}
+			/* string values in slot records are relative to the blob */
+			for (size_t at : string_fixups_)
+			{
+				uint64_t v;
+				std::memcpy(&v, data_.data() + at, sizeof(v));
+				v += data_at;
+				std::memcpy(data_.data() + at, &v, sizeof(v));
+			}
+			out += data_;
+
+			const uint64_t total = out.size();
+			std::memcpy(out.data() + h_file_size, &total, sizeof(total));
+			return out;
+		}
+
+	private:
+		struct ShapeRecord
+		{
+			uint32_t parent, key, offset;
+		};
+
+		static void put32(std::string &out, uint32_t v)
+		{
+			out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+		}
+		static void put64(std::string &out, uint64_t v)
+		{
+			out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+		}
+
+		void align8()
+		{
+			data_.resize((data_.size() + 7) & ~size_t{7});
+		}
+
+		uint32_t nameId(ObjectFactory::Identifier id)
+		{
+			if (auto it = name_ids_.find(id); it != name_ids_.end())
+				return it->second;
+			const std::string_view name = factory_.getString(id);
+			names_.emplace_back(data_.size(), name.size());
+			data_.append(name);
+			const uint32_t key = static_cast<uint32_t>(names_.size() - 1);
+			name_ids_.emplace(id, key);
+			return key;
+		}
+
+		/* numbers a shape, its parents first */
+		uint32_t shapeId(const ObjectFactory::Shape *shape)
+		{
+			if (auto it = shape_ids_.find(shape); it != shape_ids_.end())
+				return it->second;
+			const uint32_t parent = shapeId(shape->parent_.get());
+			const uint32_t key = nameId(shape->property_key_);
+			shapes_.push_back(
+				{parent, key, static_cast<uint32_t>(shape->offset_)});
+			const uint32_t id = static_cast<uint32_t>(shapes_.size() - 1);
+			shape_ids_.emplace(shape, id);
+			return id;
+		}
+
+		void emptyRecord()
+		{
+			data_.append(16, '\0');
+		}
+
+		/**
+		 * appends one 16 byte record. returns false, without writing
+		 * anything, if the value was skipped (only with skip_unsupported)
+		 */
+		std::expected<bool, std::string> slotRecord(const std::any &v)
+		{
+			uint8_t tag = tag_none;
+			uint32_t aux = 0;
+			uint64_t payload = 0;
+			std::string_view str;
+			bool has_string = false;
+
+			if (!v.has_value())
+				tag = tag_none;
+			else if (auto p = std::any_cast<int>(&v))
+				tag = tag_int, payload = static_cast<uint32_t>(*p);
+			else if (auto p = std::any_cast<double>(&v))
+				tag = tag_double, payload = std::bit_cast<uint64_t>(*p);
+			else if (auto p = std::any_cast<float>(&v))
+				tag = tag_float, payload = std::bit_cast<uint32_t>(*p);
+			else if (auto p = std::any_cast<bool>(&v))
+				tag = tag_bool, payload = *p;
+			else if (auto p = std::any_cast<int64_t>(&v))
+				tag = tag_int64, payload = static_cast<uint64_t>(*p);
+			else if (auto p = std::any_cast<uint64_t>(&v))
+				tag = tag_uint64, payload = *p;
+			else if (auto p = std::any_cast<std::string>(&v))
+				tag = tag_string, str = *p, has_string = true;
+			else if (auto p = std::any_cast<const char *>(&v))
+				tag = tag_string, str = *p, has_string = true;
+			else if (auto p = std::any_cast<std::shared_ptr<DynObject>>(&v))
+			{
+				auto it = index_.find(p->get());
+				if (it == index_.end())
+				{
+					if (!skip_unsupported_)
+						return std::unexpected("object value is not part of "
+											   "the snapshot");
+					return false;
+				}
+				tag = tag_object, payload = it->second;
+			}
+			else
+			{
+				if (!skip_unsupported_)
+					return std::unexpected("value type not supported by "
+										   "snapshots");
+				return false;
+			}
+
+			if (has_string)
+			{
+				if (str.size() > 0xffffffffu)
+					return std::unexpected("string too long for a snapshot");
+				aux = static_cast<uint32_t>(str.size());
+			}
+			const size_t at = data_.size();
+			data_.push_back(static_cast<char>(tag));
+			data_.append(3, '\0');
+			put32(data_, aux);
+			put64(data_, payload);
+			if (has_string)
+				pending_.emplace_back(at + 8, std::string(str));
+			return true;
+		}
+
+		/**
+		 * string bytes can't go in the middle of a record array, so they
+		 * are parked and written once the current array is done. the
+		 * records that point at them are patched then
+		 */
+		void flushStrings()
+		{
+			for (auto &[payload_at, str] : pending_)
+			{
+				const uint64_t offset = data_.size();
+				std::memcpy(data_.data() + payload_at, &offset, sizeof(offset));
+				string_fixups_.push_back(payload_at);
+				data_ += str;
+			}
+			pending_.clear();
+		}
+
+		const ObjectFactory &factory_;
+		const std::vector<const DynObject *> &objects_;
+		bool skip_unsupported_;
+
+		std::string data_;
+		std::unordered_map<const DynObject *, uint32_t> index_;
+		std::unordered_map<const ObjectFactory::Shape *, uint32_t> shape_ids_;
+		std::vector<ShapeRecord> shapes_;
+		std::unordered_map<ObjectFactory::Identifier, uint32_t> name_ids_;
+		std::vector<std::pair<size_t, size_t>> names_; /* offset, length */
+		std::vector<std::pair<size_t, std::string>> pending_;
+		std::vector<size_t> string_fixups_;
+	};
+
+	const char *base_ = nullptr;
+	size_t size_ = 0;
+	bool mapped_ = false;
+	std::string owned_; /* the bytes when not mapped */
+
+	std::unordered_map<std::string_view, Key> keys_;
+	bool keys_built_ = false;
+
+	/* load() state */
+	ObjectFactory *bound_factory_ = nullptr;
+	std::vector<std::shared_ptr<ObjectFactory::Shape>> shape_map_;
+	std::vector<std::weak_ptr<DynObject>> loaded_;
+	std::vector<uint32_t> visit_; /* loadGraph's marks, == visit_epoch_ */
+	uint32_t visit_epoch_ = 0;
+};
+
+/**
+ * MessagePack and CBOR encoding of DynObjects. use it through the MsgPack
+ * and Cbor aliases below:
+ *
+ *   std::vector<uint8_t> buf;
+ *   MsgPack::encode(factory, *obj, buf);
+ *   auto copy = MsgPack::decode(factory, buf);
+ *
+ * an object becomes a map of its own properties (inherited ones are not
+ * included) keyed by name, plus its elements keyed by integer index. the
+ * map header and the encoded names are cached per Shape, so encoding an
+ * object whose shape was seen before only encodes values.
+ *
+ * value types: empty (nil/null), int, int64_t, uint64_t, double, float,
+ * bool, std::string, const char *, std::vector<uint8_t> (binary),
+ * std::vector<std::any> (array), std::unordered_map<std::string, std::any>
+ * and std::shared_ptr<DynObject> (both maps). decoding turns maps back into
+ * std::shared_ptr<DynObject>, arrays into std::vector<std::any>, integers
+ * into the smallest of int, int64_t and uint64_t that holds them. CBOR's
+ * indefinite lengths and tags are not supported
+ */
+template <BinaryFormat F>
+class BinaryCodec
+{
+public:
+	using DynObject = ObjectFactory::DynObject;
+
+	/**
+	 * appends the encoding of obj to out. with skip_unsupported values of
+	 * types the format can't represent are written as nil instead of
+	 * failing
+	 */
+	static std::expected<void, std::string>
+	encode(const ObjectFactory &factory, const DynObject &obj,
+		   std::vector<uint8_t> &out, bool skip_unsupported = false)
+	{
+		VectorSink sink{out};
+		const size_t before = out.size();
+		auto ok = encodeObject(factory, obj, sink, skip_unsupported, 0);
+		if (!ok.has_value())
+			out.resize(before);
+		return ok;
+	}
+
+	/**
+	 * encodes into a caller provided buffer and returns the number of
+	 * bytes used. if the buffer is too small nothing useful is in it and
+	 * the error says how much would have been needed
+	 */
+	static std::expected<size_t, std::string>
+	encode(const ObjectFactory &factory, const DynObject &obj,
+		   std::span<uint8_t> out, bool skip_unsupported = false)
+	{
+		SpanSink sink{out.data(), out.size()};
+		auto ok = encodeObject(factory, obj, sink, skip_unsupported, 0);
+		if (!ok.has_value())
+			return std::unexpected(ok.error());
+		if (sink.size > out.size())
+			return std::unexpected("buffer too small, need " +
+								   std::to_string(sink.size) + " bytes");
+		return sink.size;
+	}
+
+	/**
+	 * decodes one map from the start of `in` into a new object. consumed,
+	 * if given, receives the number of bytes read so several objects can
+	 * be decoded back to back
+	 */
+	static std::expected<std::unique_ptr<DynObject>, std::string>
+	decode(ObjectFactory &factory, std::span<const uint8_t> in,
+		   size_t *consumed = nullptr)
+	{
+		Reader reader{in.data(), in.size()};
+		auto obj = factory.createObject();
+		auto ok = reader.decodeMapInto(factory, *obj, 0);
+		if (!ok.has_value())
+			return std::unexpected(ok.error());
+		if (consumed)
+			*consumed = reader.pos;
+		return obj;
+	}
+
+	/**
+	 * appends a delta of obj: a two element array of a map with the
+	 * current values of the added and changed keys, and an array with
+	 * the names of the removed ones. applyDelta replays it on a copy
+	 */
+	static std::expected<void, std::string>
+	encodeDelta(const ObjectFactory &factory, const DynObject &obj,
+				const DynObject::ChangeSet &changes,
+				std::vector<uint8_t> &out, bool skip_unsupported = false)
+	{
+		VectorSink sink{out};
+		const size_t before = out.size();
+		auto ok = [&]() -> std::expected<void, std::string>
+		{
+			shared_lock_t<object_mutex_t> lock(obj.mutex_);
+			std::vector<const ObjectFactory::Shape *> fields;
+			for (const auto *list : {&changes.added, &changes.changed})
+			{
+				for (ObjectFactory::Identifier key : *list)
+				{
+					if (const auto *field = obj.shape_->lookup(key))
+						fields.push_back(field);
+				}
+			}
+
+			arrayHeader(sink, 2);
+			mapHeader(sink, fields.size());
+			for (const auto *field : fields)
+			{
+				putString(sink, factory.getString(field->property_key_));
+				auto ok = encodeSlot(factory, obj.values_[field->offset_], sink,
+									 skip_unsupported, 1);
+				if (!ok.has_value())
+					return ok;
+			}
+			arrayHeader(sink, changes.removed.size());
+			for (ObjectFactory::Identifier key : changes.removed)
+				putString(sink, factory.getString(key));
+			return {};
+		}();
+		if (!ok.has_value())
+			out.resize(before);
+		return ok;
+	}
+
+	/**
+	 * applies a delta from encodeDelta to obj. consumed works like for
+	 * decode. on error the object may be partly updated
+	 */
+	static std::expected<void, std::string>
+	applyDelta(ObjectFactory &factory, DynObject &obj,
+			   std::span<const uint8_t> in, size_t *consumed = nullptr)
+	{
+		Reader reader{in.data(), in.size()};
+		auto n = reader.arrayLength();
+		if (!n.has_value())
+			return std::unexpected(n.error());
+		if (*n != 2)
+			return std::unexpected("not a delta");
+		auto ok = reader.decodeMapInto(factory, obj, 0);
+		if (!ok.has_value())
+			return ok;
+		auto removed = reader.value(factory, 0);
+		if (!removed.has_value())
+			return std::unexpected(removed.error());
+		auto names = std::any_cast<std::vector<std::any>>(&*removed);
+		if (!names)
+			return std::unexpected("not a delta");
+		for (const auto &name : *names)
+		{
+			auto s = std::any_cast<std::string>(&name);
+			if (!s)
+				return std::unexpected("not a delta");
+			/* removing what isn't there is fine, a sealed object is not */
+			auto gone = obj.remove(factory, factory.intern(*s));
+			if (!gone.has_value() && obj.integrity() != Integrity::none)
+				return gone;
+		}
+		if (consumed)
+			*consumed = reader.pos;
+		return {};
+	}
+
+private:
+	static constexpr bool msgpack = F == BinaryFormat::msgpack;
+	static constexpr size_t max_depth = 64;
+
+	struct VectorSink
+	{
+		std::vector<uint8_t> &out;
+
+		void put(uint8_t b)
+		{
+			out.push_back(b);
+		}
+		void put(const void *p, size_t n)
+		{
+			const auto *bytes = static_cast<const uint8_t *>(p);
+			out.insert(out.end(), bytes, bytes + n);
+		}
+	};
+
+	/* keeps counting past the end so the needed size can be reported */
+	struct SpanSink
+	{
+		uint8_t *data;
+		size_t capacity;
+		size_t size = 0;
+
+		void put(uint8_t b)
+		{
+			if (size < capacity)
+				data[size] = b;
+			++size;
+		}
+		void put(const void *p, size_t n)
+		{
+			if (size <= capacity && n <= capacity - size)
+				std::memcpy(data + size, p, n);
+			size += n;
+		}
+	};
+
+	/* --- encoding --- */
+
+	template <typename Sink, typename T>
+	static void putBigEndian(Sink &sink, T value)
+	{
+		uint8_t bytes[sizeof(T)];
+		for (size_t i = 0; i < sizeof(T); ++i)
+			bytes[i] = static_cast<uint8_t>(value >> (8 * (sizeof(T) - 1 - i)));
+		sink.put(bytes, sizeof(T));
+	}
+
+	/* a CBOR initial byte plus its argument, in the shortest form */
+	template <typename Sink>
+	static void cborHead(Sink &sink, uint8_t major, uint64_t arg)
+	{
+		const uint8_t m = static_cast<uint8_t>(major << 5);
+		if (arg < 24)
+			sink.put(static_cast<uint8_t>(m | arg));
+		else if (arg <= 0xff)
+		{
+			sink.put(static_cast<uint8_t>(m | 24));
+			sink.put(static_cast<uint8_t>(arg));
+		}
+		else if (arg <= 0xffff)
+		{
+			sink.put(static_cast<uint8_t>(m | 25));
+			putBigEndian(sink, static_cast<uint16_t>(arg));
+		}
+		else if (arg <= 0xffffffffu)
+		{
+			sink.put(static_cast<uint8_t>(m | 26));
+			putBigEndian(sink, static_cast<uint32_t>(arg));
+		}
+		else
+		{
+			sink.put(static_cast<uint8_t>(m | 27));
+			putBigEndian(sink, arg);
+		}
+	}
+
+	/* a msgpack length prefix: fix form if it fits, else 8/16/32 bit */
+	template <typename Sink>
+	static void msgpackHead(Sink &sink, uint8_t fix, uint64_t fix_limit,
+							uint8_t b8, uint8_t b16, uint8_t b32, uint64_t n)
+	{
+		if (n < fix_limit)
+			sink.put(static_cast<uint8_t>(fix | n));
+		else if (b8 && n <= 0xff)
+		{
+			sink.put(b8);
+			sink.put(static_cast<uint8_t>(n));
+		}
+		else if (n <= 0xffff)
+		{
+			sink.put(b16);
+			putBigEndian(sink, static_cast<uint16_t>(n));
+		}
+		else
+		{
+			sink.put(b32);
+			putBigEndian(sink, static_cast<uint32_t>(n));
+		}
+	}
+
+	template <typename Sink>
+	static void mapHeader(Sink &sink, uint64_t n)
+	{
+		if constexpr (msgpack)
+			msgpackHead(sink, 0x80, 16, 0, 0xde, 0xdf, n);
+		else
+			cborHead(sink, 5, n);
+	}
+
+	template <typename Sink>
+	static void arrayHeader(Sink &sink, uint64_t n)
+	{
+		if constexpr (msgpack)
+			msgpackHead(sink, 0x90, 16, 0, 0xdc, 0xdd, n);
+		else
+			cborHead(sink, 4, n);
+	}
+
+	template <typename Sink>
+	static void putString(Sink &sink, std::string_view str)
+	{
+		if constexpr (msgpack)
+			msgpackHead(sink, 0xa0, 32, 0xd9, 0xda, 0xdb, str.size());
+		else
+			cborHead(sink, 3, str.size());
+		sink.put(str.data(), str.size());
+	}
+
+	template <typename Sink>
+	static void putBinary(Sink &sink, const std::vector<uint8_t> &bin)
+	{
+		if constexpr (msgpack)
+			msgpackHead(sink, 0, 0, 0xc4, 0xc5, 0xc6, bin.size());
+		else
+			cborHead(sink, 2, bin.size());
+		sink.put(bin.data(), bin.size());
+	}
+
+	template <typename Sink>
+	static void putNil(Sink &sink)
+	{
+		sink.put(msgpack ? 0xc0 : 0xf6);
+	}
+
+	template <typename Sink>
+	static void putBool(Sink &sink, bool b)
+	{
+		if constexpr (msgpack)
+			sink.put(b ? 0xc3 : 0xc2);
+		else
+			sink.put(b ? 0xf5 : 0xf4);
+	}
+
+	template <typename Sink>
+	static void putUnsigned(Sink &sink, uint64_t v)
+	{
+		if constexpr (msgpack)
+		{
+			if (v < 0x80)
+				sink.put(static_cast<uint8_t>(v));
+			else if (v <= 0xff)
+			{
+				sink.put(0xcc);
+				sink.put(static_cast<uint8_t>(v));
+			}
+			else if (v <= 0xffff)
+			{
+				sink.put(0xcd);
+				putBigEndian(sink, static_cast<uint16_t>(v));
+			}
+			else if (v <= 0xffffffffu)
+			{
+				sink.put(0xce);
+				putBigEndian(sink, static_cast<uint32_t>(v));
+			}
+			else
+			{
+				sink.put(0xcf);
+				putBigEndian(sink, v);
+			}
+		}
+		else
+			cborHead(sink, 0, v);
+	}
+
+	template <typename Sink>
+	static void putSigned(Sink &sink, int64_t v)
+	{
+		if (v >= 0)
+			return putUnsigned(sink, static_cast<uint64_t>(v));
+		if constexpr (msgpack)
+		{
+			if (v >= -32)
+				sink.put(static_cast<uint8_t>(v));
+			else if (v >= INT8_MIN)
+			{
+				sink.put(0xd0);
+				sink.put(static_cast<uint8_t>(v));
+			}
+			else if (v >= INT16_MIN)
+			{
+				sink.put(0xd1);
+				putBigEndian(sink, static_cast<uint16_t>(v));
+			}
+			else if (v >= INT32_MIN)
+			{
+				sink.put(0xd2);
+				putBigEndian(sink, static_cast<uint32_t>(v));
+			}
+			else
+			{
+				sink.put(0xd3);
+				putBigEndian(sink, static_cast<uint64_t>(v));
+			}
+		}
+		else
+			cborHead(sink, 1, static_cast<uint64_t>(-1 - v));
+	}
+
+	template <typename Sink>
+	static void putDouble(Sink &sink, double d)
+	{
+		sink.put(msgpack ? 0xcb : 0xfb);
+		putBigEndian(sink, std::bit_cast<uint64_t>(d));
+	}
+
+	template <typename Sink>
+	static void putFloat(Sink &sink, float f)
+	{
+		sink.put(msgpack ? 0xca : 0xfa);
+		putBigEndian(sink, std::bit_cast<uint32_t>(f));
+	}
+
+	template <typename Sink>
+	static std::expected<void, std::string>
+	encodeValue(const ObjectFactory &factory, const std::any &v, Sink &sink,
+				bool skip_unsupported, size_t depth)
+	{
+		if (!v.has_value())
+			putNil(sink);
+		else if (auto p = std::any_cast<int>(&v))
+			putSigned(sink, *p);
+		else if (auto p = std::any_cast<double>(&v))
+			putDouble(sink, *p);
+		else if (auto p = std::any_cast<std::string>(&v))
+			putString(sink, *p);
+		else if (auto p = std::any_cast<bool>(&v))
+			putBool(sink, *p);
+		else if (auto p = std::any_cast<float>(&v))
+			putFloat(sink, *p);
+		else if (auto p = std::any_cast<int64_t>(&v))
+			putSigned(sink, *p);
+		else if (auto p = std::any_cast<uint64_t>(&v))
+			putUnsigned(sink, *p);
+		else if (auto p = std::any_cast<const char *>(&v))
+			putString(sink, *p);
+		else if (auto p = std::any_cast<std::vector<uint8_t>>(&v))
+			putBinary(sink, *p);
+		else if (auto p = std::any_cast<std::vector<std::any>>(&v))
+		{
+			if (depth >= max_depth)
+				return std::unexpected("nesting too deep");
+			arrayHeader(sink, p->size());
+			for (const auto &elem : *p)
+			{
+				auto ok =
+					encodeValue(factory, elem, sink, skip_unsupported, depth + 1);
+				if (!ok.has_value())
+					return ok;
+			}
+		}
+		else if (auto p =
+					 std::any_cast<std::unordered_map<std::string, std::any>>(
+						 &v))
+		{
+			if (depth >= max_depth)
+				return std::unexpected("nesting too deep");
+			mapHeader(sink, p->size());
+			for (const auto &[key, elem] : *p)
+			{
+				putString(sink, key);
+				auto ok =
+					encodeValue(factory, elem, sink, skip_unsupported, depth + 1);
+				if (!ok.has_value())
+					return ok;
+			}
+		}
+		else if (auto p = std::any_cast<std::shared_ptr<DynObject>>(&v))
+		{
+			if (!*p)
+				putNil(sink);
+			else
+				return encodeObject(factory, **p, sink, skip_unsupported,
+									depth + 1);
+		}
+		else if (skip_unsupported)
+			putNil(sink);
+		else
+			return std::unexpected("value type not supported by " +
+								   std::string(msgpack ? "msgpack" : "cbor"));
+		return {};
+	}
+
+	/* the map header and names for objects of this shape, cached on it */
+	static const ObjectFactory::Shape::KeyTemplate &
+	keyTemplate(const ObjectFactory &factory, const ObjectFactory::Shape &shape)
+	{
+		constexpr size_t which = msgpack
+									 ? ObjectFactory::Shape::template_msgpack
+									 : ObjectFactory::Shape::template_cbor;
+		return shape.keyTemplate(
+			which,
+			[&](ObjectFactory::Shape::KeyTemplate &t,
+				const std::vector<size_t> &keys)
+			{
+				std::vector<uint8_t> bytes;
+				VectorSink sink{bytes};
+				mapHeader(sink, keys.size());
+				t.head.assign(bytes.begin(), bytes.end());
+				for (size_t key : keys)
+				{
+					bytes.clear();
+					putString(sink, factory.getString(key));
+					t.keys.append(bytes.begin(), bytes.end());
+					t.ends.push_back(static_cast<uint32_t>(t.keys.size()));
+				}
+			});
+	}
+
+	template <typename Sink>
+	static std::expected<void, std::string>
+	encodeObject(const ObjectFactory &factory, const DynObject &obj, Sink &sink,
+				 bool skip_unsupported, size_t depth)
+	{
+		if (depth >= max_depth)
+			return std::unexpected("nesting too deep");
+
+		shared_lock_t<object_mutex_t> lock(obj.mutex_);
+		const auto &keys = keyTemplate(factory, *obj.shape_);
+		const size_t props = obj.values_.size();
+
+		/* elements change the entry count, the cached header can't be used */
+		std::vector<std::pair<size_t, std::any>> elements;
+		if (obj.elements_)
+		{
+			obj.elements_->forEach([&](size_t i, std::any v)
+								   { elements.emplace_back(i, std::move(v)); });
+		}
+		if (elements.empty())
+			sink.put(keys.head.data(), keys.head.size());
+		else
+		{
+			mapHeader(sink, props + elements.size());
+			for (const auto &[index, value] : elements)
+			{
+				putUnsigned(sink, index);
+				auto ok = encodeValue(factory, value, sink, skip_unsupported,
+									  depth + 1);
+				if (!ok.has_value())
+					return ok;
+			}
+		}
+
+		for (size_t offset = 0; offset < props; ++offset)
+		{
+			const std::string_view key = keys.key(offset);
+			sink.put(key.data(), key.size());
+			auto ok = encodeSlot(factory, obj.values_[offset], sink,
+								 skip_unsupported, depth + 1);
+			if (!ok.has_value())
+				return ok;
+		}
+		return {};
+	}
+
+	template <typename Sink>
+	static std::expected<void, std::string>
+	encodeSlot(const ObjectFactory &factory, const ObjectFactory::Slot &slot,
+			   Sink &sink, bool skip_unsupported, size_t depth)
+	{
+		switch (slot.kind())
+		{
+		case Representation::integer:
+			putSigned(sink, slot.rawInt());
+			break;
+		case Representation::floating:
+			putDouble(sink, slot.rawDouble());
+			break;
+		case Representation::heap:
+			return encodeValue(factory, slot.rawBoxed(), sink, skip_unsupported,
+							   depth);
+		default:
+			putNil(sink);
+		}
+		return {};
+	}
+
+	/* --- decoding --- */
+
+	struct Reader
+	{
+		const uint8_t *data;
+		size_t size;
+		size_t pos = 0;
+
+		std::expected<uint8_t, std::string> byte()
+		{
+			if (pos >= size)
+				return std::unexpected("unexpected end of input");
+			return data[pos++];
+		}
+
+		template <typename T>
+		std::expected<T, std::string> bigEndian()
+		{
+			if (size - pos < sizeof(T))
+				return std::unexpected("unexpected end of input");
+			uint64_t v = 0;
+			for (size_t i = 0; i < sizeof(T); ++i)
+				v = (v << 8) | data[pos++];
+			return static_cast<T>(v);
+		}
+
+		std::expected<std::string_view, std::string> bytes(uint64_t n)
+		{
+			if (n > size - pos)
+				return std::unexpected("unexpected end of input");
+			std::string_view sv(reinterpret_cast<const char *>(data + pos), n);
+			pos += n;
+			return sv;
+		}
+
+		/* an integer that fits in int stays an int */
+		static std::any integer(int64_t v)
+		{
+			if (v >= INT_MIN && v <= INT_MAX)
+				return static_cast<int>(v);
+			return v;
+		}
+		static std::any integer(uint64_t v)
+		{
+			if (v <= static_cast<uint64_t>(INT64_MAX))
+				return integer(static_cast<int64_t>(v));
+			return v;
+		}
+
+		/**
+		 * one value. maps are decoded into objects; the map itself is
+		 * read by decodeMapInto
+		 */
+		std::expected<std::any, std::string> value(ObjectFactory &factory,
+												   size_t depth)
+		{
+			if (depth >= max_depth)
+				return std::unexpected("nesting too deep");
+			if (pos >= size)
+				return std::unexpected("unexpected end of input");
+
+			if (isMap(data[pos]))
+			{
+				std::shared_ptr<DynObject> obj = factory.createObject();
+				auto ok = decodeMapInto(factory, *obj, depth + 1);
+				if (!ok.has_value())
+					return std::unexpected(ok.error());
+				return std::any(std::move(obj));
+			}
+			if constexpr (msgpack)
+				return msgpackValue(factory, depth);
+			else
+				return cborValue(factory, depth);
+		}
+
+		static bool isMap(uint8_t b)
+		{
+			if constexpr (msgpack)
+				return (b & 0xf0) == 0x80 || b == 0xde || b == 0xdf;
+			else
+				return (b >> 5) == 5;
+		}
+
+		std::expected<uint64_t, std::string> mapLength()
+		{
+			auto b = byte();
+			if (!b.has_value())
+				return std::unexpected(b.error());
+			if constexpr (msgpack)
+			{
+				if ((*b & 0xf0) == 0x80)
+					return *b & 0x0f;
+				if (*b == 0xde)
+					return bigEndian<uint16_t>();
+				if (*b == 0xdf)
+					return bigEndian<uint32_t>();
+				return std::unexpected("expected a map");
+			}
+			else
+			{
+				if ((*b >> 5) != 5)
+					return std::unexpected("expected a map");
+				return cborArgument(*b);
+			}
+		}
+
+		std::expected<uint64_t, std::string> arrayLength()
+		{
+			auto b = byte();
+			if (!b.has_value())
+				return std::unexpected(b.error());
+			if constexpr (msgpack)
+			{
+				if ((*b & 0xf0) == 0x90)
+					return *b & 0x0f;
+				if (*b == 0xdc)
+					return bigEndian<uint16_t>();
+				if (*b == 0xdd)
+					return bigEndian<uint32_t>();
+				return std::unexpected("expected an array");
+			}
+			else
+			{
+				if ((*b >> 5) != 4)
+					return std::unexpected("expected an array");
+				return cborArgument(*b);
+			}
+		}
+
+		std::expected<void, std::string>
+		decodeMapInto(ObjectFactory &factory, DynObject &obj, size_t depth)
+		{
+			if (depth >= max_depth)
+				return std::unexpected("nesting too deep");
+			auto n = mapLength();
+			if (!n.has_value())
+				return std::unexpected(n.error());
+			for (uint64_t i = 0; i < *n; ++i)
+			{
+				auto key = value(factory, depth + 1);
+				if (!key.has_value())
+					return std::unexpected(key.error());
+				auto val = value(factory, depth + 1);
+				if (!val.has_value())
+					return std::unexpected(val.error());
+
+				std::expected<void, std::string> ok;
+				if (auto k = std::any_cast<std::string>(&*key))
+					ok = obj.set(factory, factory.intern(*k), std::move(*val));
+				else if (auto k = std::any_cast<int>(&*key); k && *k >= 0)
+					ok = obj.setElement(static_cast<size_t>(*k), std::move(*val));
+				else if (auto k = std::any_cast<int64_t>(&*key); k && *k >= 0)
+					ok = obj.setElement(static_cast<size_t>(*k), std::move(*val));
+				else
+					return std::unexpected("unsupported map key");
+				if (!ok.has_value())
+					return ok;
+			}
+			return {};
+		}
+
+		std::expected<std::any, std::string> array(ObjectFactory &factory,
+												   uint64_t n, size_t depth)
+		{
+			std::vector<std::any> out;
+			/* don't trust the length for the reservation */
+			out.reserve(std::min<uint64_t>(n, size - pos));
+			for (uint64_t i = 0; i < n; ++i)
+			{
+				auto v = value(factory, depth + 1);
+				if (!v.has_value())
+					return std::unexpected(v.error());
+				out.push_back(std::move(*v));
+			}
+			return std::any(std::move(out));
+		}
+
+		std::expected<std::any, std::string> string(uint64_t n)
+		{
+			auto sv = bytes(n);
+			if (!sv.has_value())
+				return std::unexpected(sv.error());
+			return std::any(std::string(*sv));
+		}
+
+		std::expected<std::any, std::string> binary(uint64_t n)
+		{
+			auto sv = bytes(n);
+			if (!sv.has_value())
+				return std::unexpected(sv.error());
+			return std::any(std::vector<uint8_t>(sv->begin(), sv->end()));
+		}
+
+		template <typename T>
+		std::expected<std::any, std::string> wrap(std::expected<T, std::string> v)
+		{
+			if (!v.has_value())
+				return std::unexpected(v.error());
+			return std::any(*v);
+		}
+
+		/* reads a big endian length of type T then what it prefixes */
+		template <typename T, typename Fn>
+		std::expected<std::any, std::string> prefixed(Fn &&fn)
+		{
+			auto n = bigEndian<T>();
+			if (!n.has_value())
+				return std::unexpected(n.error());
+			return fn(static_cast<uint64_t>(*n));
+		}
+
+		std::expected<std::any, std::string> msgpackValue(ObjectFactory &factory,
+														  size_t depth)
+		{
+			const uint8_t b = data[pos++];
+			auto str = [&](uint64_t n) { return string(n); };
+			auto bin = [&](uint64_t n) { return binary(n); };
+			auto arr = [&](uint64_t n) { return array(factory, n, depth); };
+
+			if (b < 0x80)
+				return std::any(static_cast<int>(b));
+			if (b >= 0xe0)
+				return std::any(static_cast<int>(static_cast<int8_t>(b)));
+			if ((b & 0xe0) == 0xa0)
+				return string(b & 0x1f);
+			if ((b & 0xf0) == 0x90)
+				return array(factory, b & 0x0f, depth);
+
+			switch (b)
+			{
+			case 0xc0:
+				return std::any{};
+			case 0xc2:
+				return std::any(false);
+			case 0xc3:
+				return std::any(true);
+			case 0xc4:
+				return prefixed<uint8_t>(bin);
+			case 0xc5:
+				return prefixed<uint16_t>(bin);
+			case 0xc6:
+				return prefixed<uint32_t>(bin);
+			case 0xca:
+			{
+				auto v = bigEndian<uint32_t>();
+				if (!v.has_value())
+					return std::unexpected(v.error());
+				return std::any(std::bit_cast<float>(*v));
+			}
+			case 0xcb:
+			{
+				auto v = bigEndian<uint64_t>();
+				if (!v.has_value())
+					return std::unexpected(v.error());
+				return std::any(std::bit_cast<double>(*v));
+			}
+			case 0xcc:
+				return unsignedValue<uint8_t>();
+			case 0xcd:
+				return unsignedValue<uint16_t>();
+			case 0xce:
+				return unsignedValue<uint32_t>();
+			case 0xcf:
+				return unsignedValue<uint64_t>();
+			case 0xd0:
+				return signedValue<int8_t, uint8_t>();
+			case 0xd1:
+				return signedValue<int16_t, uint16_t>();
+			case 0xd2:
+				return signedValue<int32_t, uint32_t>();
+			case 0xd3:
+				return signedValue<int64_t, uint64_t>();
+			case 0xd9:
+				return prefixed<uint8_t>(str);
+			case 0xda:
+				return prefixed<uint16_t>(str);
+			case 0xdb:
+				return prefixed<uint32_t>(str);
+			case 0xdc:
+				return prefixed<uint16_t>(arr);
+			case 0xdd:
+				return prefixed<uint32_t>(arr);
+			default:
+				return std::unexpected("unsupported msgpack type");
+			}
+		}
+
+		template <typename U>
+		std::expected<std::any, std::string> unsignedValue()
+		{
+			auto v = bigEndian<U>();
+			if (!v.has_value())
+				return std::unexpected(v.error());
+			return integer(static_cast<uint64_t>(*v));
+		}
+
+		template <typename S, typename U>
+		std::expected<std::any, std::string> signedValue()
+		{
+			auto v = bigEndian<U>();
+			if (!v.has_value())
+				return std::unexpected(v.error());
+			return integer(static_cast<int64_t>(static_cast<S>(*v)));
+		}
+
+		/* the argument of a CBOR initial byte */
+		std::expected<uint64_t, std::string> cborArgument(uint8_t b)
+		{
+			const uint8_t ai = b & 0x1f;
+			if (ai < 24)
+				return ai;
+			switch (ai)
+			{
+			case 24:
+				return bigEndian<uint8_t>();
+			case 25:
+				return bigEndian<uint16_t>();
+			case 26:
+				return bigEndian<uint32_t>();
+			case 27:
+				return bigEndian<uint64_t>();
+			default:
+				return std::unexpected("indefinite lengths are not supported");
+			}
+		}
+
+		static double halfToDouble(uint16_t h)
+		{
+			const int exp = (h >> 10) & 0x1f;
+			const int mant = h & 0x3ff;
+			double v;
+			if (exp == 0)
+				v = std::ldexp(mant, -24);
+			else if (exp != 31)
+				v = std::ldexp(mant + 1024, exp - 25);
+			else
+				v = mant == 0 ? INFINITY : NAN;
+			return (h & 0x8000) ? -v : v;
+		}
+
+		std::expected<std::any, std::string> cborValue(ObjectFactory &factory,
+													   size_t depth)
+		{
+			const uint8_t b = data[pos++];
+			const uint8_t major = b >> 5;
+
+			if (major == 7)
+			{
+				switch (b)
+				{
+				case 0xf4:
+					return std::any(false);
+				case 0xf5:
+					return std::any(true);
+				case 0xf6:
+				case 0xf7: /* undefined, closest thing is empty */
+					return std::any{};
+				case 0xf9:
+				{
+					auto v = bigEndian<uint16_t>();
+					if (!v.has_value())
+						return std::unexpected(v.error());
+					return std::any(halfToDouble(*v));
+				}
+				case 0xfa:
+				{
+					auto v = bigEndian<uint32_t>();
+					if (!v.has_value())
+						return std::unexpected(v.error());
+					return std::any(std::bit_cast<float>(*v));
+				}
+				case 0xfb:
+				{
+					auto v = bigEndian<uint64_t>();
+					if (!v.has_value())
+						return std::unexpected(v.error());
+					return std::any(std::bit_cast<double>(*v));
+				}
+				default:
+					return std::unexpected("unsupported cbor simple value");
+				}
+			}
+
+			auto arg = cborArgument(b);
+			if (!arg.has_value())
+				return std::unexpected(arg.error());
+			switch (major)
+			{
+			case 0:
+				return integer(*arg);
+			case 1:
+				if (*arg > static_cast<uint64_t>(INT64_MAX))
+					return std::unexpected("cbor integer out of range");
+				return integer(-1 - static_cast<int64_t>(*arg));
+			case 2:
+				return binary(*arg);
+			case 3:
+				return string(*arg);
+			case 4:
+				return array(factory, *arg, depth);
+			default:
+				return std::unexpected("cbor tags are not supported");
+			}
+		}
+	};
+};
+
+using MsgPack = BinaryCodec<BinaryFormat::msgpack>;
+using Cbor = BinaryCodec<BinaryFormat::cbor>;
+
+/**
+ * columnar export for analytics. objects are grouped by shape and every
+ * property offset of a shape becomes one column in the Arrow memory
+ * layout: a validity bitmap plus the values, or plus offsets and bytes for
+ * strings. a batch can be written as an Arrow IPC stream or file, which
+ * arrow readers (pyarrow, polars, duckdb...) open directly. nothing from
+ * Arrow is linked, the flatbuffer metadata is written by hand
+ *
+ * column types come from the values: int -> int32, double and float ->
+ * float64, bool, std::string and const char * -> utf8, int64_t, uint64_t.
+ * ints mixed with doubles widen to float64, ints mixed with int64_t to
+ * int64. empty slots are nulls and a column nobody has a value in gets the
+ * null type. only named properties are exported, not elements, and
+ * nothing is read through prototypes
+ */
+class ArrowBatch
+{
+public:
+	using DynObject = ObjectFactory::DynObject;
+
+	enum class Type : uint8_t
+	{
+		null,
+		boolean,
+		int32,
+		int64,
+		uint64,
+		float64,
+		utf8
+	};
+
+	struct Column
+	{
+		std::string name;
+		Type type = Type::null;
+		size_t null_count = 0;
+		std::string validity; /* a bit per row, least significant first */
+		std::string offsets;  /* utf8 only, int32 per row plus one */
+		std::string values;	  /* fixed width values, bits for booleans */
+	};
+
+	/**
+	 * one batch per distinct shape, in the order the shapes first show up.
+	 * with skip_unsupported, columns holding values there is no arrow type
+	 * for (methods, objects, mixed types) are left out instead of failing
+	 */
+	static std::expected<std::vector<ArrowBatch>, std::string>
+	fromObjects(const ObjectFactory &factory,
+				const std::vector<const DynObject *> &objects,
+				bool skip_unsupported = false)
+	{
+		std::unordered_map<const ObjectFactory::Shape *, size_t> by_shape;
+		std::vector<const ObjectFactory::Shape *> shapes;
+		std::vector<std::vector<const DynObject *>> groups;
+		for (const DynObject *obj : objects)
+		{
+			if (!obj)
+				return std::unexpected("null object in arrow export");
+			const ObjectFactory::Shape *shape;
+			{
+				shared_lock_t<object_mutex_t> lock(obj->mutex_);
+				shape = obj->shape_.get();
+			}
+			auto [it, inserted] = by_shape.try_emplace(shape, groups.size());
+			if (inserted)
+			{
+				shapes.push_back(shape);
+				groups.emplace_back();
+			}
+			groups[it->second].push_back(obj);
+		}
+
+		std::vector<ArrowBatch> batches;
+		batches.reserve(groups.size());
+		for (size_t i = 0; i < groups.size(); ++i)
+		{
+			auto batch = build(factory, *shapes[i], groups[i], skip_unsupported);
+			if (!batch.has_value())
+				return std::unexpected(batch.error());
+			batches.push_back(std::move(*batch));
+		}
+		return batches;
+	}
+
+	/* number of rows */
+	size_t length() const
+	{
+		return length_;
+	}
+
+	const std::vector<Column> &columns() const
+	{
+		return columns_;
+	}
+
+	/* the batch as an IPC stream: schema, record batch, end of stream */
+	std::string stream() const
+	{
+		std::string body;
+		const std::string meta = batchMetadata(body);
+		std::string out;
+		frame(out, schemaMetadata());
+		frame(out, meta);
+		out += body;
+		put(out, 0xffffffffu, 4);
+		put(out, 0, 4);
+		return out;
+	}
+
+	/* the batch in the IPC file format (what .arrow files hold) */
+	std::string file() const
+	{
+		std::string body;
+		const std::string meta = batchMetadata(body);
+		std::string out(magic, sizeof(magic));
+		out.append(8 - sizeof(magic), '\0');
+		frame(out, schemaMetadata());
+		const size_t block = out.size();
+		const size_t meta_size = frame(out, meta);
+		out += body;
+		put(out, 0xffffffffu, 4);
+		put(out, 0, 4);
+
+		FlatBuilder b;
+		size_t refs[3];
+		const size_t footer = b.table({{0, 2, metadata_v5}}, {1, 2, 3}, refs);
+		b.root(footer);
+		b.patch(refs[0], schema(b));
+		b.patch(refs[1], b.vector(0, 24, 8)); /* no dictionaries */
+		const size_t blocks = b.vector(1, 24, 8);
+		b.put(block, 8);
+		b.put(meta_size, 4);
+		b.put(0, 4);
+		b.put(body.size(), 8);
+		b.patch(refs[2], blocks);
+
+		out += b.bytes();
+		put(out, b.bytes().size(), 4);
+		out.append(magic, sizeof(magic));
+		return out;
+	}
+
+	/* writes file() to path */
+	std::expected<void, std::string> write(const std::string &path) const
+	{
+		const std::string bytes = file();
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return std::unexpected("cannot open " + path + " for writing");
+		out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+		if (!out)
+			return std::unexpected("write to " + path + " failed");
+		return {};
+	}
+
+private:
+	using Slot = ObjectFactory::Slot;
+
+	static constexpr char magic[6] = {'A', 'R', 'R', 'O', 'W', '1'};
+	static constexpr uint64_t metadata_v5 = 4;
+
+	/* a slot's value without copying it, type nullopt if arrow has none */
+	struct Cell
+	{
+		std::optional<Type> type = Type::null;
+		int64_t i = 0;
+		uint64_t u = 0;
+		double d = 0;
+		std::string_view s;
+	};
+
+	static Cell cell(const Slot &slot)
+	{
+		Cell c;
+		switch (slot.kind())
+		{
+		case Representation::integer:
+			c.type = Type::int32;
+			c.i = slot.rawInt();
+			break;
+		case Representation::floating:
+			c.type = Type::float64;
+			c.d = slot.rawDouble();
+			break;
+		case Representation::heap:
+		{
+			const std::any &v = slot.rawBoxed();
+			if (!v.has_value())
+				break;
+			if (auto p = std::any_cast<std::string>(&v))
+			{
+				c.type = Type::utf8;
+				c.s = *p;
+			}
+			else if (auto p = std::any_cast<const char *>(&v))
+			{
+				c.type = Type::utf8;
+				c.s = *p ? std::string_view(*p) : std::string_view();
+			}
+			else if (auto p = std::any_cast<bool>(&v))
+			{
+				c.type = Type::boolean;
+				c.i = *p;
+			}
+			else if (auto p = std::any_cast<float>(&v))
+			{
+				c.type = Type::float64;
+				c.d = *p;
+			}
+			else if (auto p = std::any_cast<int64_t>(&v))
+			{
+				c.type = Type::int64;
+				c.i = *p;
+			}
+			else if (auto p = std::any_cast<uint64_t>(&v))
+			{
+				c.type = Type::uint64;
+				c.u = *p;
+			}
+			else
+			{
+				c.type = std::nullopt;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		return c;
+	}
+
+	/* the column type for values of types a and b, nullopt if none fits */
+	static std::optional<Type> merge(Type a, Type b)
+	{
+		if (a == Type::null || a == b)
+			return b;
+		if (b == Type::null)
+			return a;
+		if (a > b)
+			std::swap(a, b);
+		if (a == Type::int32 && (b == Type::int64 || b == Type::float64))
+			return b;
+		return std::nullopt;
+	}
+
+	static std::expected<ArrowBatch, std::string>
+	build(const ObjectFactory &factory, const ObjectFactory::Shape &shape,
+		  const std::vector<const DynObject *> &objects, bool skip_unsupported)
+	{
+		const size_t props = shape.getPropertyCount();
+		std::vector<ObjectFactory::Identifier> keys(props);
+		for (const ObjectFactory::Shape *s = &shape; s->parent_;
+			 s = s->parent_.get())
+			keys[s->offset_] = s->property_key_;
+
+		/* pass one: the type of every column */
+		std::vector<Type> types(props, Type::null);
+		std::vector<bool> unsupported(props, false);
+		for (const DynObject *obj : objects)
+		{
+			shared_lock_t<object_mutex_t> lock(obj->mutex_);
+			const size_t n = std::min(props, obj->values_.size());
+			for (size_t o = 0; o < n; ++o)
+			{
+				if (unsupported[o])
+					continue;
+				const Cell c = cell(obj->values_[o]);
+				std::optional<Type> t =
+					c.type ? merge(types[o], *c.type) : std::nullopt;
+				if (t)
+					types[o] = *t;
+				else
+					unsupported[o] = true;
+			}
+		}
+
+		ArrowBatch batch;
+		batch.length_ = objects.size();
+		std::vector<size_t> offsets; /* property offset of each column */
+		for (size_t o = 0; o < props; ++o)
+		{
+			if (unsupported[o])
+			{
+				if (skip_unsupported)
+					continue;
+				return std::unexpected("property '" +
+									   std::string(factory.getString(keys[o])) +
+									   "' has values arrow export can't hold");
+			}
+			Column col;
+			col.name = factory.getString(keys[o]);
+			col.type = types[o];
+			col.validity.assign((objects.size() + 7) / 8, '\0');
+			if (col.type == Type::boolean)
+				col.values.assign((objects.size() + 7) / 8, '\0');
+			else if (col.type == Type::utf8)
+				put(col.offsets, 0, 4);
+			else if (col.type != Type::null)
+				col.values.reserve(objects.size() * width(col.type));
+			batch.columns_.push_back(std::move(col));
+			offsets.push_back(o);
+		}
+
+		/* pass two: the values, row by row */
+		for (size_t row = 0; row < objects.size(); ++row)
+		{
+			const DynObject *obj = objects[row];
+			shared_lock_t<object_mutex_t> lock(obj->mutex_);
+			for (size_t j = 0; j < offsets.size(); ++j)
+			{
+				Column &col = batch.columns_[j];
+				Cell c;
+				if (offsets[j] < obj->values_.size())
+					c = cell(obj->values_[offsets[j]]);
+				if (!append(col, row, c))
+					return std::unexpected("column '" + col.name +
+										   "' is too large for 32 bit offsets");
+			}
+		}
+		return batch;
+	}
+
+	static size_t width(Type t)
+	{
+		return t == Type::int32 ? 4 : 8;
+	}
+
+	/* adds row to col, a value that doesn't fit the column becomes null */
+	static bool append(Column &col, size_t row, const Cell &c)
+	{
+		const bool valid =
+			c.type == col.type ||
+			(c.type == Type::int32 &&
+			 (col.type == Type::int64 || col.type == Type::float64));
+		if (valid && col.type != Type::null)
+			col.validity[row / 8] |= static_cast<char>(1 << (row % 8));
+		else
+			col.null_count++;
+
+		switch (col.type)
+		{
+		case Type::null:
+			break;
+		case Type::boolean:
+			if (valid && c.i)
+				col.values[row / 8] |= static_cast<char>(1 << (row % 8));
+			break;
+		case Type::int32:
+		{
+			const int32_t v = valid ? static_cast<int32_t>(c.i) : 0;
+			col.values.append(reinterpret_cast<const char *>(&v), sizeof(v));
+			break;
+		}
+		case Type::int64:
+		{
+			const int64_t v = valid ? c.i : 0;
+			col.values.append(reinterpret_cast<const char *>(&v), sizeof(v));
+			break;
+		}
+		case Type::uint64:
+		{
+			const uint64_t v = valid ? c.u : 0;
+			col.values.append(reinterpret_cast<const char *>(&v), sizeof(v));
+			break;
+		}
+		case Type::float64:
+		{
+			const double v = !valid				   ? 0.0
+							 : c.type == Type::int32 ? static_cast<double>(c.i)
+													 : c.d;
+			col.values.append(reinterpret_cast<const char *>(&v), sizeof(v));
+			break;
+		}
+		case Type::utf8:
+		{
+			if (valid)
+				col.values += c.s;
+			if (col.values.size() > static_cast<size_t>(INT32_MAX))
+				return false;
+			const int32_t end = static_cast<int32_t>(col.values.size());
+			col.offsets.append(reinterpret_cast<const char *>(&end),
+							   sizeof(end));
+			break;
+		}
+		}
+		return true;
+	}
+
+	/* little endian, like everything in a flatbuffer */
+	static void put(std::string &out, uint64_t v, size_t size)
+	{
+		for (size_t i = 0; i < size; ++i)
+			out += static_cast<char>((v >> (8 * i)) & 0xff);
+	}
+
+	/**
+	 * just enough of a flatbuffer writer for arrow's metadata. flatbuffers
+	 * only require offsets to point forward, so unlike the real builder
+	 * this one writes front to back: a table goes out with placeholders
+	 * for its offset fields and whatever they point at is written after
+	 * it and patched in
+	 */
+	class FlatBuilder
+	{
+	public:
+		/* a scalar table field: its id in the schema, byte width and value */
+		struct Scalar
+		{
+			uint16_t id;
+			uint8_t size;
+			uint64_t value;
+		};
+
+		FlatBuilder()
+		{
+			put(0, 4); /* offset of the root table, see root() */
+		}
+
+		const std::string &bytes() const
+		{
+			return buf_;
+		}
+
+		void root(size_t table)
+		{
+			patch(0, table);
+		}
+
+		void put(uint64_t v, size_t size)
+		{
+			ArrowBatch::put(buf_, v, size);
+		}
+
+		/* points the offset field at `at` to `target` (written later) */
+		void patch(size_t at, size_t target)
+		{
+			const uint32_t rel = static_cast<uint32_t>(target - at);
+			for (size_t i = 0; i < 4; ++i)
+				buf_[at + i] = static_cast<char>((rel >> (8 * i)) & 0xff);
+		}
+
+		/**
+		 * writes a vtable and a table. ref_at gets where each of the refs
+		 * (offset fields) ended up, in the order they were given
+		 */
+		size_t table(std::initializer_list<Scalar> scalars,
+					 std::initializer_list<uint16_t> refs,
+					 size_t *ref_at = nullptr)
+		{
+			struct Entry
+			{
+				Scalar field;
+				bool ref;
+				size_t index;
+			};
+			std::vector<Entry> entries;
+			size_t fields = 0;
+			for (const Scalar &f : scalars)
+			{
+				entries.push_back({f, false, 0});
+				fields = std::max<size_t>(fields, f.id + 1u);
+			}
+			size_t index = 0;
+			for (uint16_t id : refs)
+			{
+				entries.push_back({{id, 4, 0}, true, index++});
+				fields = std::max<size_t>(fields, id + 1u);
+			}
+			/* widest first, the table starts 8 aligned so this packs it */
+			std::stable_sort(entries.begin(), entries.end(),
+							 [](const Entry &a, const Entry &b)
+							 { return a.field.size > b.field.size; });
+
+			std::vector<size_t> at(entries.size());
+			size_t end = 4; /* after the vtable offset */
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				const size_t size = entries[i].field.size;
+				end = (end + size - 1) / size * size;
+				at[i] = end;
+				end += size;
+			}
+
+			std::vector<size_t> slots(fields, 0);
+			for (size_t i = 0; i < entries.size(); ++i)
+				slots[entries[i].field.id] = at[i];
+			align(2);
+			const size_t vtable = buf_.size();
+			put(4 + 2 * fields, 2);
+			put(end, 2);
+			for (size_t slot : slots)
+				put(slot, 2);
+
+			align(8);
+			const size_t table = buf_.size();
+			put(table - vtable, 4); /* the vtable is at table - this */
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				buf_.resize(table + at[i], '\0');
+				put(entries[i].field.value, entries[i].field.size);
+				if (entries[i].ref && ref_at)
+					ref_at[entries[i].index] = table + at[i];
+			}
+			buf_.resize(table + end, '\0');
+			return table;
+		}
+
+		/* the length of a vector, the caller put()s the elements after it */
+		size_t vector(size_t count, size_t element_size, size_t element_align)
+		{
+			(void)element_size;
+			const size_t a = std::max<size_t>(element_align, 4);
+			while ((buf_.size() + 4) % a != 0)
+				buf_ += '\0';
+			const size_t at = buf_.size();
+			put(count, 4);
+			return at;
+		}
+
+		/* a vector of offsets, element i is patched at result + 4 + 4 * i */
+		size_t refs(size_t count)
+		{
+			const size_t at = vector(count, 4, 4);
+			buf_.append(4 * count, '\0');
+			return at;
+		}
+
+		size_t string(std::string_view s)
+		{
+			align(4);
+			const size_t at = buf_.size();
+			put(s.size(), 4);
+			buf_ += s;
+			buf_ += '\0';
+			return at;
+		}
+
+	private:
+		void align(size_t a)
+		{
+			while (buf_.size() % a != 0)
+				buf_ += '\0';
+		}
+
+		std::string buf_;
+	};
+
+	/* continuation marker, padded length, metadata. returns the bytes added */
+	static size_t frame(std::string &out, const std::string &meta)
+	{
+		const size_t padded = (meta.size() + 7) / 8 * 8;
+		put(out, 0xffffffffu, 4);
+		put(out, padded, 4);
+		out += meta;
+		out.append(padded - meta.size(), '\0');
+		return 8 + padded;
+	}
+
+	/* the Schema table, shared by the schema message and the file footer */
+	size_t schema(FlatBuilder &b) const
+	{
+		size_t fields_at;
+		const uint64_t big = std::endian::native == std::endian::big;
+		const size_t table = b.table({{0, 2, big}}, {1}, &fields_at);
+		const size_t fields = b.refs(columns_.size());
+		b.patch(fields_at, fields);
+		for (size_t i = 0; i < columns_.size(); ++i)
+		{
+			const Column &col = columns_[i];
+			size_t refs[3];
+			/* name, nullable, type_type, type, children */
+			const size_t field =
+				b.table({{1, 1, 1}, {2, 1, typeId(col.type)}}, {0, 3, 5}, refs);
+			b.patch(fields + 4 + 4 * i, field);
+			b.patch(refs[0], b.string(col.name));
+			b.patch(refs[1], typeTable(b, col.type));
+			b.patch(refs[2], b.refs(0));
+		}
+		return table;
+	}
+
+	/* the Type union member ids */
+	static uint64_t typeId(Type t)
+	{
+		switch (t)
+		{
+		case Type::null:
+			return 1;
+		case Type::int32:
+		case Type::int64:
+		case Type::uint64:
+			return 2;
+		case Type::float64:
+			return 3;
+		case Type::utf8:
+			return 5;
+		case Type::boolean:
+			return 6;
+		}
+		return 0;
+	}
+
+	static size_t typeTable(FlatBuilder &b, Type t)
+	{
+		switch (t)
+		{
+		case Type::int32:
+			return b.table({{0, 4, 32}, {1, 1, 1}}, {}); /* bitWidth, signed */
+		case Type::int64:
+			return b.table({{0, 4, 64}, {1, 1, 1}}, {});
+		case Type::uint64:
+			return b.table({{0, 4, 64}, {1, 1, 0}}, {});
+		case Type::float64:
+			return b.table({{0, 2, 2}}, {}); /* precision DOUBLE */
+		default:
+			return b.table({}, {}); /* null, bool and utf8 have no fields */
+		}
+	}
+
+	/* Message{version, header_type, header, bodyLength} */
+	static size_t message(FlatBuilder &b, uint64_t header_type,
+						  uint64_t body_length, size_t &header_at)
+	{
+		const size_t table = b.table(
+			{{0, 2, metadata_v5}, {1, 1, header_type}, {3, 8, body_length}},
+			{2}, &header_at);
+		b.root(table);
+		return table;
+	}
+
+	std::string schemaMetadata() const
+	{
+		FlatBuilder b;
+		size_t header_at;
+		message(b, 1, 0, header_at);
+		b.patch(header_at, schema(b));
+		return b.bytes();
+	}
+
+	/* the RecordBatch message, body gets the buffers it points into */
+	std::string batchMetadata(std::string &body) const
+	{
+		std::vector<std::pair<size_t, size_t>> buffers;
+		auto add = [&](const std::string &bytes)
+		{
+			buffers.emplace_back(body.size(), bytes.size());
+			body += bytes;
+			body.append((8 - body.size() % 8) % 8, '\0');
+		};
+		for (const Column &col : columns_)
+		{
+			if (col.type == Type::null)
+				continue; /* the null type has no buffers */
+			add(col.validity);
+			if (col.type == Type::utf8)
+				add(col.offsets);
+			add(col.values);
+		}
+
+		FlatBuilder b;
+		size_t header_at;
+		message(b, 3, body.size(), header_at);
+		size_t refs[2];
+		const size_t batch = b.table({{0, 8, length_}}, {1, 2}, refs);
+		b.patch(header_at, batch);
+
+		const size_t nodes = b.vector(columns_.size(), 16, 8);
+		for (const Column &col : columns_)
+		{
+			b.put(length_, 8);
+			b.put(col.null_count, 8);
+		}
+		b.patch(refs[0], nodes);
+		const size_t bufs = b.vector(buffers.size(), 16, 8);
+		for (const auto &[offset, size] : buffers)
+		{
+			b.put(offset, 8);
+			b.put(size, 8);
+		}
+		b.patch(refs[1], bufs);
+		return b.bytes();
+	}
+
+	size_t length_ = 0;
+	std::vector<Column> columns_;
+};
+
+/**
+ * small rules over DynObjects, compiled to a register bytecode.
+ *
+ *   auto rule = Script::compile(factory, "total = price * qty; total > limit");
+ *   auto hit = rule->run(factory, *order); // a std::any holding 1 or 0
+ *
+ * a script is expressions over the properties of the object it runs on. a
+ * bare name (or this.name) reads that property, or writes it left of `=`;
+ * `a.b` reads b of the object stored in a (as a std::shared_ptr<DynObject>)
+ * and `f(x)` / `a.f(x)` call methods, found through prototypes like call
+ * does. values are ints, doubles, strings ("double quoted") and whatever
+ * properties hold. + - * / % keep ints as ints until they overflow, + also
+ * joins strings, comparisons give 1 or 0, and ! && || ?: go by JS
+ * truthiness. statements are separated by `;` and the value of a script is
+ * the value of its last statement
+ *
+ * every property access and call instruction has its own inline cache:
+ * the shape the object had last time and where the property was found.
+ * on a hit an own property is read from its slot without a shape walk and
+ * an inherited property or method straight from the frozen prototype that
+ * has it. lookups through prototypes that aren't frozen are never cached,
+ * those go through get/call every time.
+ *
+ * the caches live in the Script, so a Script must not run on two threads
+ * at once. copy it instead
+ */
+class Script
+{
+public:
+	using DynObject = ObjectFactory::DynObject;
+
+	/* compiles source, or says what's wrong with it and where */
+	static std::expected<Script, std::string> compile(ObjectFactory &factory,
+													  std::string_view source)
+	{
+		Script script;
+		Compiler compiler(factory, source, script);
+		if (auto ok = compiler.program(); !ok.has_value())
+			return std::unexpected(ok.error());
+		return script;
+	}
+
+	/**
+	 * runs the script on self. fails on the first thing that goes wrong
+	 * (a missing property, a write to a frozen object, bad operands...),
+	 * writes made before that stay made
+	 */
+	std::expected<std::any, std::string> run(ObjectFactory &factory,
+											 DynObject &self)
+	{
+		regs_.resize(registers_);
+		auto result = execute(factory, self);
+		/* don't keep objects the registers point to alive */
+		for (Slot &reg : regs_)
+			reg = Slot();
+		return result;
+	}
+
+	/* number of instructions, for the curious */
+	size_t size() const
+	{
+		return code_.size();
+	}
+
+private:
+	using Slot = ObjectFactory::Slot;
+	using Shape = ObjectFactory::Shape;
+	using Accessor = ObjectFactory::Accessor;
+	using Identifier = ObjectFactory::Identifier;
+
+	enum class Op : uint8_t
+	{
+		load_int,	   /* a = int(d) */
+		load_const,	   /* a = consts_[d] */
+		move,		   /* a = b */
+		get,		   /* a = object(b).key, site d */
+		set,		   /* object(a).key = b, site d */
+		call,		   /* a = object(b).key(c, c + 1...), site d */
+		add,		   /* a = b + c, same for the ones down to ge */
+		sub,
+		mul,
+		div,
+		mod,
+		eq,
+		ne,
+		lt,
+		le,
+		gt,
+		ge,
+		neg,		   /* a = -b */
+		not_,		   /* a = !b */
+		jump,		   /* go to d */
+		jump_if_false, /* go to d if a is falsy */
+		jump_if_true,  /* go to d if a is truthy */
+		ret			   /* the script's value is a */
+	};
+
+	struct Instr
+	{
+		Op op;
+		uint8_t a, b, c;
+		uint32_t d;
+	};
+
+	/* the register operand that means the object the script runs on */
+	static constexpr uint8_t self_reg = 0xff;
+
+	/**
+	 * an inline cache. a hit is an object with exactly this shape (and for
+	 * inherited properties, this prototype); field is then the property,
+	 * in holder if set (a frozen prototype) or in the object itself. the
+	 * shared_ptrs keep shape and prototype from dying and their address
+	 * being reused by something else
+	 */
+	struct Cache
+	{
+		std::shared_ptr<Shape> shape;
+		std::shared_ptr<DynObject> proto;
+		const Shape *field = nullptr;
+		const DynObject *holder = nullptr;
+	};
+
+	/* one per get/set/call instruction */
+	struct Site
+	{
+		Identifier key;
+		uint8_t argc;
+		Cache cache;
+	};
+
+	std::expected<std::any, std::string> execute(ObjectFactory &factory,
+												 DynObject &self)
+	{
+		const Instr *code = code_.data();
+		size_t pc = 0;
+		for (;;)
+		{
+			const Instr &in = code[pc++];
+			switch (in.op)
+			{
+			case Op::load_int:
+				regs_[in.a].store(static_cast<int>(in.d));
+				break;
+			case Op::load_const:
+				regs_[in.a] = consts_[in.d];
+				break;
+			case Op::move:
+				regs_[in.a] = regs_[in.b];
+				break;
+			case Op::get:
+				if (auto ok = get(in, self); !ok.has_value())
+					return std::unexpected(ok.error());
+				break;
+			case Op::set:
+				if (auto ok = set(factory, in, self); !ok.has_value())
+					return std::unexpected(ok.error());
+				break;
+			case Op::call:
+				if (auto ok = call(in, self); !ok.has_value())
+					return std::unexpected(ok.error());
+				break;
+			case Op::add:
+			case Op::sub:
+			case Op::mul:
+			case Op::div:
+			case Op::mod:
+				if (auto ok = arithmetic(in.op, regs_[in.a], regs_[in.b],
+										 regs_[in.c]);
+					!ok.has_value())
+					return std::unexpected(ok.error());
+				break;
+			case Op::eq:
+			case Op::ne:
+			case Op::lt:
+			case Op::le:
+			case Op::gt:
+			case Op::ge:
+			{
+				auto v = compare(in.op, regs_[in.b], regs_[in.c]);
+				if (!v.has_value())
+					return std::unexpected(v.error());
+				regs_[in.a].store(int(*v));
+				break;
+			}
+			case Op::neg:
+			{
+				const Slot &v = regs_[in.b];
+				if (v.kind() == Representation::integer &&
+					v.rawInt() != INT_MIN)
+					regs_[in.a].store(-v.rawInt());
+				else if (double x; number(v, x))
+					regs_[in.a].store(-x);
+				else
+					return std::unexpected("bad operand for -");
+				break;
+			}
+			case Op::not_:
+				regs_[in.a].store(int(!truthy(regs_[in.b])));
+				break;
+			case Op::jump:
+				pc = in.d;
+				break;
+			case Op::jump_if_false:
+				if (!truthy(regs_[in.a]))
+					pc = in.d;
+				break;
+			case Op::jump_if_true:
+				if (truthy(regs_[in.a]))
+					pc = in.d;
+				break;
+			case Op::ret:
+				return regs_[in.a].toAny();
+			}
+		}
+	}
+
+	/* the object operand reg stands for, nullptr if it holds none */
+	DynObject *object(uint8_t reg, DynObject &self) const
+	{
+		if (reg == self_reg)
+			return &self;
+		if (auto p = regs_[reg].ptr<std::shared_ptr<DynObject>>())
+			return p->get();
+		return nullptr;
+	}
+
+	std::expected<void, std::string> get(const Instr &in, DynObject &self)
+	{
+		DynObject *obj = object(in.b, self);
+		if (!obj)
+			return std::unexpected("not an object");
+		Site &site = sites_[in.d];
+
+		Slot value;
+		std::optional<Accessor> getter;
+		const bool hit =
+			cached(*obj, site.cache,
+				   [&](const Shape &field, const DynObject &holder)
+				   {
+					   if (field.accessor_.type)
+						   getter = field.accessor_;
+					   else
+						   value = holder.values_[field.offset_];
+				   });
+		if (!hit)
+		{
+			auto v = obj->get<std::any>(site.key);
+			if (!v.has_value())
+				return std::unexpected(v.error());
+			value.store(std::move(*v));
+			fill(*obj, site.key, site.cache);
+		}
+		else if (getter)
+			value.store(*DynObject::callGetter<std::any>(*getter, *obj));
+		/* in.a may be in.b, so only now */
+		regs_[in.a] = std::move(value);
+		return {};
+	}
+
+	std::expected<void, std::string> set(ObjectFactory &factory,
+										 const Instr &in, DynObject &self)
+	{
+		DynObject *obj = object(in.a, self);
+		if (!obj)
+			return std::unexpected("not an object");
+		Site &site = sites_[in.d];
+		const Slot &value = regs_[in.b];
+
+		/**
+		 * a hit is a known own data field of a writable object. an empty
+		 * value goes the slow way, set boxes it and widens the field
+		 */
+		if (site.cache.field && value.kind() != Representation::none)
+		{
+			bool hit = false, observed = false;
+			{
+				unique_lock_t<object_mutex_t> lock(obj->mutex_);
+				if (obj->shape_ == site.cache.shape &&
+					obj->integrity_.load(std::memory_order_relaxed) !=
+						Integrity::frozen)
+				{
+					const Shape *field = site.cache.field;
+					obj->writeBarrier(value);
+					obj->forgetHash();
+					if (obj->changes_) [[unlikely]]
+						obj->changes_->store(field->offset_);
+					field->generalize(value.kind());
+					obj->values_[field->offset_] = value;
+					observed = obj->observers_ != nullptr;
+					hit = true;
+				}
+			}
+			if (hit)
+			{
+				if (observed) [[unlikely]]
+					obj->changed(site.key);
+				return {};
+			}
+		}
+
+		if (auto ok = obj->set(factory, site.key, value.toAny());
+			!ok.has_value())
+			return ok;
+		shared_lock_t<object_mutex_t> lock(obj->mutex_);
+		const Shape *field = obj->shape_->lookup(site.key);
+		if (field && !field->accessor_.type)
+			site.cache = {obj->shape_, nullptr, field, nullptr};
+		else
+			site.cache = {};
+		return {};
+	}
+
+	std::expected<void, std::string> call(const Instr &in, DynObject &self)
+	{
+		DynObject *obj = object(in.b, self);
+		if (!obj)
+			return std::unexpected("not an object");
+		Site &site = sites_[in.d];
+
+		args_.clear();
+		for (uint8_t i = 0; i < site.argc; ++i)
+			args_.push_back(regs_[in.c + i].toAny());
+
+		std::optional<Accessor> native;
+		DynObject::Method copy;
+		const DynObject::Method *method = nullptr;
+		const bool hit = cached(
+			*obj, site.cache,
+			[&](const Shape &field, const DynObject &holder)
+			{
+				if (field.accessor_.method())
+					native = field.accessor_;
+				else if (field.accessor_.type)
+					return; /* a getter, call does the rest */
+				else if (auto p = holder.values_[field.offset_]
+									  .ptr<DynObject::Method>())
+				{
+					/* a frozen holder's slot stays put, no need to copy */
+					if (holder.frozen())
+						method = p;
+					else
+						method = &(copy = *p);
+				}
+			});
+
+		std::any result;
+		if (native)
+			result = reinterpret_cast<ObjectFactory::NativeMethod>(
+				native->getter)(*obj, native->context, args_);
+		else if (method && *method)
+			result = (*method)(*obj, DynObject::Args(
+										 std::make_move_iterator(args_.begin()),
+										 std::make_move_iterator(args_.end())));
+		else
+		{
+			auto r = obj->call(site.key,
+							   DynObject::Args(
+								   std::make_move_iterator(args_.begin()),
+								   std::make_move_iterator(args_.end())));
+			if (!r.has_value())
+				return std::unexpected(r.error());
+			result = std::move(*r);
+			if (!hit)
+				fill(*obj, site.key, site.cache);
+		}
+		regs_[in.a].store(std::move(result));
+		return {};
+	}
+
+	/**
+	 * runs read(field, holder) and returns true if cache hits for obj.
+	 * read runs under obj's lock, which is what guards the slots of obj;
+	 * a holder other than obj is frozen and needs no lock
+	 */
+	template <typename F>
+	static bool cached(const DynObject &obj, const Cache &cache, F &&read)
+	{
+		if (!cache.field)
+			return false;
+#ifdef DYNOBJECT_MULTITHREADED
+		/* a frozen object is read without its lock, like get does */
+		std::shared_lock<object_mutex_t> lock(obj.mutex_, std::defer_lock);
+		if (!obj.frozen())
+			lock.lock();
+#endif
+		if (obj.shape_ != cache.shape)
+			return false;
+		if (cache.holder && obj.prototype != cache.proto)
+			return false;
+		read(*cache.field, cache.holder ? *cache.holder : obj);
+		return true;
+	}
+
+	/**
+	 * points cache at where key is for obj: an own property, or one of a
+	 * prototype chain that's frozen from the first link to the one that
+	 * has it. anything else (and misses) leaves the cache empty
+	 */
+	static void fill(const DynObject &obj, Identifier key, Cache &cache)
+	{
+		cache = {};
+		std::shared_ptr<Shape> shape;
+		std::shared_ptr<DynObject> proto;
+		const Shape *field;
+		{
+			shared_lock_t<object_mutex_t> lock(obj.mutex_);
+			shape = obj.shape_;
+			field = shape->lookup(key);
+		}
+		if (field)
+		{
+			cache = {std::move(shape), nullptr, field, nullptr};
+			return;
+		}
+
+		proto = obj.prototype;
+		for (const DynObject *p = proto.get(); p; p = p->prototype.get())
+		{
+			if (!p->frozen())
+				return;
+			const DynObject *holder = p;
+			if ((field = p->frozenLookup(key, holder)))
+			{
+				cache = {std::move(shape), std::move(proto), field, holder};
+				return;
+			}
+			if (p->inherited_)
+				return; /* the table covers the rest of the chain */
+		}
+	}
+
+	static bool number(const Slot &v, double &out)
+	{
+		if (v.kind() == Representation::integer)
+			out = v.rawInt();
+		else if (v.kind() == Representation::floating)
+			out = v.rawDouble();
+		else
+			return false;
+		return true;
+	}
+
+	static bool truthy(const Slot &v)
+	{
+		switch (v.kind())
+		{
+		case Representation::integer:
+			return v.rawInt() != 0;
+		case Representation::floating:
+			return v.rawDouble() != 0 && !std::isnan(v.rawDouble());
+		case Representation::heap:
+			if (auto b = v.ptr<bool>())
+				return *b;
+			if (auto s = v.ptr<std::string>())
+				return !s->empty();
+			if (auto o = v.ptr<std::shared_ptr<DynObject>>())
+				return *o != nullptr;
+			return v.rawBoxed().has_value();
+		default:
+			return false;
+		}
+	}
+
+	/* dst may be l or r */
+	static std::expected<void, std::string>
+	arithmetic(Op op, Slot &dst, const Slot &l, const Slot &r)
+	{
+		if (l.kind() == Representation::integer &&
+			r.kind() == Representation::integer)
+		{
+			const int a = l.rawInt(), b = r.rawInt();
+			int v = 0;
+			bool ok = false;
+			/* exact in 64 bits, it only has to fit back into an int */
+			auto fits = [&v](int64_t wide)
+			{
+				if (wide < INT_MIN || wide > INT_MAX)
+					return false;
+				v = static_cast<int>(wide);
+				return true;
+			};
+			switch (op)
+			{
+			case Op::add:
+				ok = fits(int64_t{a} + b);
+				break;
+			case Op::sub:
+				ok = fits(int64_t{a} - b);
+				break;
+			case Op::mul:
+				ok = fits(int64_t{a} * b);
+				break;
+			default:
+				if (b == 0)
+					return std::unexpected("division by zero");
+				/**
+				 * INT_MIN / -1 doesn't fit an int, and C++ leaves the %
+				 * undefined too even though the remainder is just 0
+				 */
+				if (a == INT_MIN && b == -1)
+				{
+					ok = op == Op::mod;
+					break;
+				}
+				v = op == Op::div ? a / b : a % b;
+				ok = true;
+			}
+			if (ok)
+			{
+				dst.store(v);
+				return {};
+			}
+			/* overflowed, do it in doubles */
+		}
+
+		double x, y;
+		if (number(l, x) && number(r, y))
+		{
+			switch (op)
+			{
+			case Op::add:
+				dst.store(x + y);
+				break;
+			case Op::sub:
+				dst.store(x - y);
+				break;
+			case Op::mul:
+				dst.store(x * y);
+				break;
+			case Op::div:
+				dst.store(x / y);
+				break;
+			default:
+				dst.store(std::fmod(x, y));
+			}
+			return {};
+		}
+
+		if (op == Op::add)
+		{
+			const std::string *a = l.ptr<std::string>();
+			const std::string *b = r.ptr<std::string>();
+			if (a && b)
+			{
+				std::string joined = *a + *b;
+				dst.store(std::move(joined));
+				return {};
+			}
+		}
+		return std::unexpected("bad operands for arithmetic");
+	}
+
+	static std::expected<bool, std::string> compare(Op op, const Slot &l,
+													const Slot &r)
+	{
+		int order; /* <0, 0, >0 */
+		double x, y;
+		const std::string *a = l.ptr<std::string>();
+		const std::string *b = r.ptr<std::string>();
+		if (number(l, x) && number(r, y))
+		{
+			if (std::isnan(x) || std::isnan(y))
+				return op == Op::ne;
+			order = x < y ? -1 : x > y ? 1 : 0;
+		}
+		else if (a && b)
+			order = a->compare(*b);
+		else if (op == Op::eq || op == Op::ne)
+		{
+			/* anything else is only equal to itself */
+			bool same = l.kind() == Representation::none &&
+						r.kind() == Representation::none;
+			auto p = l.ptr<std::shared_ptr<DynObject>>();
+			auto q = r.ptr<std::shared_ptr<DynObject>>();
+			if (p && q)
+				same = *p == *q;
+			return same == (op == Op::eq);
+		}
+		else
+			return std::unexpected("bad operands for comparison");
+
+		switch (op)
+		{
+		case Op::eq:
+			return order == 0;
+		case Op::ne:
+			return order != 0;
+		case Op::lt:
+			return order < 0;
+		case Op::le:
+			return order <= 0;
+		case Op::gt:
+			return order > 0;
+		default:
+			return order >= 0;
+		}
+	}
+
+	/**
+	 * one pass, recursive descent straight to bytecode. every expression
+	 * leaves its value in the register that was the first free one when it
+	 * started, and frees everything above it, so operands and call arguments
+	 * end up next to each other without a register allocator
+	 */
+	class Compiler
+	{
+	public:
+		Compiler(ObjectFactory &factory, std::string_view source, Script &out)
+			: factory_(factory), src_(source), out_(out)
+		{
+		}
+
+		std::expected<void, std::string> program()
+		{
+			next();
+			uint8_t result = 0;
+			while (tok_.kind != Tok::end && error_.empty())
+			{
+				top_ = 0;
+				result = statement();
+				if (!accept(";") && tok_.kind != Tok::end)
+					fail("expected ';'");
+			}
+			if (!error_.empty())
+				return std::unexpected(error_);
+			emit(Op::ret, result);
+			out_.registers_ = std::max<size_t>(max_, 1);
+			return {};
+		}
+
+	private:
+		enum class Tok : uint8_t
+		{
+			end,
+			integer,
+			floating,
+			string,
+			name,
+			punct
+		};
+
+		struct Token
+		{
+			Tok kind = Tok::end;
+			std::string_view text;
+			size_t pos = 0;
+			int i = 0;
+			double d = 0;
+			std::string s; /* a string literal, unescaped */
+		};
+
+		/* statement: [target =] expression */
+		uint8_t statement()
+		{
+			const uint8_t r = ternary();
+			if (!is("="))
+				return r;
+			if (lvalue_ != out_.code_.size() || out_.code_.back().op != Op::get)
+			{
+				fail("can only assign to a property");
+				return r;
+			}
+			const Instr target = out_.code_.back();
+			out_.code_.pop_back();
+			next();
+			/* the target object stays in its register, if it's in one */
+			top_ = target.b == self_reg ? target.a : target.a + 1;
+			const uint8_t v = ternary();
+			emit(Op::set, target.b, v, 0, target.d);
+			return v;
+		}
+
+		uint8_t ternary()
+		{
+			const uint8_t r = logical(true);
+			if (!accept("?"))
+				return r;
+			const size_t to_else = emit(Op::jump_if_false, r);
+			into(r, ternary());
+			const size_t to_end = emit(Op::jump);
+			patch(to_else);
+			expect(":");
+			into(r, ternary());
+			patch(to_end);
+			return r;
+		}
+
+		/* || (or, with !is_or, &&): the value of the operand that decided it */
+		uint8_t logical(bool is_or)
+		{
+			const uint8_t r = is_or ? logical(false) : binary(0);
+			while (error_.empty() && accept(is_or ? "||" : "&&"))
+			{
+				const size_t skip =
+					emit(is_or ? Op::jump_if_true : Op::jump_if_false, r);
+				into(r, is_or ? logical(false) : binary(0));
+				patch(skip);
+			}
+			return r;
+		}
+
+		/* the binary operators by precedence, loosest first */
+		uint8_t binary(int level)
+		{
+			static constexpr std::pair<std::string_view, Op> levels[][4] = {
+				{{"==", Op::eq}, {"!=", Op::ne}},
+				{{"<", Op::lt}, {"<=", Op::le}, {">", Op::gt}, {">=", Op::ge}},
+				{{"+", Op::add}, {"-", Op::sub}},
+				{{"*", Op::mul}, {"/", Op::div}, {"%", Op::mod}}};
+			if (static_cast<size_t>(level) == std::size(levels))
+				return unary();
+
+			const uint8_t l = binary(level + 1);
+			for (;;)
+			{
+				if (!error_.empty() || tok_.kind != Tok::punct)
+					return l;
+				Op op = Op::ret;
+				for (const auto &[text, candidate] : levels[level])
+				{
+					if (!text.empty() && tok_.text == text)
+						op = candidate;
+				}
+				if (op == Op::ret)
+					return l;
+				next();
+				const uint8_t r = binary(level + 1);
+				emit(op, l, l, r);
+				top_ = l + 1;
+			}
+		}
+
+		uint8_t unary()
+		{
+			/* every nesting goes through here, keep the recursion bounded */
+			if (++depth_ > max_depth)
+			{
+				fail("nesting too deep");
+				return top_;
+			}
+			struct Leave
+			{
+				size_t &depth;
+				~Leave()
+				{
+					--depth;
+				}
+			} leave{depth_};
+
+			if (accept("-"))
+			{
+				const uint8_t r = unary();
+				emit(Op::neg, r, r);
+				return r;
+			}
+			if (accept("!"))
+			{
+				const uint8_t r = unary();
+				emit(Op::not_, r, r);
+				return r;
+			}
+			return postfix();
+		}
+
+		/* a primary, then any number of .name and .name(args) */
+		uint8_t postfix()
+		{
+			const uint8_t r = alloc();
+			if (tok_.kind == Tok::integer)
+			{
+				emit(Op::load_int, r, 0, 0, static_cast<uint32_t>(tok_.i));
+				next();
+				return r;
+			}
+			if (tok_.kind == Tok::floating || tok_.kind == Tok::string)
+			{
+				Slot value;
+				if (tok_.kind == Tok::floating)
+					value.store(tok_.d);
+				else
+					value.store(std::move(tok_.s));
+				out_.consts_.push_back(std::move(value));
+				emit(Op::load_const, r, 0, 0,
+					 static_cast<uint32_t>(out_.consts_.size() - 1));
+				next();
+				return r;
+			}
+			if (accept("("))
+			{
+				top_ = r;
+				into(r, ternary());
+				expect(")");
+			}
+			else if (tok_.kind == Tok::name)
+			{
+				if (tok_.text == "true" || tok_.text == "false")
+				{
+					emit(Op::load_int, r, 0, 0, tok_.text == "true");
+					next();
+					return r;
+				}
+				if (tok_.text == "this")
+				{
+					next();
+					if (!is("."))
+					{
+						fail("this only goes with a property, this.name");
+						return r;
+					}
+					next();
+					if (tok_.kind != Tok::name)
+					{
+						fail("expected a name");
+						return r;
+					}
+				}
+				member(r, self_reg);
+			}
+			else
+			{
+				fail("expected a value");
+				return r;
+			}
+
+			while (error_.empty() && accept("."))
+			{
+				if (tok_.kind != Tok::name)
+				{
+					fail("expected a name");
+					break;
+				}
+				member(r, r);
+			}
+			return r;
+		}
+
+		/* r = object.name or r = object.name(args), tok_ is the name */
+		void member(uint8_t r, uint8_t object)
+		{
+			const std::string_view name = tok_.text;
+			next();
+			if (!accept("("))
+			{
+				emit(Op::get, r, object, 0, site(name, 0));
+				lvalue_ = out_.code_.size();
+				return;
+			}
+			size_t argc = 0;
+			if (!accept(")"))
+			{
+				do
+				{
+					if (ternary() != r + 1 + argc)
+						fail("too many registers");
+					++argc;
+				} while (error_.empty() && accept(","));
+				expect(")");
+			}
+			if (argc > 255)
+				fail("too many arguments");
+			emit(Op::call, r, object, r + 1,
+				 site(name, static_cast<uint8_t>(argc)));
+			top_ = r + 1;
+		}
+
+		/* --- helpers --- */
+
+		uint8_t alloc()
+		{
+			if (top_ >= self_reg)
+			{
+				fail("expression too complex");
+				return 0;
+			}
+			max_ = std::max<size_t>(max_, top_ + 1);
+			return top_++;
+		}
+
+		/* moves the value of a sub-expression into r, frees what's above */
+		void into(uint8_t r, uint8_t value)
+		{
+			if (value != r)
+				emit(Op::move, r, value);
+			top_ = r + 1;
+		}
+
+		uint32_t site(std::string_view name, uint8_t argc)
+		{
+			out_.sites_.push_back({factory_.intern(name), argc, {}});
+			return static_cast<uint32_t>(out_.sites_.size() - 1);
+		}
+
+		size_t emit(Op op, uint8_t a = 0, uint8_t b = 0, uint8_t c = 0,
+					uint32_t d = 0)
+		{
+			out_.code_.push_back({op, a, b, c, d});
+			return out_.code_.size() - 1;
+		}
+
+		/* points the jump at `at` to the next instruction */
+		void patch(size_t at)
+		{
+			out_.code_[at].d = static_cast<uint32_t>(out_.code_.size());
+		}
+
+		void fail(std::string_view what)
+		{
+			if (error_.empty())
+				error_ = std::string(what) + " at offset " + std::to_string(tok_.pos);
+		}
+
+		bool is(std::string_view punct) const
+		{
+			return tok_.kind == Tok::punct && tok_.text == punct;
+		}
+
+		bool accept(std::string_view punct)
+		{
+			if (!is(punct))
+				return false;
+			next();
+			return true;
+		}
+
+		void expect(std::string_view punct)
+		{
+			if (!accept(punct))
+				fail("expected '" + std::string(punct) + "'");
+		}
+
+		/* --- the tokenizer --- */
+
+		void next()
+		{
+			while (pos_ < src_.size() &&
+				   (src_[pos_] == ' ' || src_[pos_] == '\t' || src_[pos_] == '\n' ||
+					src_[pos_] == '\r'))
+				++pos_;
+			tok_ = Token{};
+			tok_.pos = pos_;
+			if (pos_ == src_.size() || !error_.empty())
+				return;
+
+			const size_t start = pos_;
+			const char c = src_[pos_];
+			const auto ident = [](char ch)
+			{
+				return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+					   (ch >= '0' && ch <= '9') || ch == '_';
+			};
+			if (c >= '0' && c <= '9')
+			{
+				bool is_double = false;
+				while (pos_ < src_.size() &&
+					   (ident(src_[pos_]) || src_[pos_] == '.' ||
+						((src_[pos_] == '+' || src_[pos_] == '-') &&
+						 (src_[pos_ - 1] == 'e' || src_[pos_ - 1] == 'E'))))
+				{
+					is_double |= src_[pos_] == '.' || src_[pos_] == 'e' ||
+								 src_[pos_] == 'E';
+					++pos_;
+				}
+				tok_.text = src_.substr(start, pos_ - start);
+				const char *first = tok_.text.data();
+				const char *last = first + tok_.text.size();
+				tok_.kind = Tok::integer;
+				if (auto [end, ec] = std::from_chars(first, last, tok_.i);
+					is_double || ec != std::errc() || end != last)
+				{
+					tok_.kind = Tok::floating;
+					if (std::from_chars(first, last, tok_.d).ptr != last)
+						fail("bad number");
+				}
+				return;
+			}
+			if (ident(c))
+			{
+				while (pos_ < src_.size() && ident(src_[pos_]))
+					++pos_;
+				tok_.kind = Tok::name;
+				tok_.text = src_.substr(start, pos_ - start);
+				return;
+			}
+			if (c == '"')
+			{
+				++pos_;
+				while (pos_ < src_.size() && src_[pos_] != '"')
+				{
+					char ch = src_[pos_++];
+					if (ch == '\\' && pos_ < src_.size())
+					{
+						ch = src_[pos_++];
+						ch = ch == 'n' ? '\n' : ch == 't' ? '\t' : ch;
+					}
+					tok_.s += ch;
+				}
+				if (pos_ == src_.size())
+				{
+					fail("unterminated string");
+					return;
+				}
+				++pos_;
+				tok_.kind = Tok::string;
+				tok_.text = src_.substr(start, pos_ - start);
+				return;
+			}
+
+			static constexpr std::string_view puncts[] = {
+				"==", "!=", "<=", ">=", "&&", "||", "+", "-", "*", "/", "%",
+				"<",  ">",	"!",  "=",	"(",  ")",	".", ",", ";", "?", ":"};
+			for (std::string_view p : puncts)
+			{
+				if (src_.substr(pos_, p.size()) == p)
+				{
+					pos_ += p.size();
+					tok_.kind = Tok::punct;
+					tok_.text = p;
+					return;
+				}
+			}
+			fail(std::string("unexpected '") + c + "'");
+		}
+
+		ObjectFactory &factory_;
+		std::string_view src_;
+		Script &out_;
+		size_t pos_ = 0;
+		Token tok_;
+		std::string error_;
+		uint8_t top_ = 0;  /* the first free register */
+		size_t max_ = 0;   /* registers used */
+		size_t lvalue_ = 0; /* code size right after the last property get */
+		size_t depth_ = 0;
+		static constexpr size_t max_depth = 128;
+	};
+
+	Script() = default;
+
+	std::vector<Instr> code_;
+	std::vector<Slot> consts_;
+	std::vector<Site> sites_;
+	size_t registers_ = 1;
+	std::vector<Slot> regs_;
+	std::vector<std::any> args_; /* reused across calls */
+};
+
+/**
+ * bulk operations over many objects at once: forEach, transform and
+ * reduce, split across a pool of threads (DYNOBJECT_MULTITHREADED only,
+ * elsewhere the caller does everything, same as Executor).
+ *
+ * objects are sorted by shape first and cut into chunks that never mix
+ * shapes, so whatever a chunk works out from the shape holds for all of
+ * it; transform looks its keys up once per shape and adds a missing
+ * output property with one transition per shape, all made under a single
+ * factory lock before any thread starts. every thread (the caller is one
+ * of them) has a deque of chunks it takes from the back of, and once it
+ * runs dry it steals from the front of the others'.
+ *
+ * objects is anything indexable holding pointers to objects (raw, unique
+ * or shared). one operation at a time per Parallel, and fn must not start
+ * another one on the same Parallel
+ */
+class Parallel
+{
+public:
+	using DynObject = ObjectFactory::DynObject;
+	using Identifier = ObjectFactory::Identifier;
+
+	/* threads is how many threads help the caller */
+	explicit Parallel(unsigned threads = 0)
+#ifdef DYNOBJECT_MULTITHREADED
+		: queues_(threads + 1)
+	{
+		workers_.reserve(threads);
+		for (unsigned i = 0; i < threads; ++i)
+			workers_.emplace_back([this, i] { worker(i); });
+	}
+#else
+		: queues_(1)
+	{
+		(void)threads;
+	}
+#endif
+
+	Parallel(const Parallel &) = delete;
+	Parallel &operator=(const Parallel &) = delete;
+
+	~Parallel()
+	{
+#ifdef DYNOBJECT_MULTITHREADED
+		{
+			unique_lock_t<factory_mutex_t> lock(mutex_);
+			stopping_ = true;
+		}
+		start_.notify_all();
+		for (std::thread &worker : workers_)
+			worker.join();
+#endif
+	}
+
+	/* fn(obj) for every object */
+	template <typename Objects, typename F>
+	void forEach(const Objects &objects, F &&fn)
+	{
+		group(objects);
+		run(
+			[&](const Chunk &chunk)
+			{
+				for (size_t i = chunk.begin; i < chunk.end; ++i)
+					fn(*objects_[i]);
+			});
+	}
+
+	/**
+	 * sets out = fn(in values...) on every object, e.g.
+	 * `transform<int, int, int>(factory, objects, total, {price, qty},
+	 * [](int p, int q) { return p * q; })`. own data properties of the
+	 * right type are read and written in place under the object's lock,
+	 * with fn running inside it, so fn must not touch the object;
+	 * anything else (inherited or computed properties, a sealed object
+	 * that lacks out...) goes through get and set.
+	 *
+	 * every object is attempted, the first error is returned and the
+	 * writes that worked stay
+	 */
+	template <typename R, typename... In, typename Objects, typename F>
+	std::expected<void, std::string>
+	transform(ObjectFactory &factory, const Objects &objects, Identifier out,
+			  std::array<Identifier, sizeof...(In)> in, F &&fn)
+	{
+		constexpr Representation rep = Slot::representationOf<R>();
+		group(objects);
+		{
+			unique_lock_t<factory_mutex_t> factory_lock(factory.factory_mutex_);
+			for (Group &g : groups_)
+			{
+				g.fast = std::ranges::none_of(
+					in,
+					[&](Identifier key)
+					{
+						const Shape *field = g.shape->lookup(key);
+						return !field || field->accessor_.type;
+					});
+				g.out = g.shape->lookup(out);
+				if (g.out && g.out->accessor_.type)
+					g.fast = false;
+				else if (!g.out)
+				{
+					g.grown = factory.transition(g.shape, out);
+					g.grown->generalize(rep);
+				}
+			}
+		}
+		error_.clear();
+
+		run(
+			[&](const Chunk &chunk)
+			{
+				const Group &g = groups_[chunk.group];
+				std::array<size_t, sizeof...(In)> offsets{};
+				if (g.fast)
+					for (size_t i = 0; i < in.size(); ++i)
+						offsets[i] = g.shape->lookup(in[i])->offset_;
+
+				for (size_t i = chunk.begin; i < chunk.end; ++i)
+				{
+					DynObject &obj = *objects_[i];
+					if (g.fast)
+					{
+						bool done = false, observed = false;
+						{
+							unique_lock_t<object_mutex_t> lock(obj.mutex_);
+							if (obj.shape_ == g.shape &&
+								obj.integrity_.load(std::memory_order_relaxed) ==
+									Integrity::none)
+							{
+								done = [&]<size_t... I>(std::index_sequence<I...>)
+								{
+									std::tuple<const In *...> args{
+										obj.values_[offsets[I]].template ptr<In>()...};
+									if ((!std::get<I>(args) || ...))
+										return false;
+									R value = fn(*std::get<I>(args)...);
+									obj.writeBarrier(value);
+									obj.forgetHash();
+									if (g.out)
+									{
+										if (obj.changes_) [[unlikely]]
+											obj.changes_->store(g.out->offset_);
+										g.out->generalize(rep);
+										obj.values_[g.out->offset_].store(std::move(value));
+									}
+									else
+									{
+										const size_t offset = g.grown->getNewOffset();
+										obj.shape_ = g.grown;
+										obj.values_.resize(g.grown->getPropertyCount());
+										obj.values_[offset].store(std::move(value));
+										if (obj.changes_) [[unlikely]]
+											obj.changes_->add(out, offset);
+									}
+									return true;
+								}(std::index_sequence_for<In...>{});
+								observed = done && obj.observers_ != nullptr;
+							}
+						}
+						if (observed) [[unlikely]]
+							obj.changed(out);
+						if (done)
+							continue;
+					}
+
+					/* the slow way, for whatever the fast one didn't take */
+					auto ok = [&]<size_t... I>(std::index_sequence<I...>)
+						-> std::expected<void, std::string>
+					{
+						std::tuple<std::expected<In, std::string>...> args{
+							obj.get<In>(in[I])...};
+						std::string error;
+						((std::get<I>(args).has_value() || !error.empty() ||
+						  (error = std::get<I>(args).error(), true)),
+						 ...);
+						if (!error.empty())
+							return std::unexpected(std::move(error));
+						return obj.set(factory, out, R(fn(*std::get<I>(args)...)));
+					}(std::index_sequence_for<In...>{});
+					if (!ok.has_value())
+						fail(ok.error());
+				}
+			});
+
+		for (Group &g : groups_)
+			g.grown.reset();
+		if (!error_.empty())
+			return std::unexpected(std::move(error_));
+		return {};
+	}
+
+	/**
+	 * combine(...combine(combine(init, map(a)), map(b))...) over all
+	 * objects, in no particular order: combine must be associative and
+	 * commutative
+	 */
+	template <typename T, typename Objects, typename Map, typename Combine>
+	T reduce(const Objects &objects, T init, Map &&map, Combine &&combine)
+	{
+		group(objects);
+		std::vector<std::optional<T>> partial(chunks_.size());
+		run(
+			[&](const Chunk &chunk)
+			{
+				std::optional<T> &acc = partial[&chunk - chunks_.data()];
+				for (size_t i = chunk.begin; i < chunk.end; ++i)
+				{
+					if (acc)
+						*acc = combine(std::move(*acc), map(*objects_[i]));
+					else
+						acc.emplace(map(*objects_[i]));
+				}
+			});
+		for (std::optional<T> &p : partial)
+			if (p)
+				init = combine(std::move(init), std::move(*p));
+		return init;
+	}
+
+private:
+	using Shape = ObjectFactory::Shape;
+	using Slot = ObjectFactory::Slot;
+
+	/* objects_[begin, end) all have shape */
+	struct Group
+	{
+		std::shared_ptr<Shape> shape;
+		size_t begin, end;
+		/* for transform */
+		bool fast = false;
+		const Shape *out = nullptr;
+		std::shared_ptr<Shape> grown; /* shape plus out, if out is new */
+	};
+
+	struct Chunk
+	{
+		size_t group, begin, end;
+	};
+
+	struct Queue
+	{
+		factory_mutex_t mutex;
+		std::deque<const Chunk *> chunks;
+	};
+
+	/**
+	 * sorts the objects into groups_ (a counting sort, objects of a shape
+	 * stay in the order they came in) and cuts those into chunks_
+	 */
+	template <typename Objects>
+	void group(const Objects &objects)
+	{
+		const size_t n = std::size(objects);
+		groups_.clear();
+		shape_ids_.clear();
+		ids_.resize(n);
+		size_t last = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			DynObject &obj = *objects[i];
+			shared_lock_t<object_mutex_t> lock(obj.mutex_);
+			/**
+			 * a group's shared_ptr keeps its shape alive, so the address
+			 * can't come back as some other shape meanwhile
+			 */
+			if (last >= groups_.size() || groups_[last].shape != obj.shape_)
+				last = groupOf(obj.shape_);
+			ids_[i] = last;
+			++groups_[last].end; /* counts for now */
+		}
+
+		size_t begin = 0;
+		for (Group &g : groups_)
+		{
+			const size_t size = g.end;
+			g.begin = g.end = begin;
+			begin += size;
+		}
+		objects_.resize(n);
+		for (size_t i = 0; i < n; ++i)
+			objects_[groups_[ids_[i]].end++] = &*objects[i];
+
+		/* enough chunks per thread for stealing to even things out */
+		const size_t grain =
+			std::clamp<size_t>(n / (queues_.size() * 8), 64, 4096);
+		chunks_.clear();
+		for (size_t g = 0; g < groups_.size(); ++g)
+			for (size_t b = groups_[g].begin; b < groups_[g].end; b += grain)
+				chunks_.push_back({g, b, std::min(b + grain, groups_[g].end)});
+	}
+
+	/* the group of shape, a new one if it has none yet */
+	size_t groupOf(const std::shared_ptr<Shape> &shape)
+	{
+		/* a handful of shapes is the usual, a map only for more */
+		if (groups_.size() <= 8)
+		{
+			for (size_t g = 0; g < groups_.size(); ++g)
+				if (groups_[g].shape == shape)
+					return g;
+		}
+		else
+		{
+			if (shape_ids_.empty())
+				for (size_t g = 0; g < groups_.size(); ++g)
+					shape_ids_.emplace(groups_[g].shape.get(), g);
+			if (auto it = shape_ids_.find(shape.get()); it != shape_ids_.end())
+				return it->second;
+			shape_ids_.emplace(shape.get(), groups_.size());
+		}
+		groups_.push_back({shape, 0, 0, false, nullptr, nullptr});
+		return groups_.size() - 1;
+	}
+
+	/* runs body(chunk) on every chunk, here and on the workers */
+	template <typename Body>
+	void run(Body &&body)
+	{
+		if (chunks_.empty())
+			return;
+		{
+			unique_lock_t<factory_mutex_t> lock(mutex_);
+			body_ = &body;
+			call_ = [](void *b, const Chunk &chunk)
+			{ (*static_cast<std::remove_reference_t<Body> *>(b))(chunk); };
+			remaining_.store(chunks_.size(), std::memory_order_relaxed);
+			for (size_t i = 0; i < chunks_.size(); ++i)
+			{
+				Queue &q = queues_[i % queues_.size()];
+				unique_lock_t<factory_mutex_t> queue_lock(q.mutex);
+				q.chunks.push_back(&chunks_[i]);
+			}
+#ifdef DYNOBJECT_MULTITHREADED
+			++generation_;
+#endif
+		}
+#ifdef DYNOBJECT_MULTITHREADED
+		start_.notify_all();
+#endif
+		work(queues_.size() - 1);
+#ifdef DYNOBJECT_MULTITHREADED
+		unique_lock_t<factory_mutex_t> lock(mutex_);
+		done_.wait(lock,
+				   [this]
+				   {
+					   return active_ == 0 &&
+							  remaining_.load(std::memory_order_acquire) == 0;
+				   });
+#endif
+	}
+
+	/* runs chunks until there are none left anywhere */
+	void work(size_t self)
+	{
+		while (const Chunk *chunk = take(self))
+		{
+			call_(body_, *chunk);
+			if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+#ifdef DYNOBJECT_MULTITHREADED
+				unique_lock_t<factory_mutex_t> lock(mutex_);
+				done_.notify_all();
+#endif
+			}
+		}
+	}
+
+	/* the newest of our own chunks, or the oldest of someone else's */
+	const Chunk *take(size_t self)
+	{
+		const size_t n = queues_.size();
+		for (size_t i = 0; i < n; ++i)
+		{
+			Queue &q = queues_[(self + i) % n];
+			unique_lock_t<factory_mutex_t> lock(q.mutex);
+			if (q.chunks.empty())
+				continue;
+			const Chunk *chunk;
+			if (i == 0)
+			{
+				chunk = q.chunks.back();
+				q.chunks.pop_back();
+			}
+			else
+			{
+				chunk = q.chunks.front();
+				q.chunks.pop_front();
+			}
+			return chunk;
+		}
+		return nullptr;
+	}
+
+	void fail(const std::string &error)
+	{
+		unique_lock_t<factory_mutex_t> lock(mutex_);
+		if (error_.empty())
+			error_ = error;
+	}
+
+#ifdef DYNOBJECT_MULTITHREADED
+	void worker(size_t self)
+	{
+		uint64_t seen = 0;
+		for (;;)
+		{
+			{
+				unique_lock_t<factory_mutex_t> lock(mutex_);
+				start_.wait(lock,
+							[&] { return stopping_ || generation_ != seen; });
+				if (stopping_)
+					return;
+				seen = generation_;
+				++active_;
+			}
+			work(self);
+			{
+				unique_lock_t<factory_mutex_t> lock(mutex_);
+				--active_;
+			}
+			done_.notify_all();
+		}
+	}
+
+	std::vector<std::thread> workers_;
+	std::condition_variable start_, done_;
+	uint64_t generation_ = 0;
+	size_t active_ = 0; /* workers inside work() */
+	bool stopping_ = false;
+#endif
+	factory_mutex_t mutex_;
+	std::vector<Queue> queues_; /* one per worker, the caller's is last */
+	std::atomic<size_t> remaining_{0};
+	void *body_ = nullptr;
+	void (*call_)(void *, const Chunk &) = nullptr;
+	std::string error_;
+
+	/* reused across operations */
+	std::vector<DynObject *> objects_;
+	std::vector<Group> groups_;
+	std::vector<Chunk> chunks_;
+	std::vector<size_t> ids_; /* group of each object, while grouping */
+	std::unordered_map<const Shape *, size_t> shape_ids_;
+};
+
+/* what an Index keeps its values in */
+enum class IndexKind
+{
+	hash,	/* std::unordered_map, find in O(1) */
+	ordered /* std::map, find in O(log n) plus range queries */
+};
+
+/**
+ * a secondary index over a set of objects: which of them have key set to
+ * a given value. the index observes every object in it (observe(key, ...))
+ * and moves the object to its new value after each set, remove or
+ * transaction that touches key, so a lookup never scans the objects.
+ *
+ * an object is listed under what get<T>(key) gives, or not at all while
+ * that fails (missing, or not a T) or gives NaN. like any observer it
+ * lags inside a DynObject::Batch, and it doesn't notice prototype values
+ * changing. objects must be removed (or the index destroyed) before they
+ * die; an observer still running when the index goes finds it gone
+ */
+template <typename T, IndexKind Kind = IndexKind::hash>
+class Index
+{
+public:
+	using DynObject = ObjectFactory::DynObject;
+	using Identifier = ObjectFactory::Identifier;
+
+	explicit Index(Identifier key) : state_(std::make_shared<State>(key))
+	{
+	}
+
+	/* indexes objects (anything indexable holding object pointers) */
+	template <typename Objects>
+	Index(Identifier key, const Objects &objects)
+		: state_(std::make_shared<State>(key))
+	{
+		for (const auto &obj : objects)
+			add(*obj);
+	}
+
+	Index(const Index &) = delete;
+	Index &operator=(const Index &) = delete;
+
+	~Index()
+	{
+		/* observers already running find the state gone or obj unlisted */
+		std::unordered_map<DynObject *, Member> members;
+		{
+			unique_lock_t<factory_mutex_t> lock(state_->mutex);
+			members.swap(state_->members);
+		}
+		for (auto &[obj, member] : members)
+			obj->unobserve(member.subscription);
+	}
+
+	/* starts following obj, false if it already is */
+	bool add(DynObject &obj)
+	{
+		{
+			unique_lock_t<factory_mutex_t> lock(state_->mutex);
+			if (!state_->members.try_emplace(&obj).second)
+				return false;
+		}
+		const auto subscription = obj.observe(
+			state_->key,
+			[state = std::weak_ptr<State>(state_)](
+				DynObject &self, std::span<const Identifier>)
+			{
+				if (auto alive = state.lock())
+					alive->update(self);
+			});
+		{
+			unique_lock_t<factory_mutex_t> lock(state_->mutex);
+			state_->members[&obj].subscription = subscription;
+		}
+		state_->update(obj);
+		return true;
+	}
+
+	/* stops following obj, false if it wasn't */
+	bool remove(DynObject &obj)
+	{
+		typename DynObject::Subscription subscription;
+		{
+			unique_lock_t<factory_mutex_t> lock(state_->mutex);
+			auto it = state_->members.find(&obj);
+			if (it == state_->members.end())
+				return false;
+			state_->unlink(it->second);
+			subscription = it->second.subscription;
+			state_->members.erase(it);
+		}
+		obj.unobserve(subscription);
+		return true;
+	}
+
+	/* objects followed, listed or not */
+	size_t size() const
+	{
+		unique_lock_t<factory_mutex_t> lock(state_->mutex);
+		return state_->members.size();
+	}
+
+	/* the objects whose key is value, in no particular order */
+	std::vector<DynObject *> find(const T &value) const
+	{
+		if (!listable(value))
+			return {};
+		unique_lock_t<factory_mutex_t> lock(state_->mutex);
+		auto it = state_->map.find(value);
+		if (it == state_->map.end())
+			return {};
+		return it->second;
+	}
+
+	size_t count(const T &value) const
+	{
+		if (!listable(value))
+			return 0;
+		unique_lock_t<factory_mutex_t> lock(state_->mutex);
+		auto it = state_->map.find(value);
+		return it == state_->map.end() ? 0 : it->second.size();
+	}
+
+	/* the objects with lo <= key < hi, by value */
+	std::vector<DynObject *> range(const T &lo, const T &hi) const
+		requires(Kind == IndexKind::ordered)
+	{
+		std::vector<DynObject *> out;
+		if (!listable(lo) || !listable(hi))
+			return out;
+		unique_lock_t<factory_mutex_t> lock(state_->mutex);
+		for (auto it = state_->map.lower_bound(lo);
+			 it != state_->map.end() && it->first < hi; ++it)
+			out.insert(out.end(), it->second.begin(), it->second.end());
+		return out;
+	}
+
+private:
+	/* the objects listed under one value */
+	using Bucket = std::vector<DynObject *>;
+	using Map = std::conditional_t<Kind == IndexKind::ordered,
+								   std::map<T, Bucket>,
+								   std::unordered_map<T, Bucket>>;
+
+	struct Member
+	{
+		std::optional<T> value; /* empty while not listed */
+		size_t position = 0;	/* in the value's bucket */
+		typename DynObject::Subscription subscription = 0;
+	};
+
+	/**
+	 * NaN equals nothing, not even itself, and has no place in an order:
+	 * neither map could find it again. objects holding it aren't listed
+	 */
+	static bool listable(const T &value)
+	{
+		if constexpr (std::is_floating_point_v<T>)
+			return !std::isnan(value);
+		else
+			return true;
+	}
+
+	/* shared with the observers, which may outlive the index */
+	struct State
+	{
+		explicit State(Identifier key) : key(key)
+		{
+		}
+
+		/* relists obj under its current value */
+		void update(DynObject &obj)
+		{
+			/**
+			 * read under our lock, so when two sets race, whichever update
+			 * comes last also reads last and the newest value wins. nothing
+			 * takes our lock while holding an object's, the other order
+			 */
+			unique_lock_t<factory_mutex_t> lock(mutex);
+			auto value = obj.template get<T>(key);
+			auto it = members.find(&obj);
+			if (it == members.end())
+				return; /* removed meanwhile */
+			Member &member = it->second;
+			const bool listed = value.has_value() && listable(*value);
+			if (listed && member.value == *value)
+				return;
+			unlink(member);
+			if (!listed)
+				return;
+			Bucket &bucket = map[*value];
+			member.position = bucket.size();
+			bucket.push_back(&obj);
+			member.value.emplace(std::move(*value));
+		}
+
+		/* takes a member out of its bucket, the last one there fills in */
+		void unlink(Member &member)
+		{
+			if (!member.value)
+				return;
+			auto it = map.find(*member.value);
+			Bucket &bucket = it->second;
+			DynObject *last = bucket.back();
+			bucket[member.position] = last;
+			members[last].position = member.position;
+			bucket.pop_back();
+			if (bucket.empty())
+				map.erase(it);
+			member.value.reset();
+		}
+
+		const Identifier key;
+		mutable factory_mutex_t mutex;
+		Map map;
+		std::unordered_map<DynObject *, Member> members;
+	};
+
+	std::shared_ptr<State> state_;
+};
+
+template <typename T>
+using HashIndex = Index<T, IndexKind::hash>;
+template <typename T>
+using OrderedIndex = Index<T, IndexKind::ordered>;
+
+/**
+ * a side table of V per object that doesn't keep the objects alive, e.g.
+ * memoized data derived from them: each entry carries a finalizer (see
+ * DynObject::Weak) that drops it when its object is destroyed. entries
+ * are keyed by the object's weak identity, which stays put when evacuate
+ * moves a young object. the map may die before or after its objects
+ */
+template <typename V>
+class WeakMap
+{
+public:
+	using DynObject = ObjectFactory::DynObject;
+
+	WeakMap() : state_(std::make_shared<State>())
+	{
+	}
+
+	WeakMap(const WeakMap &) = delete;
+	WeakMap &operator=(const WeakMap &) = delete;
+
+	~WeakMap()
+	{
+		/* finalizers already running find the state gone or the entry erased */
+		std::vector<Entry> entries;
+		{
+			unique_lock_t<factory_mutex_t> lock(state_->mutex);
+			for (auto &[id, entry] : state_->entries)
+				entries.push_back(std::move(entry));
+			state_->entries.clear();
+		}
+		for (Entry &entry : entries)
+			entry.weak.unfinalize(entry.finalizer);
+	}
+
+	std::optional<V> get(const DynObject &obj) const
+	{
+		const void *id = obj.identity();
+		if (!id)
+			return std::nullopt;
+		unique_lock_t<factory_mutex_t> lock(state_->mutex);
+		auto it = state_->entries.find(id);
+		if (it == state_->entries.end())
+			return std::nullopt;
+		return it->second.value;
+	}
+
+	void set(DynObject &obj, V value)
+	{
+		typename DynObject::Weak weak = obj.weak();
+		const void *id = weak.identity();
+		{
+			unique_lock_t<factory_mutex_t> lock(state_->mutex);
+			auto it = state_->entries.find(id);
+			if (it != state_->entries.end())
+			{
+				it->second.value = std::move(value);
+				return;
+			}
+		}
+
+		/* the finalizer runs with no lock held, and takes ours */
+		const auto finalizer = weak.finalize(
+			[state = std::weak_ptr<State>(state_), id](const DynObject &)
+			{
+				if (auto alive = state.lock())
+				{
+					unique_lock_t<factory_mutex_t> lock(alive->mutex);
+					alive->entries.erase(id);
+				}
+			});
+		bool raced = false;
+		{
+			unique_lock_t<factory_mutex_t> lock(state_->mutex);
+			auto it = state_->entries.find(id);
+			if (it == state_->entries.end())
+				state_->entries.emplace(id, Entry{std::move(value), weak, finalizer});
+			else
+			{
+				/* another set of obj got in first */
+				it->second.value = std::move(value);
+				raced = true;
+			}
+		}
+		if (raced)
+			weak.unfinalize(finalizer);
+	}
+
+	/* false if obj had no entry */
+	bool erase(const DynObject &obj)
+	{
+		const void *id = obj.identity();
+		std::optional<Entry> entry;
+		{
+			unique_lock_t<factory_mutex_t> lock(state_->mutex);
+			auto it = state_->entries.find(id);
+			if (!id || it == state_->entries.end())
+				return false;
+			entry.emplace(std::move(it->second));
+			state_->entries.erase(it);
+		}
+		entry->weak.unfinalize(entry->finalizer);
+		return true;
+	}
+
+	/**
+	 * obj's value, computed by compute(obj) and kept on the first call.
+	 * compute runs without the map locked, two threads asking for the
+	 * same object at once may both compute it
+	 */
+	template <typename F>
+	V memo(DynObject &obj, F &&compute)
+	{
+		if (auto value = get(obj))
+			return *std::move(value);
+		V value = std::invoke(std::forward<F>(compute), obj);
+		set(obj, value);
+		return value;
+	}
+
+	size_t size() const
+	{
+		unique_lock_t<factory_mutex_t> lock(state_->mutex);
+		return state_->entries.size();
+	}
+
+private:
+	struct Entry
+	{
+		V value;
+		typename DynObject::Weak weak;
+		typename DynObject::Subscription finalizer = 0;
+	};
+
+	/* shared with the finalizers, which may outlive the map */
+	struct State
+	{
+		factory_mutex_t mutex;
+		std::unordered_map<const void *, Entry> entries;
+	};
+
+	std::shared_ptr<State> state_;
+};
 } /* namespace dynobj */
 } /* namespace dog0752 */
 
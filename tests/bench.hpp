@@ -0,0 +1,620 @@
+/**
+ * COPYRIGHT 2025 dog0752
+ * this file is licensed under the dog0752-license-⑨.⑨
+ *
+ * tiny benchmark harness shared by the tests/bench_*.cpp programs.
+ *
+ * every benchmark program is a single translation unit that includes this
+ * header exactly once (it replaces the global operator new/delete to count
+ * allocations, so it can't go into more than one TU of the same program).
+ *
+ * each case is run as a few warmup batches followed by a number of timed
+ * batches. a batch size is calibrated so one batch takes roughly
+ * --min-batch-ms, and the per-batch ns/op values are what the percentiles
+ * are computed over.
+ *
+ * command line:
+ *   --filter=<substring>   only run cases whose name contains it
+ *   --reps=<n>             timed batches per case (default 15)
+ *   --warmup=<n>           untimed batches per case (default 3)
+ *   --min-batch-ms=<ms>    target wall time of one batch (default 10)
+ *   --format=text|json|csv output format (default text)
+ *   --perf                 also collect hardware counters, see
+ *                          perf_counters.hpp (single threaded cases only)
+ */
+
+#ifndef DYNOBJECT_BENCH_HPP
+#define DYNOBJECT_BENCH_HPP
+
+#include <algorithm>
+#include <barrier>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "perf_counters.hpp"
+
+namespace dog0752
+{
+namespace bench
+{
+
+/**
+ * per thread allocation counters. thread local so counting doesn't add an
+ * atomic to every allocation of the code being measured
+ */
+struct AllocCounter
+{
+	uint64_t count = 0;
+	uint64_t bytes = 0;
+};
+
+inline AllocCounter &allocCounter()
+{
+	thread_local AllocCounter counter;
+	return counter;
+}
+
+} /* namespace bench */
+} /* namespace dog0752 */
+
+/* --- global allocation hooks (one definition per benchmark program) --- */
+
+void *operator new(std::size_t size)
+{
+	auto &c = dog0752::bench::allocCounter();
+	c.count++;
+	c.bytes += size;
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+	return ::operator new(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t align)
+{
+	auto &c = dog0752::bench::allocCounter();
+	c.count++;
+	c.bytes += size;
+	const std::size_t a = static_cast<std::size_t>(align);
+	/* aligned_alloc wants the size to be a multiple of the alignment */
+	if (void *p = std::aligned_alloc(a, (size + a - 1) / a * a))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t align)
+{
+	return ::operator new(size, align);
+}
+
+/**
+ * gcc can't tell these frees pair with the replaced operator new above and
+ * warns at every inlined delete
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+void operator delete[](void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+void operator delete(void *p, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace dog0752
+{
+namespace bench
+{
+
+/* keeps the optimizer from deleting a computation whose result is unused */
+template <typename T>
+inline void doNotOptimize(const T &value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline void clobberMemory()
+{
+	asm volatile("" : : : "memory");
+}
+
+enum class Format
+{
+	text,
+	json,
+	csv
+};
+
+struct Options
+{
+	std::string filter;
+	int reps = 15;
+	int warmup = 3;
+	double min_batch_ms = 10.0;
+	Format format = Format::text;
+	bool perf = false;
+};
+
+struct Result
+{
+	std::string name;
+	int threads = 1;
+	uint64_t iterations = 0; /* operations per timed batch (all threads) */
+	std::vector<double> ns_per_op; /* one sample per timed batch */
+	double allocs_per_op = 0;
+	double bytes_per_op = 0;
+	PerfSample perf; /* per op, empty unless --perf and available */
+
+	double percentile(double p) const
+	{
+		if (ns_per_op.empty())
+			return 0;
+		std::vector<double> sorted = ns_per_op;
+		std::sort(sorted.begin(), sorted.end());
+		/* nearest rank, good enough for a couple dozen samples */
+		const double rank = p / 100.0 * static_cast<double>(sorted.size() - 1);
+		return sorted[static_cast<size_t>(std::lround(rank))];
+	}
+
+	double mean() const
+	{
+		double sum = 0;
+		for (double v : ns_per_op)
+			sum += v;
+		return ns_per_op.empty() ? 0 : sum / ns_per_op.size();
+	}
+
+	double stddev() const
+	{
+		if (ns_per_op.size() < 2)
+			return 0;
+		const double m = mean();
+		double acc = 0;
+		for (double v : ns_per_op)
+			acc += (v - m) * (v - m);
+		return std::sqrt(acc / (ns_per_op.size() - 1));
+	}
+};
+
+class Runner
+{
+public:
+	Runner(int argc, char **argv, std::string_view suite) : suite_(suite)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string_view arg = argv[i];
+			if (auto v = value(arg, "--filter="))
+				options_.filter = *v;
+			else if (auto v = value(arg, "--reps="))
+				options_.reps = std::max(1, std::atoi(v->data()));
+			else if (auto v = value(arg, "--warmup="))
+				options_.warmup = std::max(0, std::atoi(v->data()));
+			else if (auto v = value(arg, "--min-batch-ms="))
+				options_.min_batch_ms = std::max(0.01, std::atof(v->data()));
+			else if (arg == "--perf")
+				options_.perf = true;
+			else if (auto v = value(arg, "--format="))
+			{
+				if (*v == "json")
+					options_.format = Format::json;
+				else if (*v == "csv")
+					options_.format = Format::csv;
+				else
+					options_.format = Format::text;
+			}
+			else
+			{
+				std::cerr << "unknown argument: " << arg << "\n";
+				std::exit(2);
+			}
+		}
+
+		if (options_.perf)
+		{
+			perf_.emplace();
+			if (!perf_->available())
+			{
+				std::cerr << "--perf: hardware counters are not available "
+							 "here, reporting wall time only\n";
+				perf_.reset();
+			}
+		}
+	}
+
+	const Options &options() const
+	{
+		return options_;
+	}
+
+	bool enabled(std::string_view name) const
+	{
+		return options_.filter.empty() ||
+			   name.find(options_.filter) != std::string_view::npos;
+	}
+
+	/**
+	 * runs body(iterations) repeatedly. body must perform exactly
+	 * `iterations` operations; everything it allocates is attributed to them
+	 */
+	template <typename F>
+	void run(std::string name, F &&body)
+	{
+		run(std::move(name), std::forward<F>(body), [](uint64_t) {});
+	}
+
+	/**
+	 * same as above, but setup(iterations) is called before every batch.
+	 * its time and allocations are not counted
+	 */
+	template <typename F, typename S>
+	void run(std::string name, F &&body, S &&setup)
+	{
+		if (!enabled(name))
+			return;
+
+		const uint64_t iters = calibrate(body, setup);
+		for (int i = 0; i < options_.warmup; ++i)
+		{
+			setup(iters);
+			body(iters);
+		}
+
+		Result result;
+		result.name = std::move(name);
+		result.iterations = iters;
+
+		AllocCounter &alloc = allocCounter();
+		uint64_t allocs = 0, bytes = 0;
+		PerfSample counters;
+		if (perf_)
+			counters.fill(0.0);
+		for (int i = 0; i < options_.reps; ++i)
+		{
+			setup(iters);
+			const AllocCounter before = alloc;
+			PerfSample perf_start;
+			if (perf_)
+				perf_start = perf_->read();
+			const auto start = clock::now();
+			body(iters);
+			const auto end = clock::now();
+			if (perf_)
+				accumulate(counters, PerfCounters::perOp(perf_start,
+														 perf_->read(), 1.0));
+			allocs += alloc.count - before.count;
+			bytes += alloc.bytes - before.bytes;
+			result.ns_per_op.push_back(nanoseconds(start, end) / iters);
+		}
+		const double total_ops = static_cast<double>(iters) * options_.reps;
+		result.allocs_per_op = allocs / total_ops;
+		result.bytes_per_op = bytes / total_ops;
+		for (auto &c : counters)
+		{
+			if (c)
+				*c /= total_ops;
+		}
+		result.perf = counters;
+		report(std::move(result));
+	}
+
+	/**
+	 * runs body(thread_index, iterations) on `threads` threads at once.
+	 * ns/op is wall time divided by the total number of operations over
+	 * all threads, so perfect scaling shows up as ns/op dropping with
+	 * the thread count. hardware counters only follow the thread that
+	 * opened them, so they're not collected here
+	 */
+	template <typename F>
+	void runThreads(std::string name, int threads, F &&body)
+	{
+		if (!enabled(name))
+			return;
+
+		const uint64_t iters =
+			calibrate([&](uint64_t n) { body(0, n); }, [](uint64_t) {});
+
+		Result result;
+		result.name = std::move(name);
+		result.threads = threads;
+		result.iterations = iters * threads;
+
+		std::vector<AllocCounter> deltas(threads);
+		std::vector<double> batch_ns;
+		const int batches = options_.warmup + options_.reps;
+		std::barrier sync(threads + 1);
+
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; ++t)
+		{
+			workers.emplace_back(
+				[&, t]
+				{
+					for (int b = 0; b < batches; ++b)
+					{
+						sync.arrive_and_wait(); /* batch start */
+						const AllocCounter before = allocCounter();
+						body(t, iters);
+						if (b >= options_.warmup)
+						{
+							deltas[t].count += allocCounter().count - before.count;
+							deltas[t].bytes += allocCounter().bytes - before.bytes;
+						}
+						sync.arrive_and_wait(); /* batch end */
+					}
+				});
+		}
+		for (int b = 0; b < batches; ++b)
+		{
+			sync.arrive_and_wait();
+			const auto start = clock::now();
+			sync.arrive_and_wait();
+			const auto end = clock::now();
+			if (b >= options_.warmup)
+				result.ns_per_op.push_back(nanoseconds(start, end) /
+										   result.iterations);
+		}
+		for (auto &w : workers)
+			w.join();
+
+		const double total_ops =
+			static_cast<double>(result.iterations) * options_.reps;
+		for (const auto &d : deltas)
+		{
+			result.allocs_per_op += d.count / total_ops;
+			result.bytes_per_op += d.bytes / total_ops;
+		}
+		report(std::move(result));
+	}
+
+	/* prints the collected results, returns the process exit code */
+	int finish()
+	{
+		switch (options_.format)
+		{
+		case Format::json:
+			printJSON();
+			break;
+		case Format::csv:
+			printCSV();
+			break;
+		case Format::text:
+			break; /* text rows are printed as they complete */
+		}
+		return 0;
+	}
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	static double nanoseconds(clock::time_point a, clock::time_point b)
+	{
+		return std::chrono::duration<double, std::nano>(b - a).count();
+	}
+
+	static std::optional<std::string_view> value(std::string_view arg,
+												 std::string_view prefix)
+	{
+		if (arg.substr(0, prefix.size()) == prefix)
+			return arg.substr(prefix.size());
+		return std::nullopt;
+	}
+
+	/* adds a counter delta to a running total, a missing read poisons it */
+	static void accumulate(PerfSample &total, const PerfSample &delta)
+	{
+		for (size_t i = 0; i < perf_event_count; ++i)
+		{
+			if (total[i] && delta[i])
+				*total[i] += *delta[i];
+			else
+				total[i].reset();
+		}
+	}
+
+	/* doubles the batch size until one batch takes min_batch_ms */
+	template <typename F, typename S>
+	uint64_t calibrate(F &&body, S &&setup)
+	{
+		const double target_ns = options_.min_batch_ms * 1e6;
+		uint64_t iters = 1;
+		for (;;)
+		{
+			setup(iters);
+			const auto start = clock::now();
+			body(iters);
+			const double ns = nanoseconds(start, clock::now());
+			if (ns >= target_ns || iters >= (uint64_t{1} << 40))
+				return iters;
+			/* jump close to the target once the timing is meaningful */
+			if (ns > 1e5)
+				return std::max<uint64_t>(
+					iters + 1, static_cast<uint64_t>(iters * target_ns / ns));
+			iters *= 2;
+		}
+	}
+
+	void report(Result result)
+	{
+		if (options_.format == Format::text)
+		{
+			if (results_.empty())
+			{
+				std::printf("%-44s %7s %10s %10s %10s %10s %9s %9s",
+							suite_.c_str(), "threads", "ns/op", "p50", "p90",
+							"p99", "allocs/op", "bytes/op");
+				if (perf_)
+					std::printf(" %8s %8s %8s %8s %8s %8s", "ins/op", "ipc",
+								"br-miss", "l1d-miss", "llc-miss", "dtlb-miss");
+				std::printf("\n");
+			}
+			std::printf("%-44s %7d %10.2f %10.2f %10.2f %10.2f %9.2f %9.1f",
+						result.name.c_str(), result.threads, result.mean(),
+						result.percentile(50), result.percentile(90),
+						result.percentile(99), result.allocs_per_op,
+						result.bytes_per_op);
+			if (perf_)
+			{
+				const PerfSample &c = result.perf;
+				for (const auto &v :
+					 {c[static_cast<size_t>(PerfEvent::instructions)],
+					  PerfCounters::ipc(c),
+					  c[static_cast<size_t>(PerfEvent::branch_misses)],
+					  c[static_cast<size_t>(PerfEvent::l1d_misses)],
+					  c[static_cast<size_t>(PerfEvent::llc_misses)],
+					  c[static_cast<size_t>(PerfEvent::dtlb_misses)]})
+				{
+					if (v)
+						std::printf(" %8.3f", *v);
+					else
+						std::printf(" %8s", "-");
+				}
+			}
+			std::printf("\n");
+			std::fflush(stdout);
+		}
+		results_.push_back(std::move(result));
+	}
+
+	static void printJSONString(std::string_view s)
+	{
+		std::putchar('"');
+		for (char c : s)
+		{
+			if (c == '"' || c == '\\')
+				std::putchar('\\');
+			std::putchar(c);
+		}
+		std::putchar('"');
+	}
+
+	void printJSON() const
+	{
+		std::printf("{\"suite\":");
+		printJSONString(suite_);
+		std::printf(",\"context\":{\"compiler\":");
+		printJSONString(__VERSION__);
+#ifdef DYNOBJECT_MULTITHREADED
+		std::printf(",\"multithreaded\":true");
+#else
+		std::printf(",\"multithreaded\":false");
+#endif
+		std::printf(",\"reps\":%d,\"warmup\":%d},\"benchmarks\":[",
+					options_.reps, options_.warmup);
+		for (size_t i = 0; i < results_.size(); ++i)
+		{
+			const Result &r = results_[i];
+			std::printf("%s\n{\"name\":", i ? "," : "");
+			printJSONString(r.name);
+			std::printf(",\"threads\":%d,\"iterations\":%llu,\"ns_per_op\":%.4f,"
+						"\"stddev\":%.4f,\"min\":%.4f,\"p50\":%.4f,\"p90\":%.4f,"
+						"\"p99\":%.4f,\"max\":%.4f,\"allocs_per_op\":%.4f,"
+						"\"bytes_per_op\":%.4f",
+						r.threads, static_cast<unsigned long long>(r.iterations),
+						r.mean(), r.stddev(), r.percentile(0),
+						r.percentile(50), r.percentile(90), r.percentile(99),
+						r.percentile(100), r.allocs_per_op, r.bytes_per_op);
+			/* only the counters that were actually read show up */
+			bool any = false;
+			for (size_t e = 0; e < perf_event_count; ++e)
+			{
+				if (!r.perf[e])
+					continue;
+				std::printf("%s\"%s\":%.4f", any ? "," : ",\"perf\":{",
+							perfEventName(static_cast<PerfEvent>(e)), *r.perf[e]);
+				any = true;
+			}
+			if (auto ipc = PerfCounters::ipc(r.perf))
+				std::printf(",\"ipc\":%.4f", *ipc);
+			std::printf(any ? "}}" : "}");
+		}
+		std::printf("\n]}\n");
+	}
+
+	void printCSV() const
+	{
+		std::printf("suite,name,threads,iterations,ns_per_op,stddev,min,p50,"
+					"p90,p99,max,allocs_per_op,bytes_per_op");
+		/* counter columns are always there so files stay diffable */
+		for (size_t e = 0; e < perf_event_count; ++e)
+			std::printf(",%s", perfEventName(static_cast<PerfEvent>(e)));
+		std::printf(",ipc\n");
+		for (const Result &r : results_)
+		{
+			std::printf("%s,%s,%d,%llu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,"
+						"%.4f,%.4f",
+						suite_.c_str(), r.name.c_str(), r.threads,
+						static_cast<unsigned long long>(r.iterations), r.mean(),
+						r.stddev(), r.percentile(0), r.percentile(50),
+						r.percentile(90), r.percentile(99), r.percentile(100),
+						r.allocs_per_op, r.bytes_per_op);
+			for (size_t e = 0; e < perf_event_count; ++e)
+			{
+				if (r.perf[e])
+					std::printf(",%.4f", *r.perf[e]);
+				else
+					std::printf(",");
+			}
+			if (auto ipc = PerfCounters::ipc(r.perf))
+				std::printf(",%.4f\n", *ipc);
+			else
+				std::printf(",\n");
+		}
+	}
+
+	std::string suite_;
+	Options options_;
+	std::optional<PerfCounters> perf_;
+	std::vector<Result> results_;
+};
+
+} /* namespace bench */
+} /* namespace dog0752 */
+
+#endif /* #ifndef DYNOBJECT_BENCH_HPP */
@@ -0,0 +1,91 @@
+/**
+ * method calls through DynObject::callAsync on one thread. the call cases
+ * await callAsync in a loop inside one task: on a plain Method (next to
+ * call itself) and on an AsyncMethod that finishes without suspending.
+ * io/in_flight spawns one task per call, each waiting on its own fake I/O
+ * event until all n are suspended, then completes them in reverse order
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using DynObject = Factory::DynObject;
+using dog0752::dynobj::AsyncEvent;
+using dog0752::dynobj::Executor;
+using dog0752::dynobj::Task;
+
+/* awaits obj.callAsync(name) n times */
+static Task<> callLoop(DynObject &obj, Factory::Identifier name, uint64_t n)
+{
+	for (uint64_t i = 0; i < n; ++i)
+		doNotOptimize(co_await obj.callAsync<int>(name));
+}
+
+static Task<> callOne(DynObject &obj, Factory::Identifier name, AsyncEvent &io)
+{
+	DynObject::Args args{std::any(&io)};
+	doNotOptimize(co_await obj.callAsync<int>(name, std::move(args)));
+}
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "async");
+	Factory factory;
+	Executor executor;
+
+	auto obj = factory.createObject();
+	const auto id_sync = factory.intern("sync");
+	const auto id_ready = factory.intern("ready");
+	const auto id_read = factory.intern("read");
+	obj->set(factory, id_sync,
+			 DynObject::Method([](DynObject &, DynObject::Args) -> std::any { return 1; }));
+	obj->set(factory, id_ready,
+			 DynObject::AsyncMethod([](DynObject &, DynObject::Args) -> Task<std::any>
+									{ co_return 1; }));
+	obj->set(factory, id_read,
+			 DynObject::AsyncMethod(
+				 [](DynObject &, DynObject::Args args) -> Task<std::any>
+				 {
+					 co_await *std::any_cast<AsyncEvent *>(args[0]);
+					 co_return 1;
+				 }));
+
+	runner.run("call/sync",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->call<int>(id_sync));
+			   });
+	runner.run("callAsync/sync",
+			   [&](uint64_t n)
+			   {
+				   executor.spawn(callLoop(*obj, id_sync, n));
+				   executor.run();
+			   });
+	runner.run("callAsync/ready",
+			   [&](uint64_t n)
+			   {
+				   executor.spawn(callLoop(*obj, id_ready, n));
+				   executor.run();
+			   });
+
+	std::vector<std::unique_ptr<AsyncEvent>> io;
+	runner.run("io/in_flight",
+			   [&](uint64_t n)
+			   {
+				   io.clear();
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   io.push_back(std::make_unique<AsyncEvent>(executor));
+					   executor.spawn(callOne(*obj, id_read, *io.back()));
+				   }
+				   executor.poll();
+				   for (uint64_t i = n; i-- > 0;)
+					   io[i]->set();
+				   executor.run();
+			   });
+
+	return runner.finish();
+}
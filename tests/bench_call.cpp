@@ -0,0 +1,170 @@
+/**
+ * method calls through DynObject::call with 0 to 4 arguments, plus the
+ * old counter increment loop (a method that reads and rewrites a property
+ * on every call). the accessor cases compute a property through a getter,
+ * once as a Method called with call and once as an accessor read with get.
+ * the native cases call the same sum as a native method, on the object
+ * itself and on a prototype shared by 1024 objects (next to a Method on
+ * such a prototype).
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using DynObject = Factory::DynObject;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "call");
+	Factory factory;
+
+	auto obj = factory.createObject();
+	const Factory::Identifier id_sum = factory.intern("sum");
+	obj->set(factory, id_sum,
+			 DynObject::Method(
+				 [](DynObject &, DynObject::Args args) -> std::any
+				 {
+					 int total = 0;
+					 for (const auto &a : args)
+						 total += std::any_cast<int>(a);
+					 return total;
+				 }));
+
+	runner.run("call/args=0",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->call<int>(id_sum));
+			   });
+	runner.run("call/args=1",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->call<int>(id_sum, {1}));
+			   });
+	runner.run("call/args=2",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->call<int>(id_sum, {1, 2}));
+			   });
+	runner.run("call/args=3",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->call<int>(id_sum, {1, 2, 3}));
+			   });
+	runner.run("call/args=4",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->call<int>(id_sum, {1, 2, 3, 4}));
+			   });
+
+	/* inc() { counter += 1; return counter; } */
+	const Factory::Identifier id_counter = factory.intern("counter");
+	const Factory::Identifier id_inc = factory.intern("inc");
+	obj->set(factory, id_counter, int(0));
+	obj->set(factory, id_inc,
+			 DynObject::Method(
+				 [&](DynObject &self, DynObject::Args) -> std::any
+				 {
+					 auto val = self.get<int>(id_counter).value_or(0);
+					 val++;
+					 self.set(factory, id_counter, val);
+					 return val;
+				 }));
+
+	runner.run("call/counter_inc",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->call<int>(id_inc));
+			   });
+
+	/* area = width * height, computed on every read */
+	static Factory::Identifier id_width, id_height;
+	id_width = factory.intern("width");
+	id_height = factory.intern("height");
+	const Factory::Identifier id_area = factory.intern("area");
+	const Factory::Identifier id_area_method = factory.intern("areaMethod");
+	obj->set(factory, id_width, 3);
+	obj->set(factory, id_height, 4);
+	obj->set(factory, id_area_method,
+			 DynObject::Method(
+				 [](DynObject &self, DynObject::Args) -> std::any
+				 {
+					 return self.get<int>(id_width).value_or(0) *
+							self.get<int>(id_height).value_or(0);
+				 }));
+	obj->defineAccessor(factory, id_area,
+						+[](const DynObject &self)
+						{
+							return self.get<int>(id_width).value_or(0) *
+								   self.get<int>(id_height).value_or(0);
+						});
+
+	runner.run("accessor/as_method",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->call<int>(id_area_method));
+			   });
+	runner.run("accessor/get",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->get<int>(id_area));
+			   });
+
+	const Factory::Identifier id_native = factory.intern("nativeSum");
+	obj->defineMethod(factory, id_native,
+					  [](DynObject &, void *, std::span<std::any> args) -> std::any
+					  {
+						  int total = 0;
+						  for (const auto &a : args)
+							  total += std::any_cast<int>(a);
+						  return total;
+					  });
+	runner.run("native/args=0",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->call<int>(id_native));
+			   });
+	runner.run("native/args=2",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(obj->call<int>(id_native, {1, 2}));
+			   });
+
+	std::shared_ptr<DynObject> proto = factory.createObject();
+	proto->set(factory, id_sum, obj->get<DynObject::Method>(id_sum).value());
+	proto->defineMethod(factory, id_native,
+						[](DynObject &, void *, std::span<std::any>) -> std::any
+						{ return 0; });
+	std::vector<std::unique_ptr<DynObject>> shared;
+	for (int i = 0; i < 1024; ++i)
+	{
+		shared.push_back(factory.createObject());
+		shared.back()->set(factory, id_counter, i);
+		shared.back()->prototype = proto;
+	}
+	runner.run("proto/method",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(shared[i & 1023]->call<int>(id_sum));
+			   });
+	runner.run("proto/native",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(shared[i & 1023]->call<int>(id_native));
+			   });
+
+	return runner.finish();
+}
@@ -0,0 +1,68 @@
+/**
+ * hash consing of small frozen objects like {"unit":"ms","scale":1}.
+ * make/plain builds and freezes one, make/canonical also looks it up
+ * among the canonical objects (there are 8 variants, all kept) and
+ * drops the duplicate. equals compares two of them with the same
+ * content and then two different ones, as separate objects (plain) and
+ * as canonical ones, where it's a pointer compare
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using DynObject = Factory::DynObject;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "canonical");
+	Factory factory;
+
+	const auto unit = factory.intern("unit");
+	const auto scale = factory.intern("scale");
+	const auto make = [&](uint64_t i)
+	{
+		std::shared_ptr<DynObject> obj = factory.createObject();
+		obj->set(factory, unit, std::string(i % 2 ? "ms" : "us"));
+		obj->set(factory, scale, int(i % 8));
+		obj->freeze();
+		return obj;
+	};
+
+	std::vector<std::shared_ptr<DynObject>> kept;
+	for (uint64_t i = 0; i < 8; ++i)
+		kept.push_back(factory.canonical(make(i)).value());
+
+	runner.run("make/plain",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(make(i));
+			   });
+	runner.run("make/canonical",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(factory.canonical(make(i)));
+			   });
+
+	auto a = make(1), b = make(1), c = make(2);
+	const auto ca = factory.canonical(a).value(), cb = factory.canonical(b).value(),
+			   cc = factory.canonical(c).value();
+	auto pa = make(1), pb = make(1), pc = make(2);
+	runner.run("equals/plain",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(pa->equals(*pb) + pa->equals(*pc));
+			   });
+	runner.run("equals/canonical",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(ca->equals(*cb) + ca->equals(*cc));
+			   });
+
+	return runner.finish();
+}
@@ -0,0 +1,67 @@
+/**
+ * the handle table's collector. 65536 objects in rings of 4 (each links
+ * to the next through a Handle), one ring in 16 rooted. collect is one
+ * full cycle per op: marking the 4096 reachable objects and sweeping all
+ * of them, nothing to free. step is one collectStep with the default
+ * budget, i.e. the pause a service would see. garbage is the steady
+ * state of making garbage and collecting it: every op creates an object
+ * (in unreachable rings of 4) and runs a collectStep(64)
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using Handle = Factory::Handle;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "gc");
+	Factory factory;
+
+	const auto next = factory.intern("next");
+	constexpr size_t count = 65536;
+	const auto ring = [&](bool rooted)
+	{
+		Handle first = factory.createHandle(), prev = first;
+		for (int i = 1; i < 4; ++i)
+		{
+			Handle h = factory.createHandle();
+			factory.resolve(prev)->set(factory, next, h);
+			factory.unroot(h);
+			prev = h;
+		}
+		factory.resolve(prev)->set(factory, next, first);
+		if (!rooted)
+			factory.unroot(first);
+	};
+	for (size_t i = 0; i < count / 4; ++i)
+		ring(i % 16 == 0);
+	factory.collect();
+
+	runner.run("collect",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   factory.collect();
+			   });
+	runner.run("step",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(factory.collectStep());
+			   });
+	runner.run("garbage",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   if (i % 4 == 0)
+						   ring(false);
+					   factory.collectStep(64);
+				   }
+			   });
+
+	return runner.finish();
+}
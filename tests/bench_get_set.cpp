@@ -0,0 +1,157 @@
+/**
+ * own property get/set hits at varying shape depths.
+ *
+ * an object with `depth` properties has a shape chain of the same length.
+ * "first" looks up the property added first (the longest walk up the chain),
+ * "last" the one added last (found on the first step). the element cases
+ * are the same kind of access on the indexed backing store. the observed
+ * cases set with one observer attached, immediately and inside a Batch.
+ * x4 sets four properties one by one or in a single transaction
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "get_set");
+	Factory factory;
+
+	for (int depth : {1, 4, 16, 64})
+	{
+		auto obj = factory.createObject();
+		std::vector<Factory::Identifier> keys;
+		for (int i = 0; i < depth; ++i)
+		{
+			keys.push_back(factory.intern("p" + std::to_string(i)));
+			obj->set(factory, keys.back(), int(i));
+		}
+
+		const std::string suffix = "/depth=" + std::to_string(depth);
+		const Factory::Identifier first = keys.front();
+		const Factory::Identifier last = keys.back();
+
+		runner.run("get_int/first" + suffix,
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(obj->get<int>(first));
+				   });
+		runner.run("get_int/last" + suffix,
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(obj->get<int>(last));
+				   });
+		runner.run("set_int/first" + suffix,
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   obj->set(factory, first, static_cast<int>(i));
+				   });
+		runner.run("set_int/last" + suffix,
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   obj->set(factory, last, static_cast<int>(i));
+				   });
+	}
+
+	/* a heap allocated value type, to show the std::any boxing cost */
+	{
+		auto obj = factory.createObject();
+		auto key = factory.intern("name");
+		obj->set(factory, key, std::string("a string too long for sso!!"));
+		runner.run("get_string",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(obj->get<std::string>(key));
+				   });
+		const std::string value = "another string too long for sso";
+		runner.run("set_string",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   obj->set(factory, key, value);
+				   });
+	}
+
+	/* indexed elements, packed ints: no shape walk at all */
+	{
+		auto obj = factory.createObject();
+		for (int i = 0; i < 1024; ++i)
+			obj->setElement(i, i);
+		runner.run("get_element/packed_int",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(obj->getElement<int>(i & 1023));
+				   });
+		runner.run("set_element/packed_int",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   obj->setElement(i & 1023, static_cast<int>(i));
+				   });
+	}
+
+	/* an observer that only counts what it's told */
+	{
+		auto obj = factory.createObject();
+		auto key = factory.intern("watched");
+		obj->set(factory, key, 0);
+		uint64_t seen = 0;
+		obj->observe(key, [&](Factory::DynObject &, auto keys)
+					 { seen += keys.size(); });
+		runner.run("set_int/observed",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   obj->set(factory, key, static_cast<int>(i));
+				   });
+		runner.run("set_int/observed_batch",
+				   [&](uint64_t n)
+				   {
+					   Factory::DynObject::Batch batch;
+					   for (uint64_t i = 0; i < n; ++i)
+						   obj->set(factory, key, static_cast<int>(i));
+				   });
+		doNotOptimize(seen);
+	}
+
+	{
+		auto obj = factory.createObject();
+		Factory::Identifier keys[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			keys[i] = factory.intern("t" + std::to_string(i));
+			obj->set(factory, keys[i], 0);
+		}
+		runner.run("set_int/x4",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+					   {
+						   for (auto key : keys)
+							   obj->set(factory, key, static_cast<int>(i));
+					   }
+				   });
+		runner.run("transaction/x4",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+					   {
+						   auto tx = obj->transaction(factory);
+						   for (auto key : keys)
+							   tx.set(key, static_cast<int>(i));
+						   tx.commit();
+					   }
+				   });
+	}
+
+	return runner.finish();
+}
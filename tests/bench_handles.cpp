@@ -0,0 +1,84 @@
+/**
+ * object references as property values: a list of 4096 objects linked
+ * through "next", once as std::shared_ptr<DynObject> and once as
+ * ObjectFactory::Handle. link sets next on every node (the handle fits
+ * in std::any without allocating, the shared_ptr doesn't), walk follows
+ * the list from the head, resolve looks handles up in the table
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using DynObject = Factory::DynObject;
+using Handle = Factory::Handle;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "handles");
+	Factory factory;
+
+	const auto next = factory.intern("next");
+	constexpr size_t count = 4096;
+
+	std::vector<std::shared_ptr<DynObject>> shared;
+	std::vector<Handle> handles;
+	for (size_t i = 0; i < count; ++i)
+	{
+		shared.push_back(factory.createObject());
+		handles.push_back(factory.createHandle());
+	}
+
+	runner.run("link/shared_ptr",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   const size_t at = i % (count - 1);
+					   shared[at]->set(factory, next, shared[at + 1]);
+				   }
+			   });
+	runner.run("link/handle",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   const size_t at = i % (count - 1);
+					   factory.resolve(handles[at])->set(factory, next,
+														 handles[at + 1]);
+				   }
+			   });
+
+	runner.run("walk/shared_ptr",
+			   [&](uint64_t n)
+			   {
+				   const DynObject *node = shared[0].get();
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   auto p = node->get<std::shared_ptr<DynObject>>(next);
+					   node = p.has_value() ? p->get() : shared[0].get();
+					   doNotOptimize(node);
+				   }
+			   });
+	runner.run("walk/handle",
+			   [&](uint64_t n)
+			   {
+				   const DynObject *node = factory.resolve(handles[0]);
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   auto h = node->get<Handle>(next);
+					   node = factory.resolve(h.value_or(handles[0]));
+					   doNotOptimize(node);
+				   }
+			   });
+
+	runner.run("resolve",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(factory.resolve(handles[i % count]));
+			   });
+
+	return runner.finish();
+}
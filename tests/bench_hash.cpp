@@ -0,0 +1,100 @@
+/**
+ * content hash and equality of objects with 8 properties (ints, doubles
+ * and a string). equals/same_shape compares two equal objects of one
+ * shape, equals/mixed_shape the same content added in reverse order, and
+ * equals/differ a pair whose cached hashes already tell them apart.
+ * hash/cached is a hash that's kept, hash/after_set one recomputed after
+ * every set. dedup looks 1024 objects up in a set of their equals
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+#include <unordered_set>
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using DynObject = Factory::DynObject;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "hash");
+	Factory factory;
+
+	std::vector<Factory::Identifier> keys;
+	for (const char *name : {"a", "b", "c", "d", "e", "f", "g", "name"})
+		keys.push_back(factory.intern(name));
+	const auto make = [&](int seed, bool reversed)
+	{
+		std::unique_ptr<DynObject> obj = factory.createObject();
+		for (size_t k = 0; k < keys.size(); ++k)
+		{
+			const size_t i = reversed ? keys.size() - 1 - k : k;
+			if (i == 7)
+				obj->set(factory, keys[i], "object " + std::to_string(seed));
+			else if (i % 2)
+				obj->set(factory, keys[i], seed * 0.5 + double(i));
+			else
+				obj->set(factory, keys[i], seed + int(i));
+		}
+		return obj;
+	};
+
+	auto a = make(1, false), b = make(1, false), c = make(1, true), d = make(2, false);
+	runner.run("equals/same_shape",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(a->equals(*b));
+			   });
+	runner.run("equals/mixed_shape",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(a->equals(*c));
+			   });
+	a->hash();
+	d->hash();
+	runner.run("equals/differ",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(a->equals(*d));
+			   });
+
+	runner.run("hash/cached",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(a->hash());
+			   });
+	runner.run("hash/after_set",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   b->set(factory, keys[0], int(i));
+					   doNotOptimize(b->hash());
+				   }
+			   });
+
+	std::vector<std::unique_ptr<DynObject>> objects, copies;
+	std::unordered_set<const DynObject *, DynObject::ContentHash, DynObject::ContentEqual>
+		seen;
+	for (int i = 0; i < 1024; ++i)
+	{
+		objects.push_back(make(i, false));
+		copies.push_back(make(i, i % 2));
+		seen.insert(objects.back().get());
+	}
+	for (auto &copy : copies)
+		copy->hash();
+	runner.run("dedup/find",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(seen.find(copies[i & 1023].get()));
+			   });
+
+	return runner.finish();
+}
@@ -0,0 +1,104 @@
+/**
+ * finding objects by a property value among 16384 objects: a linear scan
+ * of get calls against a HashIndex and an OrderedIndex (find returns the
+ * ~164 objects with one "group" value, range the ~1638 with a group in
+ * [0, 10)). the set cases rewrite group on objects that are and aren't in
+ * an index, which is what keeping the index current costs
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using DynObject = Factory::DynObject;
+using dog0752::dynobj::HashIndex;
+using dog0752::dynobj::OrderedIndex;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "index");
+	Factory factory;
+
+	const auto id = factory.intern("id");
+	const auto group = factory.intern("group");
+	constexpr int count = 16384;
+	std::vector<std::unique_ptr<DynObject>> objects;
+	for (int i = 0; i < count; ++i)
+	{
+		objects.push_back(factory.createObject());
+		objects.back()->set(factory, id, i);
+		objects.back()->set(factory, group, i % 100);
+	}
+
+	runner.run("find/scan",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   std::vector<DynObject *> found;
+					   for (auto &o : objects)
+						   if (o->get<int>(group).value_or(-1) == int(i % 100))
+							   found.push_back(o.get());
+					   doNotOptimize(found);
+				   }
+			   });
+	runner.run("range/scan",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   std::vector<DynObject *> found;
+					   for (auto &o : objects)
+						   if (o->get<int>(group).value_or(-1) < 10)
+							   found.push_back(o.get());
+					   doNotOptimize(found);
+				   }
+			   });
+
+	runner.run("set/unindexed",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   objects[i % count]->set(factory, group, int(i % 100));
+			   });
+
+	{
+		HashIndex<int> index(group, objects);
+		runner.run("find/hash",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(index.find(int(i % 100)));
+				   });
+		runner.run("set/hash",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   objects[i % count]->set(factory, group, int(i % 100));
+				   });
+	}
+	{
+		OrderedIndex<int> index(group, objects);
+		runner.run("find/ordered",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(index.find(int(i % 100)));
+				   });
+		runner.run("range/ordered",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(index.range(0, 10));
+				   });
+		runner.run("set/ordered",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   objects[i % count]->set(factory, group, int(i % 100));
+				   });
+	}
+
+	return runner.finish();
+}
@@ -0,0 +1,57 @@
+/**
+ * string interning: lookups of already interned strings (hit) and of new
+ * strings (miss, which also grows the table).
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "intern");
+
+	{
+		Factory factory;
+		std::vector<std::string> names;
+		for (int i = 0; i < 1024; ++i)
+		{
+			names.push_back("identifier_" + std::to_string(i));
+			factory.intern(names.back());
+		}
+		runner.run("intern/hit",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(factory.intern(names[i & 1023]));
+				   });
+	}
+
+	{
+		/**
+		 * every batch interns n strings nobody has seen, into a fresh
+		 * factory. generating the strings and swapping the factory is done
+		 * in the untimed setup step
+		 */
+		std::unique_ptr<Factory> factory;
+		std::vector<std::string> names;
+		runner.run(
+			"intern/miss",
+			[&](uint64_t n)
+			{
+				for (uint64_t i = 0; i < n; ++i)
+					doNotOptimize(factory->intern(names[i]));
+			},
+			[&](uint64_t n)
+			{
+				factory = std::make_unique<Factory>();
+				while (names.size() < n)
+					names.push_back("fresh_identifier_" +
+									std::to_string(names.size()));
+			});
+	}
+
+	return runner.finish();
+}
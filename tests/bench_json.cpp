@@ -0,0 +1,146 @@
+/**
+ * toJSON on a small (4 properties) and a large (256 properties) object,
+ * with a mix of ints, doubles and strings. the factory also holds a pile
+ * of unrelated identifiers, like a real program would. the msgpack and
+ * cbor cases encode the same objects into a reused buffer. the batch
+ * cases turn 1000 small objects into one JSON string or one arrow stream.
+ * the delta cases change one property of the large object and encode
+ * just that change.
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+
+static std::unique_ptr<Factory::DynObject> build(Factory &factory,
+												 const std::string &prefix,
+												 int props)
+{
+	auto obj = factory.createObject();
+	for (int i = 0; i < props; ++i)
+	{
+		auto key = factory.intern(prefix + std::to_string(i));
+		switch (i % 3)
+		{
+		case 0:
+			obj->set(factory, key, i);
+			break;
+		case 1:
+			obj->set(factory, key, i * 0.5);
+			break;
+		default:
+			obj->set(factory, key, std::string("value ") + std::to_string(i));
+		}
+	}
+	return obj;
+}
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "json");
+	Factory factory;
+
+	for (int i = 0; i < 1024; ++i)
+		factory.intern("unrelated" + std::to_string(i));
+
+	auto small = build(factory, "s", 4);
+	auto large = build(factory, "l", 256);
+
+	runner.run("toJSON/small",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(small->toJSON(factory));
+			   });
+	runner.run("toJSON/large",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(large->toJSON(factory));
+			   });
+
+	std::vector<uint8_t> buf;
+	for (auto [name, obj] : {std::pair{"small", small.get()},
+							 std::pair{"large", large.get()}})
+	{
+		runner.run(std::string("msgpack/") + name,
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+					   {
+						   buf.clear();
+						   doNotOptimize(
+							   dog0752::dynobj::MsgPack::encode(factory, *obj, buf));
+					   }
+				   });
+		runner.run(std::string("cbor/") + name,
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+					   {
+						   buf.clear();
+						   doNotOptimize(
+							   dog0752::dynobj::Cbor::encode(factory, *obj, buf));
+					   }
+				   });
+	}
+
+	std::vector<std::unique_ptr<Factory::DynObject>> rows;
+	std::vector<const Factory::DynObject *> batch;
+	for (int i = 0; i < 1000; ++i)
+	{
+		rows.push_back(build(factory, "s", 4));
+		batch.push_back(rows.back().get());
+	}
+	std::string text;
+	runner.run("batch/json",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   text.clear();
+					   for (const auto *obj : batch)
+						   obj->appendJSON(factory, text);
+					   doNotOptimize(text);
+				   }
+			   });
+	runner.run("batch/arrow",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   auto batches =
+						   dog0752::dynobj::ArrowBatch::fromObjects(factory, batch);
+					   doNotOptimize(batches->front().stream());
+				   }
+			   });
+
+	large->trackChanges();
+	const auto changed = factory.intern("l0");
+	int counter = 0;
+	runner.run("delta/json",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   large->set(factory, changed, counter++);
+					   doNotOptimize(
+						   large->deltaJSON(factory, large->checkpoint()));
+				   }
+			   });
+	runner.run("delta/msgpack",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   large->set(factory, changed, counter++);
+					   buf.clear();
+					   doNotOptimize(dog0752::dynobj::MsgPack::encodeDelta(
+						   factory, *large, large->checkpoint(), buf));
+				   }
+			   });
+
+	return runner.finish();
+}
@@ -0,0 +1,86 @@
+/**
+ * short lived objects: every op makes an object with three properties
+ * (one a string) and drops it again. handle is createHandle & destroy,
+ * one object at a time from the objects resource; young is createYoung
+ * with an evacuate every 1024 objects, where 1 in 32 is still rooted and
+ * gets promoted (and destroyed afterwards, so it's the same steady state).
+ * young_finalized is young with a finalizer on every object that calls
+ * back into the factory (createYoung and destroy) while evacuate frees it
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using Handle = Factory::Handle;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "nursery");
+	Factory factory;
+
+	const auto x = factory.intern("x");
+	const auto y = factory.intern("y");
+	const auto name = factory.intern("name");
+	const auto fill = [&](Handle h, uint64_t i)
+	{
+		Factory::DynObject *obj = factory.resolve(h);
+		obj->set(factory, x, int(i));
+		obj->set(factory, y, double(i));
+		obj->set(factory, name, std::string("object name over sso"));
+	};
+
+	runner.run("short_lived/handle",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   Handle h = factory.createHandle();
+					   fill(h, i);
+					   doNotOptimize(h);
+					   factory.destroy(h);
+				   }
+			   });
+
+	std::vector<Handle> kept;
+	runner.run("short_lived/young",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   Handle h = factory.createYoung();
+					   fill(h, i);
+					   doNotOptimize(h);
+					   if (i % 32 == 0)
+						   kept.push_back(h);
+					   else
+						   factory.unroot(h);
+					   if (i % 1024 == 1023)
+					   {
+						   factory.evacuate();
+						   for (Handle k : kept)
+							   factory.destroy(k);
+						   kept.clear();
+					   }
+				   }
+			   });
+
+	runner.run("short_lived/young_finalized",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   Handle h = factory.createYoung();
+					   fill(h, i);
+					   factory.resolve(h)->weak().finalize(
+						   [&](const Factory::DynObject &)
+						   { factory.destroy(factory.createYoung()); });
+					   factory.unroot(h);
+					   if (i % 1024 == 1023)
+						   factory.evacuate();
+				   }
+			   });
+
+	return runner.finish();
+}
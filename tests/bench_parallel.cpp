@@ -0,0 +1,99 @@
+/**
+ * recomputing total = price * qty on 65536 objects of 4 shapes (shuffled),
+ * per object op. "loop" is the plain get/set loop, "transform" the same
+ * through Parallel::transform with 0 to 3 helper threads (the helpers only
+ * exist with -DDYNOBJECT_MULTITHREADED -pthread), and reduce sums price
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+#include <random>
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using DynObject = Factory::DynObject;
+using dog0752::dynobj::Parallel;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "parallel");
+	Factory factory;
+
+	const auto price = factory.intern("price");
+	const auto qty = factory.intern("qty");
+	const auto total = factory.intern("total");
+	const Factory::Identifier extras[] = {factory.intern("a"), factory.intern("b"),
+										  factory.intern("c")};
+
+	constexpr size_t count = 65536;
+	const auto build = [&](size_t n)
+	{
+		std::vector<std::unique_ptr<DynObject>> objects;
+		for (size_t i = 0; i < n; ++i)
+		{
+			objects.push_back(factory.createObject());
+			DynObject &o = *objects.back();
+			/* 4 shapes: 0 to 3 extra properties in front */
+			for (size_t e = 0; e < i % 4; ++e)
+				o.set(factory, extras[e], 0);
+			o.set(factory, price, int(i % 100));
+			o.set(factory, qty, int(i % 7));
+			o.set(factory, total, 0);
+		}
+		std::shuffle(objects.begin(), objects.end(), std::mt19937(42));
+		return objects;
+	};
+	auto objects = build(count);
+
+	/* body(k) handles k objects, n in all */
+	const auto batches = [&](uint64_t n, auto &&body)
+	{
+		for (uint64_t done = 0; done < n; done += count)
+			body(std::min<uint64_t>(count, n - done));
+	};
+	const auto first = [&](uint64_t k)
+	{ return std::span(objects).first(k); };
+
+	runner.run("loop",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   DynObject &o = *objects[i % count];
+					   o.set(factory, total,
+							 o.get<int>(price).value() * o.get<int>(qty).value());
+				   }
+			   });
+
+	for (unsigned threads = 0; threads < 4; ++threads)
+	{
+		Parallel parallel(threads);
+		runner.run("transform/helpers=" + std::to_string(threads),
+				   [&](uint64_t n)
+				   {
+					   batches(n,
+							   [&](uint64_t k)
+							   {
+								   doNotOptimize(parallel.transform<int, int, int>(
+									   factory, first(k), total, {price, qty},
+									   [](int p, int q) { return p * q; }));
+							   });
+				   });
+		runner.run("reduce/helpers=" + std::to_string(threads),
+				   [&](uint64_t n)
+				   {
+					   batches(n,
+							   [&](uint64_t k)
+							   {
+								   doNotOptimize(parallel.reduce(
+									   first(k), 0L,
+									   [&](DynObject &o)
+									   { return long(o.get<int>(price).value()); },
+									   [](long a, long b) { return a + b; }));
+							   });
+				   });
+	}
+
+	return runner.finish();
+}
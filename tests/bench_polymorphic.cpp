@@ -0,0 +1,54 @@
+/**
+ * polymorphic access: the same key read from objects of 1, 4 or 16
+ * different shapes, interleaved. every shape has the key at a different
+ * position in its chain, as happens when objects are built in different
+ * orders.
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "polymorphic");
+	Factory factory;
+
+	const Factory::Identifier target = factory.intern("x");
+	std::vector<Factory::Identifier> filler;
+	for (int i = 0; i < 16; ++i)
+		filler.push_back(factory.intern("f" + std::to_string(i)));
+
+	for (int shapes : {1, 4, 16})
+	{
+		/* 256 objects, shape i % shapes, in a fixed interleaved order */
+		std::vector<std::unique_ptr<Factory::DynObject>> objects;
+		for (int i = 0; i < 256; ++i)
+		{
+			const int s = i % shapes;
+			auto obj = factory.createObject();
+			/* shape s: s filler properties, then x, then the rest */
+			for (int f = 0; f < s; ++f)
+				obj->set(factory, filler[f], f);
+			obj->set(factory, target, i);
+			for (int f = s; f < 16; ++f)
+				obj->set(factory, filler[f], f);
+			objects.push_back(std::move(obj));
+		}
+
+		runner.run("get_int/shapes=" + std::to_string(shapes),
+				   [&](uint64_t n)
+				   {
+					   size_t idx = 0;
+					   for (uint64_t i = 0; i < n; ++i)
+					   {
+						   doNotOptimize(objects[idx]->get<int>(target));
+						   idx = (idx + 1) & 255;
+					   }
+				   });
+	}
+
+	return runner.finish();
+}
@@ -0,0 +1,74 @@
+/**
+ * prototype chain lookups. the property lives on the object at the end of
+ * a chain of `depth` prototypes; every object on the way has a few own
+ * properties of its own so each miss is a real shape walk. the frozen
+ * cases do the same lookups once the whole chain is frozen.
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "proto");
+	Factory factory;
+
+	const Factory::Identifier target = factory.intern("inherited");
+	const Factory::Identifier missing = factory.intern("missing");
+	std::vector<Factory::Identifier> own;
+	for (int i = 0; i < 4; ++i)
+		own.push_back(factory.intern("own" + std::to_string(i)));
+
+	for (int depth : {0, 1, 2, 4, 8})
+	{
+		std::shared_ptr<Factory::DynObject> root = factory.createObject();
+		root->set(factory, target, 42);
+
+		std::shared_ptr<Factory::DynObject> obj = root;
+		for (int d = 0; d < depth; ++d)
+		{
+			std::shared_ptr<Factory::DynObject> child = factory.createObject();
+			for (auto key : own)
+				child->set(factory, key, d);
+			child->prototype = obj;
+			obj = child;
+		}
+
+		const std::string suffix = "/depth=" + std::to_string(depth);
+		runner.run("get_hit" + suffix,
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(obj->get<int>(target));
+				   });
+		runner.run("get_miss" + suffix,
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(obj->get<int>(missing));
+				   });
+
+		std::vector<Factory::DynObject *> chain;
+		for (auto *p = obj.get(); p; p = p->prototype.get())
+			chain.push_back(p);
+		for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+			(*it)->freeze();
+		runner.run("get_hit/frozen" + suffix,
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(obj->get<int>(target));
+				   });
+		runner.run("get_miss/frozen" + suffix,
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+						   doNotOptimize(obj->get<int>(missing));
+				   });
+	}
+
+	return runner.finish();
+}
@@ -0,0 +1,95 @@
+/**
+ * a small rule, `total = price * qty; total > limit`, evaluated over 1024
+ * objects of one shape. "closures" is the rule built the old way, a tree
+ * of std::functions that call get/set; "script" is the same rule as a
+ * Script. the call cases run a method found on a frozen prototype.
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using DynObject = Factory::DynObject;
+using dog0752::dynobj::Script;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "script");
+	Factory factory;
+
+	const auto price = factory.intern("price");
+	const auto qty = factory.intern("qty");
+	const auto limit = factory.intern("limit");
+	const auto total = factory.intern("total");
+	const auto discount = factory.intern("discount");
+
+	std::shared_ptr<DynObject> proto = factory.createObject();
+	proto->defineMethod(factory, discount,
+						[](DynObject &, void *, std::span<std::any> args) -> std::any
+						{ return std::any_cast<int>(args[0]) / 10; });
+	proto->freeze();
+
+	std::vector<std::unique_ptr<DynObject>> objects;
+	for (int i = 0; i < 1024; ++i)
+	{
+		objects.push_back(factory.createObject());
+		objects.back()->set(factory, price, i % 100);
+		objects.back()->set(factory, qty, i % 7);
+		objects.back()->set(factory, limit, 100.0);
+		objects.back()->set(factory, total, 0);
+		objects.back()->prototype = proto;
+	}
+
+	using Node = std::function<std::any(DynObject &)>;
+	const auto get = [](Factory::Identifier key) -> Node
+	{ return [key](DynObject &o) { return o.get<std::any>(key).value(); }; };
+	const Node product = [l = get(price), r = get(qty)](DynObject &o) -> std::any
+	{ return std::any_cast<int>(l(o)) * std::any_cast<int>(r(o)); };
+	const Node assign = [&factory, product, total](DynObject &o) -> std::any
+	{
+		std::any v = product(o);
+		o.set(factory, total, v);
+		return v;
+	};
+	const Node rule = [assign, l = get(total), r = get(limit)](DynObject &o) -> std::any
+	{
+		assign(o);
+		return int(std::any_cast<int>(l(o)) > std::any_cast<double>(r(o)));
+	};
+
+	runner.run("rule/closures",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(rule(*objects[i & 1023]));
+			   });
+
+	auto script = Script::compile(factory, "total = price * qty; total > limit");
+	runner.run("rule/script",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(script->run(factory, *objects[i & 1023]));
+			   });
+
+	auto call = Script::compile(factory, "price - discount(price)");
+	runner.run("call/script",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(call->run(factory, *objects[i & 1023]));
+			   });
+	runner.run("call/direct",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   DynObject &o = *objects[i & 1023];
+					   const int p = o.get<int>(price).value();
+					   doNotOptimize(p - o.call<int>(discount, {p}).value());
+				   }
+			   });
+
+	return runner.finish();
+}
@@ -0,0 +1,122 @@
+/**
+ * loading from a snapshot. flat is an object with four plain properties.
+ * cycle is one of two objects referring to each other, loaded and then
+ * unlinked again (shared_ptr cycles don't free themselves). chain is the
+ * head of 1000 objects, each referring to the next; the loader walks
+ * such graphs in loops, not recursion. before timing, the cycle is
+ * checked to come back linked up, and a snapshot with a prototype chain
+ * leading out of the object table to be refused
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using DynObject = Factory::DynObject;
+using dog0752::dynobj::Snapshot;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "snapshot");
+	Factory factory;
+	const auto next = factory.intern("next");
+	const auto value = factory.intern("value");
+
+	std::shared_ptr<DynObject> flat = factory.createObject();
+	for (const char *name : {"a", "b", "c", "d"})
+		flat->set(factory, factory.intern(name), 1);
+
+	std::shared_ptr<DynObject> a = factory.createObject();
+	std::shared_ptr<DynObject> b = factory.createObject();
+	a->set(factory, next, b);
+	b->set(factory, next, a);
+	a->set(factory, value, 1);
+	b->set(factory, value, 2);
+
+	std::vector<std::shared_ptr<DynObject>> chain;
+	std::vector<const DynObject *> chain_objects;
+	for (int i = 0; i < 1000; ++i)
+	{
+		chain.push_back(factory.createObject());
+		chain.back()->set(factory, value, i);
+		if (i > 0)
+			chain[i - 1]->set(factory, next, chain[i]);
+		chain_objects.push_back(chain.back().get());
+	}
+
+	auto flat_snap =
+		Snapshot::fromBytes(*Snapshot::serialize(factory, {flat.get()}));
+	auto cycle_bytes = *Snapshot::serialize(factory, {a.get(), b.get()});
+	auto cycle_snap = Snapshot::fromBytes(cycle_bytes);
+	auto chain_snap =
+		Snapshot::fromBytes(*Snapshot::serialize(factory, chain_objects));
+	a->remove(factory, next);
+
+	Factory loader;
+	const auto loaded_next = loader.intern("next");
+	{
+		/* first -> second -> a shared copy of first */
+		auto first = cycle_snap->load(loader, 0);
+		std::shared_ptr<DynObject> second, back;
+		if (first)
+			second = (*first)
+						 ->get<std::shared_ptr<DynObject>>(loaded_next)
+						 .value_or(nullptr);
+		if (second)
+			back = second->get<std::shared_ptr<DynObject>>(loaded_next)
+					   .value_or(nullptr);
+		if (!back || back->get<int>(loader.intern("value")) != 1)
+		{
+			std::fprintf(stderr, "cycle didn't load\n");
+			return 1;
+		}
+		second->remove(loader, loaded_next);
+	}
+
+	/**
+	 * object 0's prototype is object 1, whose prototype index points far
+	 * past the object table: the chain from 0 must not be followed there
+	 */
+	uint64_t objects_at;
+	std::memcpy(&objects_at, cycle_bytes.data() + 56, sizeof(objects_at));
+	const uint32_t one = 1, nowhere = 0x7ffffff0;
+	std::memcpy(cycle_bytes.data() + objects_at + 4, &one, sizeof(one));
+	std::memcpy(cycle_bytes.data() + objects_at + 32 + 4, &nowhere,
+				sizeof(nowhere));
+	if (Snapshot::fromBytes(cycle_bytes))
+	{
+		std::fprintf(stderr, "corrupt prototype accepted\n");
+		return 1;
+	}
+
+	runner.run("load/flat",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(flat_snap->load(loader, 0));
+			   });
+	runner.run("load/cycle",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   auto obj = cycle_snap->load(loader, 0);
+					   auto other =
+						   (*obj)->get<std::shared_ptr<DynObject>>(loaded_next);
+					   (*other)->remove(loader, loaded_next);
+					   doNotOptimize(obj);
+				   }
+			   });
+	runner.run("load/chain",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(chain_snap->load(loader, 0));
+			   });
+
+	return runner.finish();
+}
@@ -0,0 +1,100 @@
+/**
+ * multithreaded scaling. build with -DDYNOBJECT_MULTITHREADED to measure
+ * the real locks; without it the numbers show the lock-free upper bound.
+ *
+ * shared_get: every thread reads the same object (shared lock contention)
+ * frozen_get: the same, on a frozen copy of it (no lock at all)
+ * own_set:    every thread rewrites its own object (no sharing)
+ * build:      every thread builds fresh objects (factory lock contention)
+ * intern:     every thread interns existing strings (interner lock)
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "threads");
+	Factory factory;
+
+	std::vector<Factory::Identifier> keys;
+	std::vector<std::string> names;
+	for (int i = 0; i < 8; ++i)
+	{
+		names.push_back("k" + std::to_string(i));
+		keys.push_back(factory.intern(names.back()));
+	}
+
+	auto shared = factory.createObject();
+	for (auto key : keys)
+		shared->set(factory, key, 1);
+	auto frozen = factory.createObject();
+	for (auto key : keys)
+		frozen->set(factory, key, 1);
+	frozen->freeze();
+
+	/* keeps the transitions the build case follows alive */
+	auto template_obj = factory.createObject();
+	for (auto key : keys)
+		template_obj->set(factory, key, 0);
+
+	const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+	for (int threads : {1, 2, 4, 8, 16})
+	{
+		if (threads > 1 && static_cast<unsigned>(threads) > 2 * hw)
+			break;
+		const std::string suffix = "/threads=" + std::to_string(threads);
+
+		runner.runThreads("shared_get" + suffix, threads,
+						  [&](int, uint64_t n)
+						  {
+							  for (uint64_t i = 0; i < n; ++i)
+								  doNotOptimize(shared->get<int>(keys[i & 7]));
+						  });
+		runner.runThreads("frozen_get" + suffix, threads,
+						  [&](int, uint64_t n)
+						  {
+							  for (uint64_t i = 0; i < n; ++i)
+								  doNotOptimize(frozen->get<int>(keys[i & 7]));
+						  });
+
+		std::vector<std::unique_ptr<Factory::DynObject>> own;
+		for (int t = 0; t < threads; ++t)
+		{
+			own.push_back(factory.createObject());
+			for (auto key : keys)
+				own.back()->set(factory, key, 0);
+		}
+		runner.runThreads("own_set" + suffix, threads,
+						  [&](int t, uint64_t n)
+						  {
+							  for (uint64_t i = 0; i < n; ++i)
+								  own[t]->set(factory, keys[i & 7], int(i));
+						  });
+
+		/* one op = one property add */
+		runner.runThreads("build" + suffix, threads,
+						  [&](int, uint64_t n)
+						  {
+							  for (uint64_t i = 0; i < n; i += 8)
+							  {
+								  auto obj = factory.createObject();
+								  for (auto key : keys)
+									  obj->set(factory, key, 0);
+								  doNotOptimize(obj);
+							  }
+						  });
+
+		runner.runThreads("intern" + suffix, threads,
+						  [&](int, uint64_t n)
+						  {
+							  for (uint64_t i = 0; i < n; ++i)
+								  doNotOptimize(factory.intern(names[i & 7]));
+						  });
+	}
+
+	return runner.finish();
+}
@@ -0,0 +1,69 @@
+/**
+ * shape transitions: building objects property by property.
+ *
+ * "cached" follows transitions that already exist in the transition tree,
+ * which is the common case of many objects built the same way. "fresh"
+ * adds a property no shape has seen before, so every add creates a shape.
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "transition");
+	Factory factory;
+
+	for (int props : {1, 4, 16})
+	{
+		std::vector<Factory::Identifier> keys;
+		for (int i = 0; i < props; ++i)
+			keys.push_back(factory.intern("t" + std::to_string(i)));
+
+		/* keep one object alive so the cached shapes aren't released */
+		auto keep_alive = factory.createObject();
+		for (auto key : keys)
+			keep_alive->set(factory, key, 0);
+
+		/* one op = one property add, object creation included */
+		runner.run("build_cached/props=" + std::to_string(props),
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; i += props)
+					   {
+						   auto obj = factory.createObject();
+						   for (auto key : keys)
+							   obj->set(factory, key, 0);
+						   doNotOptimize(obj);
+					   }
+				   });
+	}
+
+	{
+		/**
+		 * the keys are interned up front so the interner isn't part of
+		 * the measurement. transitions are only cached weakly and each
+		 * object dies right away, so every add has to create its shape
+		 */
+		std::vector<Factory::Identifier> keys;
+		for (int i = 0; i < 4096; ++i)
+			keys.push_back(factory.intern("fresh" + std::to_string(i)));
+
+		uint64_t next = 0;
+		runner.run("add_fresh",
+				   [&](uint64_t n)
+				   {
+					   for (uint64_t i = 0; i < n; ++i)
+					   {
+						   auto obj = factory.createObject();
+						   obj->set(factory, keys[next++ % keys.size()], 0);
+						   doNotOptimize(obj);
+					   }
+				   });
+	}
+
+	return runner.finish();
+}
@@ -0,0 +1,77 @@
+/**
+ * weak references. upgrade is getting the object back from a weak
+ * reference to one of 1024 objects: a std::weak_ptr::lock of a shared_ptr
+ * owned object next to DynObject::Weak::get. memo is a hit in a per
+ * object cache, a plain unordered_map keyed by pointer (which pins
+ * nothing but dangles) next to a WeakMap. churn is an object that gets a
+ * WeakMap entry and dies, the entry going with it
+ */
+
+#include "bench.hpp"
+#include "../dynobject.hpp"
+
+using dog0752::bench::doNotOptimize;
+using Factory = dog0752::dynobj::ObjectFactory;
+using DynObject = Factory::DynObject;
+using dog0752::dynobj::WeakMap;
+
+int main(int argc, char **argv)
+{
+	dog0752::bench::Runner runner(argc, argv, "weak");
+	Factory factory;
+
+	std::vector<std::shared_ptr<DynObject>> objects;
+	std::vector<std::weak_ptr<DynObject>> std_weak;
+	std::vector<DynObject::Weak> weak;
+	for (int i = 0; i < 1024; ++i)
+	{
+		objects.push_back(factory.createObject());
+		std_weak.push_back(objects.back());
+		weak.push_back(objects.back()->weak());
+	}
+
+	runner.run("upgrade/weak_ptr",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(std_weak[i & 1023].lock());
+			   });
+	runner.run("upgrade/weak",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(weak[i & 1023].get());
+			   });
+
+	std::unordered_map<const DynObject *, int> plain;
+	WeakMap<int> memo;
+	for (int i = 0; i < 1024; ++i)
+	{
+		plain[objects[i].get()] = i;
+		memo.set(*objects[i], i);
+	}
+	runner.run("memo/unordered_map",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(plain.find(objects[i & 1023].get())->second);
+			   });
+	runner.run("memo/weak_map",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+					   doNotOptimize(memo.get(*objects[i & 1023]));
+			   });
+
+	runner.run("churn/weak_map",
+			   [&](uint64_t n)
+			   {
+				   for (uint64_t i = 0; i < n; ++i)
+				   {
+					   auto obj = factory.createObject();
+					   memo.set(*obj, int(i));
+				   }
+			   });
+
+	return runner.finish();
+}
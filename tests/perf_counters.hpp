@@ -0,0 +1,210 @@
+/**
+ * COPYRIGHT 2025 dog0752
+ * this file is licensed under the dog0752-license-⑨.⑨
+ *
+ * optional hardware performance counters for the benchmark harness, read
+ * through linux perf_event_open. only user space is counted so it works
+ * with the default perf_event_paranoid setting.
+ *
+ * every event is opened on its own (not as a group) so whatever the cpu
+ * and kernel support gets counted and the rest is just missing. when the
+ * pmu has fewer counters than events the kernel multiplexes them; the
+ * values are scaled by time_enabled / time_running like perf stat does.
+ *
+ * on anything that isn't linux, or in a container/vm without a pmu, every
+ * event fails to open and available() is false. the harness then simply
+ * leaves the columns out.
+ */
+
+#ifndef DYNOBJECT_PERF_COUNTERS_HPP
+#define DYNOBJECT_PERF_COUNTERS_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define DYNOBJECT_HAVE_PERF_EVENTS 1
+#endif
+
+namespace dog0752
+{
+namespace bench
+{
+
+enum class PerfEvent
+{
+	cycles,
+	instructions,
+	branch_misses,
+	l1d_misses,
+	llc_misses,
+	dtlb_misses,
+	count_ /* number of events, keep last */
+};
+
+inline constexpr size_t perf_event_count = static_cast<size_t>(PerfEvent::count_);
+
+/* short names used for the output columns */
+inline const char *perfEventName(PerfEvent e)
+{
+	switch (e)
+	{
+	case PerfEvent::cycles:
+		return "cycles";
+	case PerfEvent::instructions:
+		return "instructions";
+	case PerfEvent::branch_misses:
+		return "branch_misses";
+	case PerfEvent::l1d_misses:
+		return "l1d_misses";
+	case PerfEvent::llc_misses:
+		return "llc_misses";
+	case PerfEvent::dtlb_misses:
+		return "dtlb_misses";
+	case PerfEvent::count_:
+		break;
+	}
+	return "?";
+}
+
+/* a counter reading, nullopt for events that couldn't be opened */
+using PerfSample = std::array<std::optional<double>, perf_event_count>;
+
+class PerfCounters
+{
+public:
+	PerfCounters()
+	{
+		fds_.fill(-1);
+#ifdef DYNOBJECT_HAVE_PERF_EVENTS
+		open(PerfEvent::cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		open(PerfEvent::instructions, PERF_TYPE_HARDWARE,
+			 PERF_COUNT_HW_INSTRUCTIONS);
+		open(PerfEvent::branch_misses, PERF_TYPE_HARDWARE,
+			 PERF_COUNT_HW_BRANCH_MISSES);
+		open(PerfEvent::l1d_misses, PERF_TYPE_HW_CACHE,
+			 cacheConfig(PERF_COUNT_HW_CACHE_L1D));
+		open(PerfEvent::llc_misses, PERF_TYPE_HW_CACHE,
+			 cacheConfig(PERF_COUNT_HW_CACHE_LL));
+		open(PerfEvent::dtlb_misses, PERF_TYPE_HW_CACHE,
+			 cacheConfig(PERF_COUNT_HW_CACHE_DTLB));
+#endif
+	}
+
+	~PerfCounters()
+	{
+#ifdef DYNOBJECT_HAVE_PERF_EVENTS
+		for (int fd : fds_)
+		{
+			if (fd >= 0)
+				::close(fd);
+		}
+#endif
+	}
+
+	PerfCounters(const PerfCounters &) = delete;
+	PerfCounters &operator=(const PerfCounters &) = delete;
+
+	/* true if at least one event could be opened */
+	bool available() const
+	{
+		for (int fd : fds_)
+		{
+			if (fd >= 0)
+				return true;
+		}
+		return false;
+	}
+
+	bool available(PerfEvent e) const
+	{
+		return fds_[static_cast<size_t>(e)] >= 0;
+	}
+
+	/**
+	 * the counters run all the time (they're only ever opened for the
+	 * calling thread), a measurement is the difference of two reads
+	 */
+	PerfSample read() const
+	{
+		PerfSample sample;
+#ifdef DYNOBJECT_HAVE_PERF_EVENTS
+		for (size_t i = 0; i < perf_event_count; ++i)
+		{
+			if (fds_[i] < 0)
+				continue;
+			/* value, time_enabled, time_running */
+			uint64_t buf[3];
+			if (::read(fds_[i], buf, sizeof(buf)) != sizeof(buf))
+				continue;
+			double value = static_cast<double>(buf[0]);
+			if (buf[2] != 0 && buf[2] < buf[1])
+				value *= static_cast<double>(buf[1]) / buf[2];
+			sample[i] = value;
+		}
+#endif
+		return sample;
+	}
+
+	/* end - start, per operation */
+	static PerfSample perOp(const PerfSample &start, const PerfSample &end,
+							double ops)
+	{
+		PerfSample result;
+		for (size_t i = 0; i < perf_event_count; ++i)
+		{
+			if (start[i] && end[i])
+				result[i] = (*end[i] - *start[i]) / ops;
+		}
+		return result;
+	}
+
+	/* instructions per cycle out of a (per op) sample */
+	static std::optional<double> ipc(const PerfSample &s)
+	{
+		const auto &cyc = s[static_cast<size_t>(PerfEvent::cycles)];
+		const auto &ins = s[static_cast<size_t>(PerfEvent::instructions)];
+		if (!cyc || !ins || *cyc == 0)
+			return std::nullopt;
+		return *ins / *cyc;
+	}
+
+private:
+#ifdef DYNOBJECT_HAVE_PERF_EVENTS
+	static uint64_t cacheConfig(uint64_t cache)
+	{
+		return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	}
+
+	void open(PerfEvent e, uint32_t type, uint64_t config)
+	{
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format =
+			PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		/* pid 0, cpu -1: this thread, on whatever cpu it runs */
+		const long fd = ::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		fds_[static_cast<size_t>(e)] = static_cast<int>(fd);
+	}
+#endif
+
+	std::array<int, perf_event_count> fds_;
+};
+
+} /* namespace bench */
+} /* namespace dog0752 */
+
+#endif /* #ifndef DYNOBJECT_PERF_COUNTERS_HPP */